@@ -0,0 +1,170 @@
+/* auth-cookie.c: check signed authentication cookies without the auth filter
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * Running the auth filter for every request adds its start-up time, and
+ * whatever it does to check a cookie, to every page. If the filter signs
+ * its cookies with a secret it shares with cgit, cgit can check them
+ * itself, and the filter is only run for cookies that fail the check
+ * and, once per cache-auth-ttl, to decide whether a user may see a
+ * repository.
+ *
+ * The cookies are those of filters/simple-authentication.lua: the URL
+ * encoded form of
+ *   field|value|expiry|salt|hmac
+ * where field is "username", value the URL encoded user name, expiry a
+ * Unix time (0 for none), and hmac the hex HMAC-SHA1 of everything
+ * before the last "|", keyed with the secret.
+ */
+
+#include "cgit.h"
+#include "auth-cookie.h"
+
+#define HMAC_BLOCK_SIZE 64
+
+static void hmac_sha1(unsigned char *out, const char *key, size_t keylen,
+		      const char *msg, size_t msglen)
+{
+	unsigned char k[HMAC_BLOCK_SIZE], pad[HMAC_BLOCK_SIZE], inner[20];
+	git_SHA_CTX c;
+	int i;
+
+	memset(k, 0, sizeof(k));
+	if (keylen > HMAC_BLOCK_SIZE) {
+		git_SHA1_Init(&c);
+		git_SHA1_Update(&c, key, keylen);
+		git_SHA1_Final(k, &c);
+	} else {
+		memcpy(k, key, keylen);
+	}
+
+	for (i = 0; i < HMAC_BLOCK_SIZE; i++)
+		pad[i] = k[i] ^ 0x36;
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, pad, sizeof(pad));
+	git_SHA1_Update(&c, msg, msglen);
+	git_SHA1_Final(inner, &c);
+
+	for (i = 0; i < HMAC_BLOCK_SIZE; i++)
+		pad[i] = k[i] ^ 0x5c;
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, pad, sizeof(pad));
+	git_SHA1_Update(&c, inner, sizeof(inner));
+	git_SHA1_Final(out, &c);
+}
+
+static void url_decode(struct strbuf *out, const char *txt, size_t len)
+{
+	const char *end = txt + len;
+	int d1, d2;
+
+	for (; txt < end; txt++) {
+		if (*txt == '+') {
+			strbuf_addch(out, ' ');
+		} else if (*txt == '%' && end - txt >= 3 &&
+			   (d1 = hexval(txt[1])) >= 0 &&
+			   (d2 = hexval(txt[2])) >= 0) {
+			strbuf_addch(out, d1 << 4 | d2);
+			txt += 2;
+		} else {
+			strbuf_addch(out, *txt);
+		}
+	}
+}
+
+/* The value of cookie `name` in a Cookie header, URL decoded */
+static int get_cookie(struct strbuf *out, const char *cookies,
+		      const char *name)
+{
+	size_t namelen = strlen(name);
+	const char *p = cookies, *end;
+
+	while (p && *p) {
+		while (*p == ' ' || *p == ';')
+			p++;
+		end = strchrnul(p, ';');
+		if (!strncmp(p, name, namelen) && p[namelen] == '=') {
+			p += namelen + 1;
+			while (end > p && end[-1] == ' ')
+				end--;
+			url_decode(out, p, end - p);
+			return 0;
+		}
+		p = end;
+	}
+	return -1;
+}
+
+/* Compare in constant time, so the signature cannot be guessed from
+ * how long checking it takes.
+ */
+static int hex_differs(const char *a, const char *b, size_t len)
+{
+	unsigned char diff = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		diff |= a[i] ^ b[i];
+	return diff;
+}
+
+char *cgit_check_auth_cookie(const char *cookies, const char *name,
+			     const char *secret)
+{
+	struct strbuf cookie = STRBUF_INIT;
+	struct strbuf field = STRBUF_INIT;
+	struct strbuf user = STRBUF_INIT;
+	unsigned char hmac[20];
+	const char *parts[5], *p, *sig;
+	char *end;
+	uintmax_t expiry;
+	int i;
+
+	if (!cookies || get_cookie(&cookie, cookies, name))
+		goto fail;
+
+	/* field|value|expiry|salt|hmac */
+	p = cookie.buf;
+	for (i = 0; i < 5; i++) {
+		parts[i] = p;
+		p = strchr(p, '|');
+		if (!p)
+			break;
+		p++;
+	}
+	if (i != 4)
+		goto fail;
+	sig = parts[4];
+	if (strlen(sig) != 40)
+		goto fail;
+	hmac_sha1(hmac, secret, strlen(secret), cookie.buf,
+		  sig - 1 - cookie.buf);
+	if (hex_differs(sha1_to_hex(hmac), sig, 40))
+		goto fail;
+
+	expiry = strtoumax(parts[2], &end, 10);
+	if (end == parts[2] || *end != '|' ||
+	    (expiry && expiry <= (uintmax_t)time(NULL)))
+		goto fail;
+
+	url_decode(&field, parts[0], parts[1] - 1 - parts[0]);
+	if (strcmp(field.buf, "username"))
+		goto fail;
+	url_decode(&user, parts[1], parts[2] - 1 - parts[1]);
+	if (!user.len)
+		goto fail;
+
+	strbuf_release(&cookie);
+	strbuf_release(&field);
+	return strbuf_detach(&user, NULL);
+
+fail:
+	strbuf_release(&cookie);
+	strbuf_release(&field);
+	strbuf_release(&user);
+	return NULL;
+}
@@ -0,0 +1,12 @@
+#ifndef AUTH_COOKIE_H
+#define AUTH_COOKIE_H
+
+/* Check the cookie `name` among `cookies` (an HTTP Cookie header), as
+ * signed with `secret` by filters/simple-authentication.lua. Returns the
+ * user name it carries if it is valid and has not expired, which the
+ * caller must free, and NULL otherwise.
+ */
+extern char *cgit_check_auth_cookie(const char *cookies, const char *name,
+				    const char *secret);
+
+#endif /* AUTH_COOKIE_H */
@@ -0,0 +1,276 @@
+/* author-stats.c: persistent commit counts per author and day
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The stats page shows the number of commits per author for a dozen
+ * weeks, months, quarters or years. Instead of walking all of that
+ * history on every view, we count the commits per author and UTC day
+ * once, and keep the counts in a data file in the cache directory. All
+ * periods are made of whole days, so any of them can be answered by
+ * adding up day buckets.
+ *
+ * There is one file per repository and branch. When the branch
+ * advances, only the new commits are counted; if it has been rewritten,
+ * or a longer history is asked for than the file covers, the counts are
+ * rebuilt.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGST" version tip-sha1 since nr_authors nr_buckets
+ *   nr_buckets * (author day count)    sorted by author and day
+ *   names                              \0-terminated, by author number
+ */
+
+#include "cgit.h"
+#include "cache.h"
+#include "author-stats.h"
+
+#define STATS_SIGNATURE "CGST"
+#define STATS_VERSION 1
+#define STATS_HEADER_SIZE (4 + 4 + 20 + 4 + 4 + 4)
+#define STATS_BUCKET_SIZE 12
+#define DAY_SECS (60 * 60 * 24)
+
+struct stats_file {
+	unsigned char tip[20];
+	uint32_t since;
+	uint32_t nr_authors;
+	uint32_t nr_buckets;
+	const unsigned char *buckets;
+	const char **authors;
+};
+
+struct bucket {
+	const char *author;
+	uint32_t day;
+	uint32_t count;
+};
+
+struct bucket_list {
+	struct bucket *items;
+	int nr, alloc;
+};
+
+static int parse_stats(struct stats_file *st, const char *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	const char *name, *end;
+	size_t size;
+	uint32_t i;
+
+	if (len < STATS_HEADER_SIZE || memcmp(p, STATS_SIGNATURE, 4) ||
+	    get_be32(p + 4) != STATS_VERSION)
+		return -1;
+	hashcpy(st->tip, p + 8);
+	st->since = get_be32(p + 28);
+	st->nr_authors = get_be32(p + 32);
+	st->nr_buckets = get_be32(p + 36);
+	size = STATS_HEADER_SIZE + (size_t)st->nr_buckets * STATS_BUCKET_SIZE;
+	if (len < size || len - size < st->nr_authors)
+		return -1;
+	st->buckets = p + STATS_HEADER_SIZE;
+
+	st->authors = xcalloc(st->nr_authors, sizeof(*st->authors));
+	name = buf + size;
+	end = buf + len;
+	for (i = 0; i < st->nr_authors; i++) {
+		st->authors[i] = name;
+		name = memchr(name, '\0', end - name);
+		if (!name)
+			break;
+		name++;
+	}
+	for (i = 0; name && i < st->nr_buckets; i++)
+		if (get_be32(st->buckets + (size_t)i * STATS_BUCKET_SIZE) >=
+		    st->nr_authors)
+			name = NULL;
+	if (!name) {
+		free(st->authors);
+		st->authors = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static void add_bucket(struct bucket_list *list, const char *author,
+		       uint32_t day, uint32_t count)
+{
+	ALLOC_GROW(list->items, list->nr + 1, list->alloc);
+	list->items[list->nr].author = author;
+	list->items[list->nr].day = day;
+	list->items[list->nr].count = count;
+	list->nr++;
+}
+
+static int bucket_cmp(const void *a, const void *b)
+{
+	const struct bucket *ba = a, *bb = b;
+	int cmp = strcmp(ba->author, bb->author);
+
+	if (cmp)
+		return cmp;
+	return ba->day < bb->day ? -1 : ba->day > bb->day;
+}
+
+/* Add one bucket per new commit reachable from `tip` but not from
+ * `old_tip`, and committed on or after day `since`. The author names
+ * are owned by `names`.
+ */
+static void count_new_commits(struct bucket_list *list,
+			      struct string_list *names,
+			      const unsigned char *tip,
+			      const unsigned char *old_tip, uint32_t since)
+{
+	struct rev_info rev;
+	struct commit *commit;
+	struct commitinfo *info;
+	struct object *obj;
+
+	init_revisions(&rev, NULL);
+	rev.max_parents = 1;
+	rev.max_age = (unsigned long)since * DAY_SECS;
+	obj = parse_object(tip);
+	if (!obj)
+		return;
+	add_pending_object(&rev, obj, "tip");
+	if (old_tip && (obj = parse_object(old_tip))) {
+		obj->flags |= UNINTERESTING;
+		add_pending_object(&rev, obj, "old-tip");
+	}
+	if (prepare_revision_walk(&rev))
+		return;
+	while ((commit = get_revision(&rev)) != NULL) {
+		info = cgit_parse_commit(commit);
+		if (info->author)
+			add_bucket(list,
+				   string_list_insert(names, info->author)->string,
+				   info->committer_date / DAY_SECS, 1);
+		cgit_free_commitinfo(info);
+		free_commit_buffer(commit);
+	}
+	clear_object_flags(ALL_REV_FLAGS);
+}
+
+/* Serialize the buckets, merging those for the same author and day */
+static void write_stats(struct strbuf *out, const unsigned char *tip,
+			uint32_t since, struct bucket_list *list)
+{
+	struct strbuf buckets = STRBUF_INIT;
+	struct strbuf names = STRBUF_INIT;
+	uint32_t nr_authors = 0, nr_buckets = 0, count;
+	const char *author = NULL;
+	int i, j;
+
+	qsort(list->items, list->nr, sizeof(*list->items), bucket_cmp);
+	for (i = 0; i < list->nr; i = j) {
+		if (!author || strcmp(author, list->items[i].author)) {
+			author = list->items[i].author;
+			strbuf_add(&names, author, strlen(author) + 1);
+			nr_authors++;
+		}
+		count = 0;
+		for (j = i; j < list->nr && !bucket_cmp(&list->items[i],
+							 &list->items[j]); j++)
+			count += list->items[j].count;
+		cache_add_be32(&buckets, nr_authors - 1);
+		cache_add_be32(&buckets, list->items[i].day);
+		cache_add_be32(&buckets, count);
+		nr_buckets++;
+	}
+
+	strbuf_add(out, STATS_SIGNATURE, 4);
+	cache_add_be32(out, STATS_VERSION);
+	strbuf_add(out, tip, 20);
+	cache_add_be32(out, since);
+	cache_add_be32(out, nr_authors);
+	cache_add_be32(out, nr_buckets);
+	strbuf_addbuf(out, &buckets);
+	strbuf_addbuf(out, &names);
+	strbuf_release(&buckets);
+	strbuf_release(&names);
+}
+
+static int is_ancestor(const unsigned char *old_tip, const unsigned char *tip)
+{
+	struct commit *old_commit, *commit;
+
+	old_commit = lookup_commit_reference_gently(old_tip, 1);
+	commit = lookup_commit_reference_gently(tip, 1);
+	if (!old_commit || !commit || parse_commit(old_commit))
+		return 0;
+	return in_merge_bases(old_commit, commit);
+}
+
+int cgit_author_stats_foreach(const char *ref, unsigned long since,
+			      author_stats_fn fn, void *data)
+{
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct bucket_list list = { NULL, 0, 0 };
+	struct strbuf buf = STRBUF_INIT;
+	struct stats_file st, *old;
+	struct cache_data file;
+	const unsigned char *b;
+	unsigned char tip[20];
+	char *refname, *key;
+	uint32_t i;
+
+	/* Without a place to keep the counts, walking is cheaper */
+	if (ctx.cfg.cache_size <= 0)
+		return -1;
+
+	/* Only branches get a data file */
+	refname = cgit_branch_refname(ref);
+	if (!refname)
+		return -1;
+	if (get_sha1_committish(refname, tip)) {
+		free(refname);
+		return -1;
+	}
+
+	key = fmtalloc("%s\n%s", ctx.repo->path, refname);
+	free(refname);
+	old = NULL;
+	if (!cache_open_data(&file, "stats", key) &&
+	    !parse_stats(&st, file.buf, file.len))
+		old = &st;
+
+	if (!old || old->since > since || hashcmp(old->tip, tip)) {
+		if (old && (old->since > since || !is_ancestor(old->tip, tip))) {
+			free(old->authors);
+			old = NULL;
+		}
+		for (i = 0; old && i < old->nr_buckets; i++) {
+			b = old->buckets + (size_t)i * STATS_BUCKET_SIZE;
+			add_bucket(&list, old->authors[get_be32(b)],
+				   get_be32(b + 4), get_be32(b + 8));
+		}
+		if (old)
+			since = old->since;
+		count_new_commits(&list, &names, tip, old ? old->tip : NULL,
+				  since);
+		write_stats(&buf, tip, since, &list);
+		cache_write_data("stats", key, buf.buf, buf.len);
+		if (old)
+			free(old->authors);
+		cache_close_data(&file);
+		if (parse_stats(&st, buf.buf, buf.len))
+			die("BUG: unable to parse generated author stats");
+	}
+
+	for (i = 0; i < st.nr_buckets; i++) {
+		b = st.buckets + (size_t)i * STATS_BUCKET_SIZE;
+		fn(st.authors[get_be32(b)], get_be32(b + 4), get_be32(b + 8),
+		   data);
+	}
+
+	free(st.authors);
+	cache_close_data(&file);
+	strbuf_release(&buf);
+	string_list_clear(&names, 0);
+	free(list.items);
+	free(key);
+	return 0;
+}
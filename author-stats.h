@@ -0,0 +1,22 @@
+#ifndef AUTHOR_STATS_H
+#define AUTHOR_STATS_H
+
+/* Called once per (author, day) pair with the number of non-merge
+ * commits the author made on that day. Days are counted in UTC since
+ * the epoch, and the pairs are passed in no particular order.
+ */
+typedef void (*author_stats_fn)(const char *author, unsigned long day,
+				unsigned long count, void *data);
+
+/* Report the commits per author and day for the history of `ref`,
+ * going back at least to `since` (a day number as above). The counts
+ * are kept in the cache directory and brought up to date with the
+ * current value of `ref` first, so only new commits are walked.
+ *
+ * Returns 0 on success, and -1 if the counts cannot be kept (in which
+ * case the caller should walk the history).
+ */
+extern int cgit_author_stats_foreach(const char *ref, unsigned long since,
+				     author_stats_fn fn, void *data);
+
+#endif /* AUTHOR_STATS_H */
@@ -0,0 +1,355 @@
+/* blame.c: find the commit that last changed each line of a file
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The blame of a file in a commit follows from the blame of the file in
+ * the commit's parents: a line the commit did not change (according to
+ * a diff against a parent) was last changed wherever it was last changed
+ * in that parent, and every other line was changed by the commit itself.
+ * If a parent has the same version of the file, the blame is the same as
+ * the parent's, and the other parents do not matter.
+ *
+ * So the blame is computed from the oldest commit that changed the file
+ * onwards, and the blame of each commit that changed it is kept in a data
+ * file in the cache directory, keyed by commit and path. Showing the blame
+ * of a new commit then takes its diff and its parents' cached blame;
+ * nothing is ever invalidated, as the history of a commit cannot change.
+ * The blame of the commit asked for is kept too, even if it did not change
+ * the file, so that asking again does not walk back to the one that did.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGBL" version nr_commits nr_lines
+ *   nr_commits * commit-sha1
+ *   nr_lines * commit                  index into the commits above
+ */
+
+#include "cgit.h"
+#include "cache.h"
+#include "blame.h"
+#include <decorate.h>
+
+#define BLAME_SIGNATURE "CGBL"
+#define BLAME_VERSION 1
+#define BLAME_HEADER_SIZE (4 + 4 + 4 + 4)
+
+/* The blame of every commit looked at in this request */
+static struct decoration blames;
+
+struct line_map {
+	struct cgit_blame *blame;
+	struct cgit_blame *parent;
+	long a, b;
+};
+
+static struct cgit_blame *lookup_blame(struct commit *commit)
+{
+	return lookup_decoration(&blames, &commit->object);
+}
+
+static int file_blob(struct commit *commit, const char *path,
+		     unsigned char *sha1)
+{
+	unsigned mode;
+
+	if (parse_commit(commit) ||
+	    get_tree_entry(commit->tree->object.oid.hash, path, sha1, &mode))
+		return -1;
+	return S_ISREG(mode) || S_ISLNK(mode) ? 0 : -1;
+}
+
+static int count_lines(const char *buf, unsigned long size)
+{
+	const char *end = buf + size;
+	int nr = 0;
+
+	while (buf < end) {
+		nr++;
+		buf = memchr(buf, '\n', end - buf);
+		if (!buf)
+			break;
+		buf++;
+	}
+	return nr;
+}
+
+static struct cgit_blame *new_blame(const char *buf, unsigned long size)
+{
+	struct cgit_blame *blame = xcalloc(1, sizeof(*blame));
+
+	blame->nr = count_lines(buf, size);
+	blame->lines = xcalloc(blame->nr ? blame->nr : 1,
+			       sizeof(*blame->lines));
+	return blame;
+}
+
+static struct cgit_blame *read_cached_blame(struct commit *commit,
+					    const char *path,
+					    const char *buf,
+					    unsigned long size)
+{
+	struct cgit_blame *blame = NULL;
+	struct commit **commits;
+	struct cache_data file;
+	const unsigned char *p;
+	uint32_t i, nr, idx;
+	char *key;
+
+	key = fmtalloc("%s\n%s", oid_to_hex(&commit->object.oid), path);
+	if (cache_open_data(&file, "blame", key)) {
+		free(key);
+		return NULL;
+	}
+	free(key);
+
+	p = (const unsigned char *)file.buf;
+	if (file.len < BLAME_HEADER_SIZE || memcmp(p, BLAME_SIGNATURE, 4) ||
+	    get_be32(p + 4) != BLAME_VERSION)
+		goto out;
+	nr = get_be32(p + 8);
+	blame = new_blame(buf, size);
+	if (get_be32(p + 12) != blame->nr ||
+	    file.len != BLAME_HEADER_SIZE + (size_t)nr * 20 +
+			(size_t)blame->nr * 4)
+		goto bad;
+
+	p += BLAME_HEADER_SIZE;
+	commits = xcalloc(nr ? nr : 1, sizeof(*commits));
+	for (i = 0; i < nr; i++, p += 20)
+		commits[i] = lookup_commit(p);
+	for (i = 0; i < blame->nr; i++, p += 4) {
+		idx = get_be32(p);
+		if (idx >= nr || !commits[idx])
+			break;
+		blame->lines[i] = commits[idx];
+	}
+	free(commits);
+	if (i == blame->nr)
+		goto out;
+bad:
+	free(blame->lines);
+	free(blame);
+	blame = NULL;
+out:
+	cache_close_data(&file);
+	return blame;
+}
+
+static void write_cached_blame(struct commit *commit, const char *path,
+			       struct cgit_blame *blame)
+{
+	struct decoration ids = { "blame ids" };
+	struct strbuf commits = STRBUF_INIT;
+	struct strbuf lines = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	uintptr_t id, nr = 0;
+	char *key;
+	int i;
+
+	for (i = 0; i < blame->nr; i++) {
+		id = (uintptr_t)lookup_decoration(&ids, &blame->lines[i]->object);
+		if (!id) {
+			id = ++nr;
+			add_decoration(&ids, &blame->lines[i]->object,
+				       (void *)id);
+			strbuf_add(&commits, blame->lines[i]->object.oid.hash,
+				   20);
+		}
+		cache_add_be32(&lines, id - 1);
+	}
+	free(ids.hash);
+
+	strbuf_add(&buf, BLAME_SIGNATURE, 4);
+	cache_add_be32(&buf, BLAME_VERSION);
+	cache_add_be32(&buf, nr);
+	cache_add_be32(&buf, blame->nr);
+	strbuf_addbuf(&buf, &commits);
+	strbuf_addbuf(&buf, &lines);
+
+	key = fmtalloc("%s\n%s", oid_to_hex(&commit->object.oid), path);
+	cache_write_data("blame", key, buf.buf, buf.len);
+	free(key);
+	strbuf_release(&commits);
+	strbuf_release(&lines);
+	strbuf_release(&buf);
+}
+
+/* Lines up to end_b of the file are the same as those from map->a on in
+ * the parent.
+ */
+static void map_unchanged(struct line_map *map, long end_b)
+{
+	while (map->b < end_b && map->b < map->blame->nr &&
+	       map->a < map->parent->nr) {
+		if (!map->blame->lines[map->b])
+			map->blame->lines[map->b] = map->parent->lines[map->a];
+		map->a++;
+		map->b++;
+	}
+}
+
+static int map_hunk(long start_a, long count_a, long start_b, long count_b,
+		    void *data)
+{
+	struct line_map *map = data;
+
+	map_unchanged(map, start_b);
+	map->a = start_a + count_a;
+	map->b = start_b + count_b;
+	return 0;
+}
+
+/* Take the blame of the lines a parent has too from the parent */
+static void map_lines(struct cgit_blame *blame, struct cgit_blame *parent,
+		      const char *buf, unsigned long size,
+		      const char *parent_buf, unsigned long parent_size)
+{
+	struct line_map map = { blame, parent, 0, 0 };
+	mmfile_t file1, file2;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
+
+	memset(&xpp, 0, sizeof(xpp));
+	memset(&xecfg, 0, sizeof(xecfg));
+	memset(&ecb, 0, sizeof(ecb));
+	xecfg.hunk_func = map_hunk;
+	ecb.priv = &map;
+	file1.ptr = (char *)parent_buf;
+	file1.size = parent_size;
+	file2.ptr = (char *)buf;
+	file2.size = size;
+	if (xdi_diff(&file1, &file2, &xpp, &xecfg, &ecb))
+		return;
+	map_unchanged(&map, blame->nr);
+}
+
+/* Push the commits whose blame is needed for the blame of commit onto
+ * the stack, or work it out if they are all known. Returns 1 if more
+ * commits have been pushed.
+ */
+static int blame_commit(struct commit *commit, const char *path,
+			struct commit ***stack, int *nr, int *alloc)
+{
+	struct commit_list *p;
+	struct cgit_blame *blame;
+	unsigned char sha1[20], parent_sha1[20];
+	enum object_type type;
+	unsigned long size, parent_size;
+	char *buf, *parent_buf;
+	int i, pushed = 0;
+
+	file_blob(commit, path, sha1);
+	for (p = commit->parents; p; p = p->next) {
+		if (file_blob(p->item, path, parent_sha1) ||
+		    hashcmp(sha1, parent_sha1))
+			continue;
+		blame = lookup_blame(p->item);
+		if (!blame) {
+			ALLOC_GROW(*stack, *nr + 1, *alloc);
+			(*stack)[(*nr)++] = p->item;
+			return 1;
+		}
+		add_decoration(&blames, &commit->object, blame);
+		return 0;
+	}
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf) {
+		buf = xstrdup("");
+		size = 0;
+	}
+	blame = read_cached_blame(commit, path, buf, size);
+	if (blame) {
+		add_decoration(&blames, &commit->object, blame);
+		free(buf);
+		return 0;
+	}
+
+	for (p = commit->parents; p; p = p->next) {
+		if (file_blob(p->item, path, parent_sha1) ||
+		    lookup_blame(p->item))
+			continue;
+		ALLOC_GROW(*stack, *nr + 1, *alloc);
+		(*stack)[(*nr)++] = p->item;
+		pushed = 1;
+	}
+	if (pushed) {
+		free(buf);
+		return 1;
+	}
+
+	blame = new_blame(buf, size);
+	for (p = commit->parents; p; p = p->next) {
+		if (file_blob(p->item, path, parent_sha1))
+			continue;
+		parent_buf = read_sha1_file(parent_sha1, &type, &parent_size);
+		if (!parent_buf)
+			continue;
+		map_lines(blame, lookup_blame(p->item), buf, size, parent_buf,
+			  parent_size);
+		free(parent_buf);
+	}
+	for (i = 0; i < blame->nr; i++)
+		if (!blame->lines[i])
+			blame->lines[i] = commit;
+	free(buf);
+
+	add_decoration(&blames, &commit->object, blame);
+	write_cached_blame(commit, path, blame);
+	return 0;
+}
+
+int cgit_blame(struct commit *commit, const char *path,
+	       struct cgit_blame *blame)
+{
+	struct commit **stack = NULL;
+	int nr = 0, alloc = 0;
+	struct commit_list *p;
+	struct cgit_blame *found;
+	unsigned char sha1[20];
+	enum object_type type;
+	unsigned long size;
+	char *buf;
+
+	if (file_blob(commit, path, sha1))
+		return -1;
+
+	if (!lookup_blame(commit)) {
+		buf = read_sha1_file(sha1, &type, &size);
+		if (!buf) {
+			buf = xstrdup("");
+			size = 0;
+		}
+		found = read_cached_blame(commit, path, buf, size);
+		if (found)
+			add_decoration(&blames, &commit->object, found);
+		free(buf);
+	}
+
+	/* Walk back until commits with a known blame are found, and then
+	 * forward again, without recursing through all of history.
+	 */
+	ALLOC_GROW(stack, nr + 1, alloc);
+	stack[nr++] = commit;
+	while (nr) {
+		if (lookup_blame(stack[nr - 1]) ||
+		    !blame_commit(stack[nr - 1], path, &stack, &nr, &alloc))
+			nr--;
+	}
+	free(stack);
+
+	/* Only the commits that changed the file have been written */
+	found = lookup_blame(commit);
+	for (p = commit->parents; p; p = p->next) {
+		if (lookup_blame(p->item) == found) {
+			write_cached_blame(commit, path, found);
+			break;
+		}
+	}
+	*blame = *found;
+	return 0;
+}
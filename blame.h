@@ -0,0 +1,21 @@
+#ifndef BLAME_H
+#define BLAME_H
+
+/* The commit that last changed each line of a file */
+struct cgit_blame {
+	struct commit **lines;
+	int nr;
+};
+
+/* Work out which commit last changed each line of `path` in `commit`.
+ * Only the history of the path itself is looked at, i.e. lines moved or
+ * copied from other files, and renames, are not followed.
+ *
+ * The blame of every commit that changed the file is kept in the cache
+ * directory, so the blame of a commit is its parents' blame plus its own
+ * diff. Returns 0 on success, and -1 if `path` is not a file in `commit`.
+ */
+extern int cgit_blame(struct commit *commit, const char *path,
+		      struct cgit_blame *blame);
+
+#endif /* BLAME_H */
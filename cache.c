@@ -22,6 +22,13 @@
 
 #define CACHE_BUFSIZE (1024 * 4)
 
+/* The data files are looked at for pruning at most once per this many
+ * seconds, and a data file that is read gets a new mtime at most once
+ * per DATA_TOUCH_INTERVAL seconds, so the least recently used go first.
+ */
+#define DATA_PRUNE_INTERVAL 60
+#define DATA_TOUCH_INTERVAL 3600
+
 struct cache_slot {
 	const char *key;
 	int keylen;
@@ -81,36 +88,41 @@ static int close_slot(struct cache_slot *slot)
 }
 
 /* Print the content of the active cache slot (but skip the key). */
-static int print_slot(struct cache_slot *slot)
+/* Copy bytes [start, end) of the cache file to stdout */
+static int send_slot(struct cache_slot *slot, off_t start, off_t end)
 {
 #ifdef HAVE_LINUX_SENDFILE
-	off_t start_off;
 	int ret;
 
-	start_off = slot->keylen + 1;
-
-	do {
-		ret = sendfile(STDOUT_FILENO, slot->cache_fd, &start_off,
-				slot->cache_st.st_size - start_off);
+	/* sendfile() may stop short, e.g. when writing to a full pipe */
+	while (start < end) {
+		ret = sendfile(STDOUT_FILENO, slot->cache_fd, &start,
+				end - start);
 		if (ret < 0) {
 			if (errno == EAGAIN || errno == EINTR)
 				continue;
 			return errno;
 		}
-		return 0;
-	} while (1);
+		if (ret == 0)
+			break;
+	}
+	return 0;
 #else
 	ssize_t i, j;
 
-	i = lseek(slot->cache_fd, slot->keylen + 1, SEEK_SET);
-	if (i != slot->keylen + 1)
+	i = lseek(slot->cache_fd, start, SEEK_SET);
+	if (i != start)
 		return errno;
 
 	do {
-		i = j = xread(slot->cache_fd, slot->buf, sizeof(slot->buf));
+		i = sizeof(slot->buf);
+		if (i > end - start)
+			i = end - start;
+		i = j = xread(slot->cache_fd, slot->buf, i);
 		if (i > 0)
 			j = xwrite(STDOUT_FILENO, slot->buf, i);
-	} while (i > 0 && j == i);
+		start += i > 0 ? i : 0;
+	} while (i > 0 && j == i && start < end);
 
 	if (i < 0 || j != i)
 		return errno;
@@ -119,6 +131,97 @@ static int print_slot(struct cache_slot *slot)
 #endif
 }
 
+static const char *header_value(const char *headers, const char *name)
+{
+	const char *line, *value;
+
+	for (line = headers; *line; line = strchrnul(line, '\n') + 1) {
+		if (skip_prefix(line, name, &value) && *value == ':')
+			return value + 1 + strspn(value + 1, " ");
+		if (!*strchrnul(line, '\n'))
+			break;
+	}
+	return NULL;
+}
+
+/* Answer a range request from a cached response. Only complete
+ * responses that said they accept ranges qualify, which are those of
+ * ui-plain, ui-blob and ui-snapshot. Returns 0 if the range has been
+ * sent, a positive errno on errors and -1 if the whole slot should be
+ * printed instead.
+ */
+static int print_slot_range(struct cache_slot *slot)
+{
+	struct strbuf headers = STRBUF_INIT;
+	struct strbuf etag = STRBUF_INIT;
+	const char *value, *line, *next;
+	size_t body, size, first, len;
+	ssize_t n;
+	char *end;
+	int range, err;
+
+	n = pread(slot->cache_fd, slot->buf, sizeof(slot->buf) - 1,
+		  slot->keylen + 1);
+	if (n <= 0)
+		return -1;
+	slot->buf[n] = '\0';
+	end = strstr(slot->buf, "\n\n");
+	if (!end)
+		return -1;
+	end[1] = '\0';
+	body = slot->keylen + 1 + (end + 2 - slot->buf);
+	if (header_value(slot->buf, "Status") ||
+	    !(value = header_value(slot->buf, "Accept-Ranges")) ||
+	    !starts_with(value, "bytes\n"))
+		return -1;
+	if ((value = header_value(slot->buf, "ETag")) && *value == '"')
+		strbuf_add(&etag, value + 1, strcspn(value + 1, "\"\n"));
+
+	size = slot->cache_st.st_size - body;
+	range = cgit_request_range(etag.len ? etag.buf : NULL, size, &first,
+				   &len);
+	strbuf_release(&etag);
+	if (!range)
+		return -1;
+
+	if (range > 0)
+		strbuf_addf(&headers, "Status: 206 Partial Content\n");
+	else
+		strbuf_addf(&headers, "Status: 416 Range Not Satisfiable\n");
+	for (line = slot->buf; *line; line = next) {
+		next = strchrnul(line, '\n') + 1;
+		if (!starts_with(line, "Content-Length:"))
+			strbuf_add(&headers, line, next - line);
+	}
+	if (range > 0)
+		strbuf_addf(&headers, "Content-Range: bytes %zu-%zu/%zu\n"
+			    "Content-Length: %zu\n\n",
+			    first, first + len - 1, size, len);
+	else
+		strbuf_addf(&headers, "Content-Range: bytes */%zu\n"
+			    "Content-Length: 0\n\n", size);
+	err = 0;
+	if (write_in_full(STDOUT_FILENO, headers.buf, headers.len) < 0)
+		err = errno;
+	else if (range > 0 && (!ctx.env.request_method ||
+			       strcmp(ctx.env.request_method, "HEAD")))
+		err = send_slot(slot, body + first, body + first + len);
+	strbuf_release(&headers);
+	return err;
+}
+
+static int print_slot(struct cache_slot *slot)
+{
+	int err;
+
+	if (ctx.env.http_range) {
+		err = print_slot_range(slot);
+		if (err >= 0)
+			return err;
+	}
+	return send_slot(slot, slot->keylen + 1, slot->cache_st.st_size);
+}
+
 /* Check if the slot has expired */
 static int is_expired(struct cache_slot *slot)
 {
@@ -207,6 +310,7 @@ static int unlock_slot(struct cache_slot *slot, int replace_old_slot)
  */
 static int fill_slot(struct cache_slot *slot)
 {
+	const char *range;
 	int tmp;
 
 	/* Preserve stdout */
@@ -220,8 +324,13 @@ static int fill_slot(struct cache_slot *slot)
 		return errno;
 	}
 
-	/* Generate cache content */
+	/* Generate cache content. The slot always gets the whole response,
+	 * the requested range is cut from it by print_slot().
+	 */
+	range = ctx.env.http_range;
+	ctx.env.http_range = NULL;
 	slot->fn();
+	ctx.env.http_range = range;
 
 	/* update stat info */
 	if (fstat(slot->lock_fd, &slot->cache_st)) {
@@ -397,6 +506,215 @@ int cache_process(int size, const char *path, const char *key, int ttl,
 	return result;
 }
 
+/* Return the filename used for the persistent data file identified by
+ * `kind` and `key`, e.g. "<cache-root>/search-0123abcd".
+ */
+static char *data_filename(const char *kind, const char *key)
+{
+	return fmtalloc("%s/%s-%08lx", ctx.cfg.cache_root, kind,
+			hash_str(key));
+}
+
+/* Open the persistent data file identified by `kind` and `key` and map
+ * its payload into memory. Like cache slots, the file starts with the
+ * full key followed by a \0, so hash collisions are detected here.
+ * Data files are only used when caching is enabled.
+ * Returns 0 on success and errno otherwise.
+ */
+int cache_open_data(struct cache_data *data, const char *kind,
+		    const char *key)
+{
+	char *filename;
+	struct stat st;
+	size_t keylen = strlen(key);
+	int fd, err = 0;
+
+	memset(data, 0, sizeof(*data));
+	if (!ctx.cfg.cache_root || ctx.cfg.cache_size <= 0)
+		return ENOENT;
+	filename = data_filename(kind, key);
+	fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		err = errno;
+		free(filename);
+		return err;
+	}
+	if (fstat(fd, &st)) {
+		err = errno;
+		goto out;
+	}
+	if (st.st_size <= keylen) {
+		err = ENOENT;
+		goto out;
+	}
+	data->map = xmmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	data->maplen = st.st_size;
+	if (memcmp(data->map, key, keylen + 1)) {
+		cache_close_data(data);
+		err = ENOENT;
+		goto out;
+	}
+	data->buf = (const char *)data->map + keylen + 1;
+	data->len = data->maplen - keylen - 1;
+	if (st.st_mtime + DATA_TOUCH_INTERVAL < time(NULL))
+		utime(filename, NULL);
+out:
+	close(fd);
+	free(filename);
+	return err;
+}
+
+void cache_close_data(struct cache_data *data)
+{
+	if (data->map)
+		munmap(data->map, data->maplen);
+	memset(data, 0, sizeof(*data));
+}
+
+struct data_entry {
+	char *name;
+	time_t mtime;
+	off_t size;
+};
+
+static int data_entry_cmp(const void *a, const void *b)
+{
+	const struct data_entry *ea = a, *eb = b;
+
+	if (ea->mtime != eb->mtime)
+		return ea->mtime < eb->mtime ? -1 : 1;
+	return strcmp(ea->name, eb->name);
+}
+
+/* Data files are named "<kind>-<hash>", see data_filename() */
+static int is_data_file(const char *name)
+{
+	const char *hash = strrchr(name, '-');
+
+	if (!hash || hash == name || strlen(++hash) < 8)
+		return 0;
+	while (isxdigit(*hash))
+		hash++;
+	return !*hash;
+}
+
+/* Remove the least recently used data files until they take no more
+ * than cache-data-size kilobytes. The stamp file records when this was
+ * last done, so a busy site does not read the directory on every write.
+ */
+static void prune_data(void)
+{
+	struct data_entry *files = NULL;
+	size_t nr = 0, alloc = 0, i, prefixlen;
+	uintmax_t total = 0, limit;
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	if (ctx.cfg.cache_data_size <= 0)
+		return;
+	limit = (uintmax_t)ctx.cfg.cache_data_size * 1024;
+
+	strbuf_addstr(&path, ctx.cfg.cache_root);
+	strbuf_ensure_end(&path, '/');
+	prefixlen = path.len;
+	strbuf_addstr(&path, "data.stamp");
+	if (!stat(path.buf, &st) &&
+	    st.st_mtime + DATA_PRUNE_INTERVAL > time(NULL))
+		goto out;
+	fd = open(path.buf, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		goto out;
+	close(fd);
+	utime(path.buf, NULL);
+
+	strbuf_setlen(&path, prefixlen);
+	dir = opendir(path.buf);
+	if (!dir)
+		goto out;
+	while ((ent = readdir(dir)) != NULL) {
+		if (!is_data_file(ent->d_name))
+			continue;
+		strbuf_setlen(&path, prefixlen);
+		strbuf_addstr(&path, ent->d_name);
+		if (stat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		ALLOC_GROW(files, nr + 1, alloc);
+		files[nr].name = xstrdup(path.buf);
+		files[nr].mtime = st.st_mtime;
+		files[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	if (total > limit) {
+		qsort(files, nr, sizeof(*files), data_entry_cmp);
+		for (i = 0; i < nr && total > limit; i++) {
+			if (unlink(files[i].name) && errno != ENOENT)
+				continue;
+			total -= files[i].size;
+		}
+	}
+	for (i = 0; i < nr; i++)
+		free(files[i].name);
+	free(files);
+out:
+	strbuf_release(&path);
+}
+
+/* Replace the persistent data file identified by `kind` and `key` with
+ * the specified payload. The new content is written to a lockfile which
+ * is then renamed into place, so readers never see a partial file. If
+ * the lockfile already exists, another process is busy updating the
+ * same file and we just return EEXIST.
+ */
+int cache_write_data(const char *kind, const char *key, const void *buf,
+		     size_t len)
+{
+	struct strbuf lockname = STRBUF_INIT;
+	char *filename;
+	int fd, err = 0;
+
+	if (!ctx.cfg.cache_root || ctx.cfg.cache_size <= 0)
+		return ENOENT;
+	filename = data_filename(kind, key);
+	strbuf_addf(&lockname, "%s.lock", filename);
+	fd = open(lockname.buf, O_WRONLY | O_CREAT | O_EXCL,
+		  S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		err = errno;
+		goto out;
+	}
+	if (write_in_full(fd, key, strlen(key) + 1) < 0 ||
+	    write_in_full(fd, buf, len) < 0)
+		err = errno;
+	if (close(fd) && !err)
+		err = errno;
+	if (!err && rename(lockname.buf, filename))
+		err = errno;
+	if (err) {
+		unlink(lockname.buf);
+		cache_log("[cgit] Unable to write %s: %s (%d)\n",
+			  filename, strerror(err), err);
+	} else
+		prune_data();
+out:
+	strbuf_release(&lockname);
+	free(filename);
+	return err;
+}
+
+void cache_add_be32(struct strbuf *sb, uint32_t value)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, value);
+	strbuf_add(sb, buf, 4);
+}
+
 /* Return a strftime formatted date/time
  * NB: the result from this function is to shared memory
  */
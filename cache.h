@@ -25,6 +25,38 @@ extern int cache_process(int size, const char *path, const char *key, int ttl,
 			 cache_fill_fn fn);
 
 
+/* A persistent data file in the cache directory, e.g. a search index.
+ * Unlike cache slots these are not tied to a url and have no ttl; the
+ * owner of the data is responsible for validating its content.
+ */
+struct cache_data {
+	void *map;
+	size_t maplen;
+	const char *buf;	/* payload, i.e. the content after the key */
+	size_t len;
+};
+
+/* Map the payload of the data file for (kind, key) into memory.
+ * Returns 0 on success and errno otherwise.
+ */
+extern int cache_open_data(struct cache_data *data, const char *kind,
+			   const char *key);
+
+/* Release a data file opened with cache_open_data() */
+extern void cache_close_data(struct cache_data *data);
+
+/* Atomically replace the data file for (kind, key) with the specified
+ * payload, and remove the least recently used data files if they take
+ * more than cache-data-size. Returns 0 on success and errno otherwise.
+ */
+extern int cache_write_data(const char *kind, const char *key,
+			    const void *buf, size_t len);
+
+/* Append `value` to `sb` as 4 bytes in network byte order, the way the
+ * numbers in data files are stored.
+ */
+extern void cache_add_be32(struct strbuf *sb, uint32_t value);
+
 /* List info about all cache entries on stdout */
 extern int cache_ls(const char *path);
 
@@ -7,6 +7,7 @@
  */
 
 #include "cgit.h"
+#include "auth-cookie.h"
 #include "cache.h"
 #include "cmd.h"
 #include "configfile.h"
@@ -45,6 +46,8 @@ static void repo_config(struct cgit_repo *repo, const char *name, const char *va
 		repo->defbranch = xstrdup(value);
 	else if (!strcmp(name, "snapshots"))
 		repo->snapshots = ctx.cfg.snapshots & cgit_parse_snapshots_mask(value);
+	else if (!strcmp(name, "enable-blame"))
+		repo->enable_blame = atoi(value);
 	else if (!strcmp(name, "enable-commit-graph"))
 		repo->enable_commit_graph = atoi(value);
 	else if (!strcmp(name, "enable-log-filecount"))
@@ -55,6 +58,8 @@ static void repo_config(struct cgit_repo *repo, const char *name, const char *va
 		repo->enable_remote_branches = atoi(value);
 	else if (!strcmp(name, "enable-subject-links"))
 		repo->enable_subject_links = atoi(value);
+	else if (!strcmp(name, "enable-tree-last-commit"))
+		repo->enable_tree_last_commit = atoi(value);
 	else if (!strcmp(name, "enable-html-serving"))
 		repo->enable_html_serving = atoi(value);
 	else if (!strcmp(name, "branch-sort")) {
@@ -162,6 +167,8 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.enable_index_links = atoi(value);
 	else if (!strcmp(name, "enable-index-owner"))
 		ctx.cfg.enable_index_owner = atoi(value);
+	else if (!strcmp(name, "enable-blame"))
+		ctx.cfg.enable_blame = atoi(value);
 	else if (!strcmp(name, "enable-commit-graph"))
 		ctx.cfg.enable_commit_graph = atoi(value);
 	else if (!strcmp(name, "enable-log-filecount"))
@@ -170,10 +177,14 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.enable_log_linecount = atoi(value);
 	else if (!strcmp(name, "enable-remote-branches"))
 		ctx.cfg.enable_remote_branches = atoi(value);
+	else if (!strcmp(name, "enable-search-index"))
+		ctx.cfg.enable_search_index = atoi(value);
 	else if (!strcmp(name, "enable-subject-links"))
 		ctx.cfg.enable_subject_links = atoi(value);
 	else if (!strcmp(name, "enable-html-serving"))
 		ctx.cfg.enable_html_serving = atoi(value);
+	else if (!strcmp(name, "enable-tree-last-commit"))
+		ctx.cfg.enable_tree_last_commit = atoi(value);
 	else if (!strcmp(name, "enable-tree-linenumbers"))
 		ctx.cfg.enable_tree_linenumbers = atoi(value);
 	else if (!strcmp(name, "enable-git-config"))
@@ -182,6 +193,10 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.max_stats = cgit_find_stats_period(value, NULL);
 	else if (!strcmp(name, "cache-size"))
 		ctx.cfg.cache_size = atoi(value);
+	else if (!strcmp(name, "cache-data-size"))
+		ctx.cfg.cache_data_size = atoi(value);
+	else if (!strcmp(name, "cache-filters"))
+		ctx.cfg.cache_filters = atoi(value);
 	else if (!strcmp(name, "cache-root"))
 		ctx.cfg.cache_root = xstrdup(expand_macros(value));
 	else if (!strcmp(name, "cache-root-ttl"))
@@ -192,6 +207,8 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.cache_scanrc_ttl = atoi(value);
 	else if (!strcmp(name, "cache-static-ttl"))
 		ctx.cfg.cache_static_ttl = atoi(value);
+	else if (!strcmp(name, "cache-auth-ttl"))
+		ctx.cfg.cache_auth_ttl = atoi(value);
 	else if (!strcmp(name, "cache-dynamic-ttl"))
 		ctx.cfg.cache_dynamic_ttl = atoi(value);
 	else if (!strcmp(name, "cache-about-ttl"))
@@ -210,6 +227,10 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.owner_filter = cgit_new_filter(value, OWNER);
 	else if (!strcmp(name, "auth-filter"))
 		ctx.cfg.auth_filter = cgit_new_filter(value, AUTH);
+	else if (!strcmp(name, "auth-cookie-name"))
+		ctx.cfg.auth_cookie_name = xstrdup(value);
+	else if (!strcmp(name, "auth-cookie-secret"))
+		ctx.cfg.auth_cookie_secret = xstrdup(value);
 	else if (!strcmp(name, "embedded"))
 		ctx.cfg.embedded = atoi(value);
 	else if (!strcmp(name, "max-atom-items"))
@@ -220,6 +241,24 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.max_repodesc_len = atoi(value);
 	else if (!strcmp(name, "max-blob-size"))
 		ctx.cfg.max_blob_size = atoi(value);
+	else if (!strcmp(name, "max-diff-blob-size"))
+		ctx.cfg.max_diff_blob_size = atoi(value);
+	else if (!strcmp(name, "max-diff-buffer-size"))
+		ctx.cfg.max_diff_buffer_size = atoi(value);
+	else if (!strcmp(name, "max-diff-files"))
+		ctx.cfg.max_diff_files = atoi(value);
+	else if (!strcmp(name, "max-diff-lines"))
+		ctx.cfg.max_diff_lines = atoi(value);
+	else if (!strcmp(name, "max-tree-entries"))
+		ctx.cfg.max_tree_entries = atoi(value);
+	else if (!strcmp(name, "memoize-filters"))
+		ctx.cfg.memoize_filters = atoi(value);
+	else if (!strcmp(name, "diff-threads"))
+		ctx.cfg.diff_threads = atoi(value);
+	else if (!strcmp(name, "diff-algorithm")) {
+		if (parse_algorithm_value(value) >= 0)
+			ctx.cfg.diff_algorithm = parse_algorithm_value(value);
+	}
 	else if (!strcmp(name, "max-repo-count"))
 		ctx.cfg.max_repo_count = atoi(value);
 	else if (!strcmp(name, "max-commit-count"))
@@ -337,6 +376,8 @@ static void querystring_cb(const char *name, const char *value)
 		ctx.qry.context = atoi(value);
 	} else if (!strcmp(name, "ignorews")) {
 		ctx.qry.ignorews = atoi(value);
+	} else if (!strcmp(name, "algorithm")) {
+		ctx.qry.algorithm = xstrdup(value);
 	} else if (!strcmp(name, "follow")) {
 		ctx.qry.follow = atoi(value);
 	}
@@ -348,7 +389,9 @@ static void prepare_context(void)
 	ctx.cfg.agefile = "info/web/last-modified";
 	ctx.cfg.nocache = 0;
 	ctx.cfg.cache_size = 0;
+	ctx.cfg.cache_data_size = 102400;
 	ctx.cfg.cache_max_create_time = 5;
+	ctx.cfg.auth_cookie_name = "cgitauth";
 	ctx.cfg.cache_root = CGIT_CACHE_ROOT;
 	ctx.cfg.cache_about_ttl = 15;
 	ctx.cfg.cache_snapshot_ttl = 5;
@@ -356,6 +399,7 @@ static void prepare_context(void)
 	ctx.cfg.cache_root_ttl = 5;
 	ctx.cfg.cache_scanrc_ttl = 15;
 	ctx.cfg.cache_dynamic_ttl = 5;
+	ctx.cfg.cache_auth_ttl = 5;
 	ctx.cfg.cache_static_ttl = -1;
 	ctx.cfg.case_sensitive_sort = 1;
 	ctx.cfg.branch_sort = 0;
@@ -374,6 +418,14 @@ static void prepare_context(void)
 	ctx.cfg.max_msg_len = 80;
 	ctx.cfg.max_repodesc_len = 80;
 	ctx.cfg.max_blob_size = 0;
+	ctx.cfg.max_diff_blob_size = 0;
+	ctx.cfg.max_diff_buffer_size = 8192;
+	ctx.cfg.max_diff_files = 500;
+	ctx.cfg.max_tree_entries = 1000;
+	ctx.cfg.memoize_filters = 1;
+	ctx.cfg.max_diff_lines = 20000;
+	ctx.cfg.diff_algorithm = XDF_HISTOGRAM_DIFF;
+	ctx.cfg.diff_threads = 1;
 	ctx.cfg.max_stats = 0;
 	ctx.cfg.project_list = NULL;
 	ctx.cfg.renamelimit = -1;
@@ -403,8 +455,11 @@ static void prepare_context(void)
 	ctx.env.server_port = getenv("SERVER_PORT");
 	ctx.env.http_cookie = getenv("HTTP_COOKIE");
 	ctx.env.http_referer = getenv("HTTP_REFERER");
+	ctx.env.http_range = getenv("HTTP_RANGE");
+	ctx.env.http_if_range = getenv("HTTP_IF_RANGE");
 	ctx.env.content_length = getenv("CONTENT_LENGTH") ? strtoul(getenv("CONTENT_LENGTH"), NULL, 10) : 0;
 	ctx.env.authenticated = 0;
+	ctx.env.auth_user = NULL;
 	ctx.page.mimetype = "text/html";
 	ctx.page.charset = PAGE_ENCODING;
 	ctx.page.filename = NULL;
@@ -667,6 +722,54 @@ static inline void authenticate_post(void)
 	exit(0);
 }
 
+static int ask_auth_filter(void)
+{
+	open_auth_filter("authenticate-cookie");
+	return cgit_close_filter(ctx.cfg.auth_filter);
+}
+
+/* Whether the user of a cookie checked by cgit may see the requested
+ * page. The filter's answer for the user and repository is kept in the
+ * cache directory for cache-auth-ttl minutes, keyed on the version of its
+ * script too, so changing the script asks it again.
+ *
+ * Payload layout: answer ('0' or '1'), then the time it was given as a
+ * 32-bit big endian number.
+ */
+static int authenticate_user(const char *user)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct cache_data file;
+	const unsigned char *p;
+	time_t now = time(NULL);
+	int authenticated = -1;
+
+	if (!ctx.cfg.cache_auth_ttl ||
+	    cgit_filter_key(&key, ctx.cfg.auth_filter)) {
+		strbuf_release(&key);
+		return ask_auth_filter();
+	}
+	strbuf_addf(&key, "\n%s\n%s", user, ctx.qry.repo ? ctx.qry.repo : "");
+	if (!cache_open_data(&file, "auth", key.buf)) {
+		p = (const unsigned char *)file.buf;
+		if (file.len == 5 && (p[0] == '0' || p[0] == '1') &&
+		    (ctx.cfg.cache_auth_ttl < 0 ||
+		     now - (time_t)get_be32(p + 1) < ctx.cfg.cache_auth_ttl * 60L))
+			authenticated = p[0] - '0';
+		cache_close_data(&file);
+	}
+	if (authenticated < 0) {
+		authenticated = !!ask_auth_filter();
+		strbuf_addch(&buf, authenticated ? '1' : '0');
+		cache_add_be32(&buf, now);
+		cache_write_data("auth", key.buf, buf.buf, buf.len);
+		strbuf_release(&buf);
+	}
+	strbuf_release(&key);
+	return authenticated;
+}
+
 static inline void authenticate_cookie(void)
 {
 	/* If we don't have an auth_filter, consider all cookies valid, and thus return early. */
@@ -684,9 +787,20 @@ static inline void authenticate_cookie(void)
 		return;
 	}
 
+	/* A cookie signed with auth-cookie-secret is checked here, and the
+	 * filter only decides once whether its user may see the repository.
+	 * A missing, forged or expired cookie is left to the filter. */
+	if (ctx.cfg.auth_cookie_secret && *ctx.cfg.auth_cookie_secret) {
+		ctx.env.auth_user = cgit_check_auth_cookie(ctx.env.http_cookie,
+				ctx.cfg.auth_cookie_name, ctx.cfg.auth_cookie_secret);
+		if (ctx.env.auth_user) {
+			ctx.env.authenticated = authenticate_user(ctx.env.auth_user);
+			return;
+		}
+	}
+
 	/* If we've made it this far, we're authenticating the cookie for real, so do that. */
-	open_auth_filter("authenticate-cookie");
-	ctx.env.authenticated = cgit_close_filter(ctx.cfg.auth_filter);
+	ctx.env.authenticated = ask_auth_filter();
 }
 
 static void process_request(void)
@@ -795,12 +909,16 @@ static void print_repo(FILE *f, struct cgit_repo *repo)
 		fprintf(f, "repo.section=%s\n", repo->section);
 	if (repo->clone_url)
 		fprintf(f, "repo.clone-url=%s\n", repo->clone_url);
+	fprintf(f, "repo.enable-blame=%d\n",
+	        repo->enable_blame);
 	fprintf(f, "repo.enable-commit-graph=%d\n",
 	        repo->enable_commit_graph);
 	fprintf(f, "repo.enable-log-filecount=%d\n",
 	        repo->enable_log_filecount);
 	fprintf(f, "repo.enable-log-linecount=%d\n",
 	        repo->enable_log_linecount);
+	fprintf(f, "repo.enable-tree-last-commit=%d\n",
+	        repo->enable_tree_last_commit);
 	if (repo->about_filter && repo->about_filter != ctx.cfg.about_filter)
 		cgit_fprintf_filter(repo->about_filter, f, "repo.about-filter=");
 	if (repo->commit_filter && repo->commit_filter != ctx.cfg.commit_filter)
@@ -1026,6 +1144,7 @@ int main(int argc, const char **argv)
 {
 	const char *path;
 	int err, ttl;
+	char *key;
 
 	cgit_init_filters();
 	atexit(cgit_cleanup_filters);
@@ -1080,8 +1199,16 @@ int main(int argc, const char **argv)
 		ctx.cfg.nocache = 1;
 	if (ctx.cfg.nocache)
 		ctx.cfg.cache_size = 0;
+	/* Pages seen by a user whose cookie was checked above are cached
+	 * for that user alone. */
+	if (ctx.env.auth_user)
+		key = fmtalloc("%s\n%s", ctx.env.auth_user,
+			       ctx.qry.raw ? ctx.qry.raw : "");
+	else
+		key = ctx.qry.raw ? xstrdup(ctx.qry.raw) : NULL;
 	err = cache_process(ctx.cfg.cache_size, ctx.cfg.cache_root,
-			    ctx.qry.raw, ttl, process_request);
+			    key, ttl, process_request);
+	free(key);
 	cgit_cleanup_filters();
 	if (err)
 		cgit_print_error("Error processing page: %s (%d)",
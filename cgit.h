@@ -71,6 +71,7 @@ struct cgit_filter {
 	void (*fprintf)(struct cgit_filter *, FILE *, const char *prefix);
 	void (*cleanup)(struct cgit_filter *);
 	int argument_count;
+	struct string_list *memo;	/* output by input and arguments */
 };
 
 struct cgit_exec_filter {
@@ -96,11 +97,13 @@ struct cgit_repo {
 	char *logo;
 	char *logo_link;
 	int snapshots;
+	int enable_blame;
 	int enable_commit_graph;
 	int enable_log_filecount;
 	int enable_log_linecount;
 	int enable_remote_branches;
 	int enable_subject_links;
+	int enable_tree_last_commit;
 	int enable_html_serving;
 	int max_stats;
 	int branch_sort;
@@ -135,7 +138,8 @@ struct commitinfo {
 	unsigned long committer_date;
 	char *subject;
 	char *msg;
-	char *msg_encoding;
+	const char *msg_encoding;
+	char *buf;
 };
 
 struct taginfo {
@@ -143,6 +147,7 @@ struct taginfo {
 	char *tagger_email;
 	unsigned long tagger_date;
 	char *msg;
+	char *buf;
 };
 
 struct refinfo {
@@ -184,6 +189,7 @@ struct cgit_query {
 	int show_all;
 	int context;
 	int ignorews;
+	char *algorithm;
 	int follow;
 	char *vpath;
 };
@@ -216,7 +222,10 @@ struct cgit_config {
 	char *virtual_root;	/* Always ends with '/'. */
 	char *strict_export;
 	int cache_size;
+	int cache_data_size;
+	int cache_filters;
 	int cache_dynamic_ttl;
+	int cache_auth_ttl;
 	int cache_max_create_time;
 	int cache_repo_ttl;
 	int cache_root_ttl;
@@ -225,7 +234,9 @@ struct cgit_config {
 	int cache_about_ttl;
 	int cache_snapshot_ttl;
 	int case_sensitive_sort;
+	int diff_algorithm;
 	int embedded;
+	int enable_blame;
 	int enable_filter_overrides;
 	int enable_follow_links;
 	int enable_http_clone;
@@ -235,8 +246,10 @@ struct cgit_config {
 	int enable_log_filecount;
 	int enable_log_linecount;
 	int enable_remote_branches;
+	int enable_search_index;
 	int enable_subject_links;
 	int enable_html_serving;
+	int enable_tree_last_commit;
 	int enable_tree_linenumbers;
 	int enable_git_config;
 	int local_time;
@@ -247,7 +260,14 @@ struct cgit_config {
 	int max_msg_len;
 	int max_repodesc_len;
 	int max_blob_size;
+	int max_diff_blob_size;
+	int max_diff_buffer_size;
+	int max_diff_files;
+	int max_diff_lines;
+	int diff_threads;
 	int max_stats;
+	int max_tree_entries;
+	int memoize_filters;
 	int nocache;
 	int noplainemail;
 	int noheader;
@@ -270,6 +290,8 @@ struct cgit_config {
 	struct cgit_filter *email_filter;
 	struct cgit_filter *owner_filter;
 	struct cgit_filter *auth_filter;
+	char *auth_cookie_name;
+	char *auth_cookie_secret;
 };
 
 struct cgit_page {
@@ -283,6 +305,10 @@ struct cgit_page {
 	const char *title;
 	int status;
 	const char *statusmsg;
+	int ranges;		/* the body may be served in parts */
+	int partial;		/* only range_len bytes from range_first */
+	size_t range_first;
+	size_t range_len;
 };
 
 struct cgit_environment {
@@ -298,8 +324,11 @@ struct cgit_environment {
 	const char *server_port;
 	const char *http_cookie;
 	const char *http_referer;
+	const char *http_range;
+	const char *http_if_range;
 	unsigned int content_length;
 	int authenticated;
+	char *auth_user;	/* from a cookie checked by cgit itself */
 };
 
 struct cgit_context {
@@ -345,12 +374,63 @@ extern void cgit_add_ref(struct reflist *list, struct refinfo *ref);
 extern void cgit_free_reflist_inner(struct reflist *list);
 extern int cgit_refs_cb(const char *refname, const struct object_id *oid,
 			int flags, void *cb_data);
+extern char *cgit_branch_refname(const char *rev);
 
 extern void *cgit_free_commitinfo(struct commitinfo *info);
 
 void cgit_diff_tree_cb(struct diff_queue_struct *q,
 		       struct diff_options *options, void *data);
 
+extern long cgit_diff_algorithm(void);
+extern long cgit_filepair_algorithm(struct diff_filepair *pair);
+
+/* Return values of cgit_diff_files() besides 0 */
+#define DIFF_FILES_ERROR 1
+#define DIFF_FILES_TOO_LARGE 2
+
+/*
+ * A diff of two blobs, run in steps so that the xdiff part can be done
+ * by a worker thread (see diff-pool.h). Prepare, finish and clear have
+ * to be called from the main thread, as they read objects and use the
+ * cache; run only looks at the job itself.
+ */
+struct cgit_diff_job {
+	unsigned char old_sha1[20];
+	unsigned char new_sha1[20];
+	int context;
+	int ignorews;
+
+	/* The result: 0 or one of DIFF_FILES_*, and the output lines, each
+	 * preceded by its length as a 32-bit big endian number. */
+	int status;
+	unsigned long old_size, new_size;
+	int binary;
+	struct strbuf lines;
+
+	/* private */
+	linediff_fn fn;
+	int record;
+	char *key;
+	mmfile_t file1, file2;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	struct strbuf partial;
+};
+
+/* A negative context leaves out the context lines, for jobs that only
+ * count the changed lines.
+ */
+extern void cgit_diff_job_init(struct cgit_diff_job *job,
+			       const unsigned char *old_sha1,
+			       const unsigned char *new_sha1, int context,
+			       int ignorews);
+/* Returns 1 if the job still needs to be run, 0 if the result is known */
+extern int cgit_diff_job_prepare(struct cgit_diff_job *job);
+extern void cgit_diff_job_run(struct cgit_diff_job *job);
+extern void cgit_diff_job_finish(struct cgit_diff_job *job);
+extern void cgit_replay_diff_lines(struct strbuf *lines, linediff_fn fn);
+extern void cgit_diff_job_clear(struct cgit_diff_job *job);
+
 extern int cgit_diff_files(const unsigned char *old_sha1,
 			   const unsigned char *new_sha1,
 			   unsigned long *old_size, unsigned long *new_size,
@@ -381,6 +461,20 @@ extern int cgit_parse_snapshots_mask(const char *str);
 extern int cgit_open_filter(struct cgit_filter *filter, ...);
 extern int cgit_close_filter(struct cgit_filter *filter);
 extern void cgit_fprintf_filter(struct cgit_filter *filter, FILE *f, const char *prefix);
+/* Append a key identifying `filter` and the current version of its script
+ * to `key`. Returns -1 if the script can't be found, e.g. for a command
+ * looked up in PATH.
+ */
+extern int cgit_filter_key(struct strbuf *key, struct cgit_filter *filter);
+/* Like cgit_open_filter() and cgit_close_filter() with a single argument,
+ * for filters whose output only depends on `arg` and their input, which
+ * `id` (e.g. a blob id) stands for. The output is kept in the cache
+ * directory; if it is there already, it is printed and 1 is returned, in
+ * which case the input must not be written and the filter not be closed.
+ */
+extern int cgit_open_cached_filter(struct cgit_filter *filter, const char *id,
+				   char *arg);
+extern int cgit_close_cached_filter(struct cgit_filter *filter);
 extern void cgit_exec_filter_init(struct cgit_exec_filter *filter, char *cmd, char **argv);
 extern struct cgit_filter *cgit_new_filter(const char *cmd, filter_type filtertype);
 extern void cgit_cleanup_filters(void);
@@ -394,4 +488,32 @@ extern char *expand_macros(const char *txt);
 
 extern char *get_mimetype_for_filename(const char *filename);
 
+/* As much as buffer_is_binary() looks at */
+#define STREAM_HEAD_SIZE 8000
+
+/* Called with the first STREAM_HEAD_SIZE bytes of a blob (or all of it,
+ * if it is smaller) and its size, before the blob is written.
+ */
+typedef void (*blob_head_fn)(const char *buf, unsigned long len,
+			     unsigned long size, void *data);
+
+extern int cgit_stream_blob(const unsigned char *sha1, blob_head_fn fn,
+			    void *data);
+
+/* Find the entry for `path` (with no leading or trailing slashes) below
+ * the tree `tree_sha1`, reading one tree per path component. Returns 0
+ * and sets sha1 and mode if there is one, and -1 otherwise.
+ */
+extern int cgit_get_path_entry(const unsigned char *tree_sha1,
+			       const char *path, unsigned char *sha1,
+			       unsigned *mode);
+
+/* Look at the Range and If-Range headers of the request for a body of
+ * `size` bytes with the specified etag. Returns 1 and sets *first and
+ * *len if a part of the body was asked for, -1 if the range cannot be
+ * satisfied and 0 if the whole body should be sent.
+ */
+extern int cgit_request_range(const char *etag, size_t size, size_t *first,
+			      size_t *len);
+
 #endif /* CGIT_H */
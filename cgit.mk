@@ -66,15 +66,23 @@ ifdef HAVE_LINUX_SENDFILE
 endif
 
 CGIT_OBJ_NAMES += cgit.o
+CGIT_OBJ_NAMES += auth-cookie.o
+CGIT_OBJ_NAMES += author-stats.o
+CGIT_OBJ_NAMES += blame.o
 CGIT_OBJ_NAMES += cache.o
 CGIT_OBJ_NAMES += cmd.o
 CGIT_OBJ_NAMES += configfile.o
+CGIT_OBJ_NAMES += diff-pool.o
 CGIT_OBJ_NAMES += filter.o
 CGIT_OBJ_NAMES += html.o
+CGIT_OBJ_NAMES += last-commit.o
 CGIT_OBJ_NAMES += parsing.o
+CGIT_OBJ_NAMES += ref-decorations.o
 CGIT_OBJ_NAMES += scan-tree.o
+CGIT_OBJ_NAMES += search-index.o
 CGIT_OBJ_NAMES += shared.o
 CGIT_OBJ_NAMES += ui-atom.o
+CGIT_OBJ_NAMES += ui-blame.o
 CGIT_OBJ_NAMES += ui-blob.o
 CGIT_OBJ_NAMES += ui-clone.o
 CGIT_OBJ_NAMES += ui-commit.o
@@ -11,6 +11,7 @@
 #include "cache.h"
 #include "ui-shared.h"
 #include "ui-atom.h"
+#include "ui-blame.h"
 #include "ui-blob.h"
 #include "ui-clone.h"
 #include "ui-commit.h"
@@ -53,6 +54,14 @@ static void about_fn(void)
 		cgit_print_site_readme();
 }
 
+static void blame_fn(void)
+{
+	if (ctx.repo->enable_blame)
+		cgit_print_blame(ctx.qry.sha1, ctx.qry.path);
+	else
+		cgit_print_error_page(403, "Forbidden", "Blame is disabled");
+}
+
 static void blob_fn(void)
 {
 	cgit_print_blob(ctx.qry.sha1, ctx.qry.path, ctx.qry.head, 0);
@@ -65,12 +74,20 @@ static void commit_fn(void)
 
 static void diff_fn(void)
 {
-	cgit_print_diff(ctx.qry.sha1, ctx.qry.sha2, ctx.qry.path, 1, 0);
+	cgit_print_diff(ctx.qry.sha1, ctx.qry.sha2, ctx.qry.path, 1,
+			DIFF_OUTPUT_PAGE);
 }
 
 static void rawdiff_fn(void)
 {
-	cgit_print_diff(ctx.qry.sha1, ctx.qry.sha2, ctx.qry.path, 1, 1);
+	cgit_print_diff(ctx.qry.sha1, ctx.qry.sha2, ctx.qry.path, 1,
+			DIFF_OUTPUT_RAW);
+}
+
+static void hunks_fn(void)
+{
+	cgit_print_diff(ctx.qry.sha1, ctx.qry.sha2, ctx.qry.path, 0,
+			DIFF_OUTPUT_HUNKS);
 }
 
 static void info_fn(void)
@@ -154,9 +171,11 @@ struct cgit_cmd *cgit_get_cmd(void)
 		def_cmd(HEAD, 1, 0, 1),
 		def_cmd(atom, 1, 0, 0),
 		def_cmd(about, 0, 0, 0),
+		def_cmd(blame, 1, 1, 0),
 		def_cmd(blob, 1, 0, 0),
 		def_cmd(commit, 1, 1, 0),
 		def_cmd(diff, 1, 1, 0),
+		def_cmd(hunks, 1, 1, 0),
 		def_cmd(info, 1, 0, 1),
 		def_cmd(log, 1, 1, 0),
 		def_cmd(ls_cache, 0, 0, 0),
@@ -0,0 +1,156 @@
+/* diff-pool.c: diff the files of a commit with several threads
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * Git's object store is not thread-safe, so the main thread reads the
+ * blobs of each job (cgit_diff_job_prepare) and queues it, and the
+ * workers only run xdiff on the loaded buffers. The main thread then
+ * waits for the jobs in order, stores their output in the cache and
+ * hands them to the caller, which writes the page. No more than a
+ * window of jobs is prepared ahead of the one being written, so the
+ * memory used stays bounded however many files there are.
+ */
+
+#include "cgit.h"
+#include "diff-pool.h"
+
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+/* Jobs in flight per worker thread */
+#define JOBS_PER_THREAD 4
+
+static void run_serial(struct cgit_diff_job **jobs, int nr, diff_job_fn fn,
+		       void *data)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (jobs[i]) {
+			if (cgit_diff_job_prepare(jobs[i]))
+				cgit_diff_job_run(jobs[i]);
+			cgit_diff_job_finish(jobs[i]);
+		}
+		fn(i, jobs[i], data);
+	}
+}
+
+#ifndef NO_PTHREADS
+
+struct diff_pool {
+	struct cgit_diff_job **jobs;
+	char *ready;
+	int *queue;
+	int head, tail;
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t queued;
+	pthread_cond_t finished;
+};
+
+static void *worker(void *data)
+{
+	struct diff_pool *pool = data;
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->head == pool->tail && !pool->stop)
+			pthread_cond_wait(&pool->queued, &pool->mutex);
+		if (pool->head == pool->tail)
+			break;
+		i = pool->queue[pool->head++];
+		pthread_mutex_unlock(&pool->mutex);
+		cgit_diff_job_run(pool->jobs[i]);
+		pthread_mutex_lock(&pool->mutex);
+		pool->ready[i] = 1;
+		pthread_cond_signal(&pool->finished);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+void cgit_run_diff_jobs(struct cgit_diff_job **jobs, int nr, diff_job_fn fn,
+			void *data)
+{
+	struct diff_pool pool;
+	pthread_t *threads;
+	int nr_threads, window, prepared, run, i;
+
+	nr_threads = ctx.cfg.diff_threads;
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (nr_threads <= 1) {
+		run_serial(jobs, nr, fn, data);
+		return;
+	}
+
+	memset(&pool, 0, sizeof(pool));
+	pool.jobs = jobs;
+	pool.ready = xcalloc(nr, sizeof(*pool.ready));
+	pool.queue = xcalloc(nr, sizeof(*pool.queue));
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.queued, NULL);
+	pthread_cond_init(&pool.finished, NULL);
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, worker, &pool))
+			break;
+	nr_threads = i;
+	window = (nr_threads ? nr_threads : 1) * JOBS_PER_THREAD;
+
+	for (i = 0, prepared = 0; i < nr; i++) {
+		for (; prepared < nr && prepared < i + window; prepared++) {
+			run = jobs[prepared] &&
+				cgit_diff_job_prepare(jobs[prepared]);
+			if (run && !nr_threads)
+				cgit_diff_job_run(jobs[prepared]);
+			pthread_mutex_lock(&pool.mutex);
+			if (run && nr_threads) {
+				pool.queue[pool.tail++] = prepared;
+				pthread_cond_signal(&pool.queued);
+			} else {
+				pool.ready[prepared] = 1;
+			}
+			pthread_mutex_unlock(&pool.mutex);
+		}
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!pool.ready[i])
+			pthread_cond_wait(&pool.finished, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+		if (jobs[i])
+			cgit_diff_job_finish(jobs[i]);
+		fn(i, jobs[i], data);
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.queued);
+	pthread_mutex_unlock(&pool.mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&pool.finished);
+	pthread_cond_destroy(&pool.queued);
+	pthread_mutex_destroy(&pool.mutex);
+	free(threads);
+	free(pool.queue);
+	free(pool.ready);
+}
+
+#else
+
+void cgit_run_diff_jobs(struct cgit_diff_job **jobs, int nr, diff_job_fn fn,
+			void *data)
+{
+	run_serial(jobs, nr, fn, data);
+}
+
+#endif
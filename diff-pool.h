@@ -0,0 +1,17 @@
+#ifndef DIFF_POOL_H
+#define DIFF_POOL_H
+
+/* Called for each index in order, with the finished job, or NULL if
+ * there was no job at that index. The callback owns the job.
+ */
+typedef void (*diff_job_fn)(int nr, struct cgit_diff_job *job, void *data);
+
+/* Prepare, run and finish the `nr` diff jobs in `jobs` (which may
+ * contain NULL entries), and pass each of them to `fn` in order. With
+ * "diff-threads" above 1, the jobs are run by a pool of worker threads
+ * while the main thread prepares the next ones and calls `fn`.
+ */
+extern void cgit_run_diff_jobs(struct cgit_diff_job **jobs, int nr,
+			       diff_job_fn fn, void *data);
+
+#endif /* DIFF_POOL_H */
@@ -8,6 +8,7 @@
 
 #include "cgit.h"
 #include "html.h"
+#include "cache.h"
 #ifndef NO_LUA
 #include <dlfcn.h>
 #include <lua.h>
@@ -17,6 +18,8 @@
 
 static inline void reap_filter(struct cgit_filter *filter)
 {
+	if (filter && filter->memo)
+		string_list_clear(filter->memo, 1);
 	if (filter && filter->cleanup)
 		filter->cleanup(filter);
 }
@@ -135,6 +138,180 @@ void cgit_exec_filter_init(struct cgit_exec_filter *filter, char *cmd, char **ar
 	filter->base.argument_count = 0;
 }
 
+struct coproc_filter {
+	struct cgit_filter base;
+	char *cmd;
+	int pid;
+	int in_fd;		/* requests to the filter */
+	FILE *out;		/* and its answers */
+	FILE *buf;		/* what cgit writes while the filter is open */
+	int old_stdout;
+};
+
+static void start_coproc_filter(struct coproc_filter *filter)
+{
+	int in[2], out[2];
+
+	chk_zero(pipe(in), "Unable to create pipe to subprocess");
+	chk_zero(pipe(out), "Unable to create pipe from subprocess");
+	filter->pid = chk_non_negative(fork(), "Unable to create subprocess");
+	if (filter->pid == 0) {
+		close(in[1]);
+		close(out[0]);
+		chk_non_negative(dup2(in[0], STDIN_FILENO),
+			"Unable to use pipe as STDIN");
+		chk_non_negative(dup2(out[1], STDOUT_FILENO),
+			"Unable to use pipe as STDOUT");
+		close(in[0]);
+		close(out[1]);
+		execlp(filter->cmd, filter->cmd, (char *)NULL);
+		die_errno("Unable to exec subprocess %s", filter->cmd);
+	}
+	close(in[0]);
+	close(out[1]);
+	/* Keep the pipes away from exec filters started later on */
+	fcntl(in[1], F_SETFD, FD_CLOEXEC);
+	fcntl(out[0], F_SETFD, FD_CLOEXEC);
+	filter->in_fd = in[1];
+	filter->out = xfdopen(out[0], "r");
+	filter->buf = tmpfile();
+	if (!filter->buf)
+		die_errno("Unable to create buffer for subprocess %s",
+			  filter->cmd);
+}
+
+static void write_coproc_field(struct coproc_filter *filter, const char *buf,
+			       size_t len)
+{
+	char header[32];
+
+	snprintf(header, sizeof(header), "%"PRIuMAX"\n", (uintmax_t)len);
+	if (write_in_full(filter->in_fd, header, strlen(header)) < 0 ||
+	    write_in_full(filter->in_fd, buf, len) < 0)
+		die_errno("Unable to write to subprocess %s", filter->cmd);
+}
+
+static int open_coproc_filter(struct cgit_filter *base, va_list ap)
+{
+	struct coproc_filter *filter = (struct coproc_filter *)base;
+	const char *arg;
+	char header[32];
+	int i, fd;
+
+	if (filter->pid <= 0)
+		start_coproc_filter(filter);
+
+	/* The arguments go out right away, as they may not outlive the
+	 * call; the text follows when the filter is closed.
+	 */
+	snprintf(header, sizeof(header), "%d\n", filter->base.argument_count);
+	if (write_in_full(filter->in_fd, header, strlen(header)) < 0)
+		die_errno("Unable to write to subprocess %s", filter->cmd);
+	for (i = 0; i < filter->base.argument_count; i++) {
+		arg = va_arg(ap, char *);
+		if (!arg)
+			arg = "";
+		write_coproc_field(filter, arg, strlen(arg));
+	}
+
+	fd = fileno(filter->buf);
+	chk_zero(ftruncate(fd, 0), "Unable to clear subprocess buffer");
+	chk_non_negative(lseek(fd, 0, SEEK_SET),
+		"Unable to rewind subprocess buffer");
+	filter->old_stdout = chk_positive(dup(STDOUT_FILENO),
+		"Unable to duplicate STDOUT");
+	chk_non_negative(dup2(fd, STDOUT_FILENO),
+		"Unable to use buffer as STDOUT");
+	return 0;
+}
+
+static int close_coproc_filter(struct cgit_filter *base)
+{
+	struct coproc_filter *filter = (struct coproc_filter *)base;
+	struct strbuf line = STRBUF_INIT;
+	char buf[8192];
+	int fd = fileno(filter->buf);
+	uintmax_t len;
+	ssize_t n;
+	off_t size;
+	int status;
+
+	chk_non_negative(dup2(filter->old_stdout, STDOUT_FILENO),
+		"Unable to restore STDOUT");
+	close(filter->old_stdout);
+
+	size = chk_non_negative(lseek(fd, 0, SEEK_CUR),
+		"Unable to read subprocess buffer");
+	chk_non_negative(lseek(fd, 0, SEEK_SET),
+		"Unable to rewind subprocess buffer");
+	snprintf(buf, sizeof(buf), "%"PRIuMAX"\n", (uintmax_t)size);
+	if (write_in_full(filter->in_fd, buf, strlen(buf)) < 0)
+		die_errno("Unable to write to subprocess %s", filter->cmd);
+	while (size > 0) {
+		n = xread(fd, buf, size < sizeof(buf) ? size : sizeof(buf));
+		if (n <= 0)
+			die_errno("Unable to read subprocess buffer");
+		if (write_in_full(filter->in_fd, buf, n) < 0)
+			die_errno("Unable to write to subprocess %s",
+				  filter->cmd);
+		size -= n;
+	}
+
+	/* The answer is the exit status and the output */
+	if (strbuf_getline(&line, filter->out, '\n') == EOF)
+		die("Subprocess %s exited abnormally", filter->cmd);
+	status = atoi(line.buf);
+	if (strbuf_getline(&line, filter->out, '\n') == EOF)
+		die("Subprocess %s exited abnormally", filter->cmd);
+	len = strtoumax(line.buf, NULL, 10);
+	strbuf_release(&line);
+	while (len > 0) {
+		n = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf),
+			  filter->out);
+		if (n <= 0)
+			die("Subprocess %s exited abnormally", filter->cmd);
+		html_raw(buf, n);
+		len -= n;
+	}
+	return status;
+}
+
+static void fprintf_coproc_filter(struct cgit_filter *base, FILE *f, const char *prefix)
+{
+	struct coproc_filter *filter = (struct coproc_filter *)base;
+	fprintf(f, "%scoproc:%s\n", prefix, filter->cmd);
+}
+
+static void cleanup_coproc_filter(struct cgit_filter *base)
+{
+	struct coproc_filter *filter = (struct coproc_filter *)base;
+
+	if (filter->pid <= 0)
+		return;
+	/* End of input asks the filter to exit */
+	close(filter->in_fd);
+	fclose(filter->out);
+	fclose(filter->buf);
+	waitpid(filter->pid, NULL, 0);
+	filter->pid = 0;
+}
+
+static struct cgit_filter *new_coproc_filter(const char *cmd, int argument_count)
+{
+	struct coproc_filter *filter;
+
+	filter = xmalloc(sizeof(*filter));
+	memset(filter, 0, sizeof(*filter));
+	filter->base.open = open_coproc_filter;
+	filter->base.close = close_coproc_filter;
+	filter->base.fprintf = fprintf_coproc_filter;
+	filter->base.cleanup = cleanup_coproc_filter;
+	filter->base.argument_count = argument_count;
+	filter->cmd = xstrdup(cmd);
+
+	return &filter->base;
+}
+
 #ifdef NO_LUA
 void cgit_init_filters(void)
 {
@@ -177,10 +354,14 @@ static inline void unhook_write(void)
 	current_write_filter = NULL;
 }
 
+/* Input for a Lua filter is passed on in chunks of about this size */
+#define LUA_FILTER_BUFFER_SIZE 65536
+
 struct lua_filter {
 	struct cgit_filter base;
 	char *script_file;
 	lua_State *lua_state;
+	struct strbuf buffer;	/* input not yet passed to filter_write */
 };
 
 static void error_lua_filter(struct lua_filter *filter)
@@ -189,14 +370,48 @@ static void error_lua_filter(struct lua_filter *filter)
 	lua_pop(filter->lua_state, 1);
 }
 
+/* Hand the buffered input to the script: as a pointer and a length to
+ * filter_write_buffer() if it is defined, which saves copying the input
+ * into a Lua string (e.g. for LuaJIT's FFI), and as a string to
+ * filter_write() otherwise. The pointer is only valid during the call.
+ */
+static int flush_lua_filter(struct lua_filter *filter)
+{
+	int ret;
+
+	if (!filter->buffer.len)
+		return 0;
+	lua_getglobal(filter->lua_state, "filter_write_buffer");
+	if (lua_isfunction(filter->lua_state, -1)) {
+		lua_pushlightuserdata(filter->lua_state, filter->buffer.buf);
+		lua_pushnumber(filter->lua_state, filter->buffer.len);
+		ret = lua_pcall(filter->lua_state, 2, 0, 0);
+	} else {
+		lua_pop(filter->lua_state, 1);
+		lua_getglobal(filter->lua_state, "filter_write");
+		lua_pushlstring(filter->lua_state, filter->buffer.buf,
+				filter->buffer.len);
+		ret = lua_pcall(filter->lua_state, 1, 0, 0);
+	}
+	strbuf_reset(&filter->buffer);
+	if (ret) {
+		error_lua_filter(filter);
+		return -1;
+	}
+	return 0;
+}
+
 static ssize_t write_lua_filter(struct cgit_filter *base, const void *buf, size_t count)
 {
 	struct lua_filter *filter = (struct lua_filter *)base;
 
-	lua_getglobal(filter->lua_state, "filter_write");
-	lua_pushlstring(filter->lua_state, buf, count);
-	if (lua_pcall(filter->lua_state, 1, 0, 0)) {
-		error_lua_filter(filter);
+	/* Output from the script itself (see hook_lua_filter) bypasses
+	 * this, and the script only runs while the buffer is flushed, so
+	 * its output stays in order with the input it has been given.
+	 */
+	strbuf_add(&filter->buffer, buf, count);
+	if (filter->buffer.len >= LUA_FILTER_BUFFER_SIZE &&
+	    flush_lua_filter(filter)) {
 		errno = EIO;
 		return -1;
 	}
@@ -261,6 +476,7 @@ static void cleanup_lua_filter(struct cgit_filter *base)
 
 	lua_close(filter->lua_state);
 	filter->lua_state = NULL;
+	strbuf_release(&filter->buffer);
 	if (filter->script_file) {
 		free(filter->script_file);
 		filter->script_file = NULL;
@@ -324,6 +540,7 @@ static int close_lua_filter(struct cgit_filter *base)
 	struct lua_filter *filter = (struct lua_filter *)base;
 	int ret = 0;
 
+	flush_lua_filter(filter);
 	lua_getglobal(filter->lua_state, "filter_close");
 	if (lua_pcall(filter->lua_state, 0, 1, 0)) {
 		error_lua_filter(filter);
@@ -356,6 +573,7 @@ static struct cgit_filter *new_lua_filter(const char *cmd, int argument_count)
 	filter->base.cleanup = cleanup_lua_filter;
 	filter->base.argument_count = argument_count;
 	filter->script_file = xstrdup(cmd);
+	strbuf_init(&filter->buffer, 0);
 
 	return &filter->base;
 }
@@ -363,6 +581,142 @@ static struct cgit_filter *new_lua_filter(const char *cmd, int argument_count)
 #endif
 
 
+/* Memoised filters are opened with at most this many arguments */
+#define MEMO_MAX_ARGS 2
+
+struct memo_output {
+	int status;
+	size_t len;
+	char buf[FLEX_ARRAY];
+};
+
+/* The memoised filter that is open, and what it has been given so far */
+static struct {
+	struct cgit_filter *filter;
+	char *args[MEMO_MAX_ARGS];
+	FILE *buf;
+	int old_stdout;
+} memo;
+
+static int memoizing(struct cgit_filter *filter)
+{
+	return filter->memo && ctx.cfg.memoize_filters &&
+		filter->argument_count <= MEMO_MAX_ARGS;
+}
+
+static int open_filter_args(struct cgit_filter *filter, ...)
+{
+	int result;
+	va_list ap;
+
+	va_start(ap, filter);
+	result = filter->open(filter, ap);
+	va_end(ap);
+	return result;
+}
+
+/* Send what cgit writes to a temporary file, until restore_stdout() */
+static void capture_stdout(void)
+{
+	int fd;
+
+	if (!memo.buf && !(memo.buf = tmpfile()))
+		die_errno("Unable to create filter buffer");
+	fd = fileno(memo.buf);
+	chk_zero(ftruncate(fd, 0), "Unable to clear filter buffer");
+	chk_non_negative(lseek(fd, 0, SEEK_SET),
+		"Unable to rewind filter buffer");
+	chk_non_negative(dup2(fd, STDOUT_FILENO),
+		"Unable to use buffer as STDOUT");
+}
+
+static void restore_stdout(struct strbuf *captured)
+{
+	int fd = fileno(memo.buf);
+
+	chk_non_negative(dup2(memo.old_stdout, STDOUT_FILENO),
+		"Unable to restore STDOUT");
+	if (lseek(fd, 0, SEEK_SET) || strbuf_read(captured, fd, 0) < 0)
+		die_errno("Unable to read filter buffer");
+}
+
+/* Collect the input of a memoised filter; whether it needs to run is
+ * only known once the input is complete.
+ */
+static void open_memo_filter(struct cgit_filter *filter, va_list ap)
+{
+	const char *arg;
+	int i;
+
+	memo.filter = filter;
+	for (i = 0; i < filter->argument_count; i++) {
+		arg = va_arg(ap, char *);
+		memo.args[i] = arg ? xstrdup(arg) : NULL;
+	}
+	memo.old_stdout = chk_positive(dup(STDOUT_FILENO),
+		"Unable to duplicate STDOUT");
+	capture_stdout();
+}
+
+static int close_memo_filter(struct cgit_filter *filter)
+{
+	struct strbuf input = STRBUF_INIT;
+	struct strbuf key = STRBUF_INIT;
+	struct strbuf out = STRBUF_INIT;
+	struct string_list_item *item = NULL;
+	struct memo_output *output;
+	int i, status;
+
+	restore_stdout(&input);
+	close(memo.old_stdout);
+
+	/* Lengths keep the parts of the key apart */
+	strbuf_addf(&key, "%"PRIuMAX":", (uintmax_t)input.len);
+	strbuf_addbuf(&key, &input);
+	for (i = 0; i < filter->argument_count; i++)
+		strbuf_addf(&key, "%"PRIuMAX":%s",
+			    (uintmax_t)(memo.args[i] ? strlen(memo.args[i]) : 0),
+			    memo.args[i] ? memo.args[i] : "");
+	if (!memchr(input.buf, '\0', input.len))
+		item = string_list_lookup(filter->memo, key.buf);
+	if (item) {
+		output = item->util;
+		html_raw(output->buf, output->len);
+		status = output->status;
+		goto done;
+	}
+
+	/* Run the filter on the collected input */
+	memo.old_stdout = chk_positive(dup(STDOUT_FILENO),
+		"Unable to duplicate STDOUT");
+	capture_stdout();
+	open_filter_args(filter, memo.args[0], memo.args[1]);
+	html_raw(input.buf, input.len);
+	status = filter->close(filter);
+	restore_stdout(&out);
+	close(memo.old_stdout);
+	html_raw(out.buf, out.len);
+
+	if (!memchr(input.buf, '\0', input.len)) {
+		output = xmalloc(sizeof(*output) + out.len);
+		output->status = status;
+		output->len = out.len;
+		memcpy(output->buf, out.buf, out.len);
+		string_list_insert(filter->memo, key.buf)->util = output;
+	}
+
+done:
+	for (i = 0; i < filter->argument_count; i++) {
+		free(memo.args[i]);
+		memo.args[i] = NULL;
+	}
+	memo.filter = NULL;
+	strbuf_release(&input);
+	strbuf_release(&key);
+	strbuf_release(&out);
+	return status;
+}
+
 int cgit_open_filter(struct cgit_filter *filter, ...)
 {
 	int result;
@@ -370,7 +724,11 @@ int cgit_open_filter(struct cgit_filter *filter, ...)
 	if (!filter)
 		return 0;
 	va_start(ap, filter);
-	result = filter->open(filter, ap);
+	if (memoizing(filter)) {
+		open_memo_filter(filter, ap);
+		result = 0;
+	} else
+		result = filter->open(filter, ap);
 	va_end(ap);
 	return result;
 }
@@ -379,6 +737,8 @@ int cgit_close_filter(struct cgit_filter *filter)
 {
 	if (!filter)
 		return 0;
+	if (memo.filter == filter)
+		return close_memo_filter(filter);
 	return filter->close(filter);
 }
 
@@ -387,6 +747,126 @@ void cgit_fprintf_filter(struct cgit_filter *filter, FILE *f, const char *prefix
 	filter->fprintf(filter, f, prefix);
 }
 
+/* The output of the cached filter that is open, if it is being captured */
+static struct {
+	char *key;
+	FILE *out;
+	int old_stdout;
+} cached_filter;
+
+/* The spec of the filter ("exec:/path/to/script\n") names its script;
+ * the modification time and size of the script are added to it, so
+ * editing or replacing the script changes the key.
+ */
+int cgit_filter_key(struct strbuf *key, struct cgit_filter *filter)
+{
+	struct stat st;
+	char *spec = NULL, *script;
+	size_t len = 0;
+	FILE *f;
+
+	f = open_memstream(&spec, &len);
+	if (!f)
+		return -1;
+	cgit_fprintf_filter(filter, f, "");
+	fclose(f);
+	script = strchr(spec, ':');
+	if (!script || !len || spec[len - 1] != '\n')
+		goto fail;
+	spec[len - 1] = '\0';
+	if (stat(script + 1, &st))
+		goto fail;
+	strbuf_addf(key, "%s %"PRIuMAX" %"PRIuMAX, spec,
+		    (uintmax_t)st.st_mtime, (uintmax_t)st.st_size);
+	free(spec);
+	return 0;
+
+fail:
+	free(spec);
+	return -1;
+}
+
+/* The key of the output of `filter` for the file `id` */
+static char *cached_filter_key(struct cgit_filter *filter, const char *id,
+			       const char *arg)
+{
+	struct strbuf key = STRBUF_INIT;
+
+	if (cgit_filter_key(&key, filter)) {
+		strbuf_release(&key);
+		return NULL;
+	}
+	strbuf_addf(&key, "\n%s\n%s\n%s", ctx.repo ? ctx.repo->url : "",
+		    arg ? arg : "", id);
+	return strbuf_detach(&key, NULL);
+}
+
+int cgit_open_cached_filter(struct cgit_filter *filter, const char *id,
+			    char *arg)
+{
+	struct cache_data file;
+	int fd;
+
+	if (!filter)
+		return 0;
+	if (!id || !ctx.cfg.cache_filters || !ctx.cfg.cache_root ||
+	    ctx.cfg.cache_size <= 0 ||
+	    !(cached_filter.key = cached_filter_key(filter, id, arg))) {
+		cgit_open_filter(filter, arg);
+		return 0;
+	}
+
+	if (!cache_open_data(&file, "filter", cached_filter.key)) {
+		html_raw(file.buf, file.len);
+		cache_close_data(&file);
+		free(cached_filter.key);
+		cached_filter.key = NULL;
+		return 1;
+	}
+
+	cached_filter.out = tmpfile();
+	if (!cached_filter.out) {
+		free(cached_filter.key);
+		cached_filter.key = NULL;
+		cgit_open_filter(filter, arg);
+		return 0;
+	}
+	fd = fileno(cached_filter.out);
+	cached_filter.old_stdout = chk_positive(dup(STDOUT_FILENO),
+		"Unable to duplicate STDOUT");
+	chk_non_negative(dup2(fd, STDOUT_FILENO),
+		"Unable to use buffer as STDOUT");
+	cgit_open_filter(filter, arg);
+	return 0;
+}
+
+int cgit_close_cached_filter(struct cgit_filter *filter)
+{
+	struct strbuf out = STRBUF_INIT;
+	int fd, status;
+
+	status = cgit_close_filter(filter);
+	if (!cached_filter.key)
+		return status;
+
+	chk_non_negative(dup2(cached_filter.old_stdout, STDOUT_FILENO),
+		"Unable to restore STDOUT");
+	close(cached_filter.old_stdout);
+	fd = fileno(cached_filter.out);
+	if (lseek(fd, 0, SEEK_SET) || strbuf_read(&out, fd, 0) < 0)
+		die_errno("Unable to read filter output");
+	html_raw(out.buf, out.len);
+	if (!status)
+		cache_write_data("filter", cached_filter.key, out.buf, out.len);
+
+	strbuf_release(&out);
+	fclose(cached_filter.out);
+	cached_filter.out = NULL;
+	free(cached_filter.key);
+	cached_filter.key = NULL;
+	return status;
+}
+
 
 
 static const struct {
@@ -394,6 +874,7 @@ static const struct {
 	struct cgit_filter *(*ctor)(const char *cmd, int argument_count);
 } filter_specs[] = {
 	{ "exec", new_exec_filter },
+	{ "coproc", new_coproc_filter },
 #ifndef NO_LUA
 	{ "lua", new_lua_filter },
 #endif
@@ -401,6 +882,7 @@ static const struct {
 
 struct cgit_filter *cgit_new_filter(const char *cmd, filter_type filtertype)
 {
+	struct cgit_filter *filter;
 	char *colon;
 	int i;
 	size_t len;
@@ -443,14 +925,23 @@ struct cgit_filter *cgit_new_filter(const char *cmd, filter_type filtertype)
 	}
 
 	/* If no prefix is given, exec filter is the default. */
-	if (!colon)
-		return new_exec_filter(cmd, argument_count);
-
-	for (i = 0; i < ARRAY_SIZE(filter_specs); i++) {
-		if (len == strlen(filter_specs[i].prefix) &&
-		    !strncmp(filter_specs[i].prefix, cmd, len))
-			return filter_specs[i].ctor(colon + 1, argument_count);
+	if (!colon) {
+		filter = new_exec_filter(cmd, argument_count);
+	} else {
+		for (i = 0; i < ARRAY_SIZE(filter_specs); i++) {
+			if (len == strlen(filter_specs[i].prefix) &&
+			    !strncmp(filter_specs[i].prefix, cmd, len))
+				break;
+		}
+		if (i == ARRAY_SIZE(filter_specs))
+			die("Invalid filter type: %.*s", (int) len, cmd);
+		filter = filter_specs[i].ctor(colon + 1, argument_count);
 	}
 
-	die("Invalid filter type: %.*s", (int) len, cmd);
+	/* The same name and email usually come up many times per page */
+	if (filtertype == EMAIL || filtertype == OWNER) {
+		filter->memo = xcalloc(1, sizeof(*filter->memo));
+		filter->memo->strdup_strings = 1;
+	}
+	return filter;
 }
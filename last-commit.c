@@ -0,0 +1,296 @@
+/* last-commit.c: the last commit changing each entry of a directory
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The tree view can show which commit last changed each of the listed
+ * files and directories. Finding out means walking back through history
+ * until every entry has been seen to change, which for an entry that has
+ * not changed since the first commit is all of it. So the answer is kept
+ * in a data file in the cache directory, one per repository, revision
+ * and directory, together with the commit it was computed for.
+ *
+ * When the branch advances, only the new commits are walked: an entry
+ * they change gets the newest of them, every other entry keeps what it
+ * had. If the branch has been rewritten, the file is rebuilt.
+ *
+ * A commit changes an entry if the entry differs from the one in its
+ * first parent. Merges are skipped, since the commits they bring in are
+ * walked too; an entry that only a merge changed cannot be told.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGLC" version tip-sha1 nr_entries
+ *   nr_entries * commit-sha1           null if it cannot be told
+ *   names                              \0-terminated, sorted
+ */
+
+#include "cgit.h"
+#include "cache.h"
+#include "last-commit.h"
+#include <tree-walk.h>
+
+#define LAST_SIGNATURE "CGLC"
+#define LAST_VERSION 1
+#define LAST_HEADER_SIZE (4 + 4 + 20 + 4)
+
+/* Marks an entry that has been looked for, but cannot be told */
+static struct commit unknown_commit;
+
+static int parse_last_commits(struct string_list *list, unsigned char *tip,
+			      const char *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	const char *name, *end;
+	uint32_t i, nr;
+	size_t size;
+
+	if (len < LAST_HEADER_SIZE || memcmp(p, LAST_SIGNATURE, 4) ||
+	    get_be32(p + 4) != LAST_VERSION)
+		return -1;
+	hashcpy(tip, p + 8);
+	nr = get_be32(p + 28);
+	size = LAST_HEADER_SIZE + (size_t)nr * 20;
+	if (len < size)
+		return -1;
+
+	name = buf + size;
+	end = buf + len;
+	for (i = 0; i < nr; i++) {
+		if (!memchr(name, '\0', end - name)) {
+			string_list_clear(list, 0);
+			return -1;
+		}
+		string_list_append(list, name)->util =
+			(void *)(p + LAST_HEADER_SIZE + (size_t)i * 20);
+		name += strlen(name) + 1;
+	}
+	return 0;
+}
+
+static void write_last_commits(struct strbuf *out, const unsigned char *tip,
+			       struct string_list *commits)
+{
+	struct commit *commit;
+	int i;
+
+	strbuf_add(out, LAST_SIGNATURE, 4);
+	cache_add_be32(out, LAST_VERSION);
+	strbuf_add(out, tip, 20);
+	cache_add_be32(out, commits->nr);
+	for (i = 0; i < commits->nr; i++) {
+		commit = commits->items[i].util;
+		if (commit && commit != &unknown_commit)
+			strbuf_add(out, commit->object.oid.hash, 20);
+		else
+			strbuf_add(out, null_sha1, 20);
+	}
+	for (i = 0; i < commits->nr; i++)
+		strbuf_add(out, commits->items[i].string,
+			   strlen(commits->items[i].string) + 1);
+}
+
+/* The tree of the directory `path` in commit */
+static int dir_tree(struct commit *commit, const char *path,
+		    unsigned char *sha1)
+{
+	unsigned mode;
+
+	if (parse_commit(commit))
+		return -1;
+	if (!path) {
+		hashcpy(sha1, commit->tree->object.oid.hash);
+		return 0;
+	}
+	if (get_tree_entry(commit->tree->object.oid.hash, path, sha1, &mode) ||
+	    !S_ISDIR(mode))
+		return -1;
+	return 0;
+}
+
+/* Give the entries of `tree` that differ from those of `parent_tree`,
+ * and have not been seen to change yet, to commit. Both trees are sorted
+ * the same way, so they can be compared side by side.
+ */
+static void mark_changed(struct string_list *commits, int *left,
+			 struct commit *commit, const unsigned char *tree,
+			 const unsigned char *parent_tree)
+{
+	struct tree_desc cur, old;
+	struct string_list_item *item;
+	void *cur_buf, *old_buf;
+	int cmp;
+
+	cur_buf = fill_tree_descriptor(&cur, tree);
+	old_buf = fill_tree_descriptor(&old, parent_tree);
+	while (cur.size) {
+		cmp = 1;
+		while (old.size) {
+			cmp = base_name_compare(old.entry.path,
+						tree_entry_len(&old.entry),
+						old.entry.mode, cur.entry.path,
+						tree_entry_len(&cur.entry),
+						cur.entry.mode);
+			if (cmp >= 0)
+				break;
+			update_tree_entry(&old);
+		}
+		if (cmp || old.entry.mode != cur.entry.mode ||
+		    hashcmp(old.entry.sha1, cur.entry.sha1)) {
+			item = string_list_lookup(commits, cur.entry.path);
+			if (item && !item->util) {
+				item->util = commit;
+				(*left)--;
+			}
+		}
+		update_tree_entry(&cur);
+	}
+	free(cur_buf);
+	free(old_buf);
+}
+
+/* Walk the commits reachable from `tip` but not from `old_tip`, newest
+ * first, until all entries of `commits` have been seen to change.
+ */
+static void walk_changes(struct string_list *commits, int *left,
+			 const char *path, const unsigned char *tip,
+			 const unsigned char *old_tip)
+{
+	struct rev_info rev;
+	struct commit *commit, *parent;
+	struct object *obj;
+	unsigned char tree[20], parent_tree[20];
+
+	init_revisions(&rev, NULL);
+	rev.max_parents = 1;
+	obj = parse_object(tip);
+	if (!obj)
+		return;
+	add_pending_object(&rev, obj, "tip");
+	if (old_tip && (obj = parse_object(old_tip))) {
+		obj->flags |= UNINTERESTING;
+		add_pending_object(&rev, obj, "old-tip");
+	}
+	if (prepare_revision_walk(&rev))
+		return;
+	while (*left && (commit = get_revision(&rev)) != NULL) {
+		if (!dir_tree(commit, path, tree)) {
+			parent = commit->parents ? commit->parents->item : NULL;
+			if (!parent || dir_tree(parent, path, parent_tree))
+				mark_changed(commits, left, commit, tree, NULL);
+			else if (hashcmp(tree, parent_tree))
+				mark_changed(commits, left, commit, tree,
+					     parent_tree);
+		}
+		free_commit_buffer(commit);
+	}
+	clear_object_flags(ALL_REV_FLAGS);
+}
+
+static int is_ancestor(const unsigned char *old_tip, const unsigned char *tip)
+{
+	struct commit *old_commit, *commit;
+
+	old_commit = lookup_commit_reference_gently(old_tip, 1);
+	commit = lookup_commit_reference_gently(tip, 1);
+	if (!old_commit || !commit || parse_commit(old_commit))
+		return 0;
+	return in_merge_bases(old_commit, commit);
+}
+
+/* Take the commits of the entries not changed since the file was written */
+static void use_old_commits(struct string_list *commits, int *left,
+			    struct string_list *old)
+{
+	struct string_list_item *item, *old_item;
+
+	for_each_string_list_item(item, commits) {
+		if (item->util)
+			continue;
+		old_item = string_list_lookup(old, item->string);
+		if (!old_item)
+			continue;
+		if (is_null_sha1(old_item->util))
+			item->util = &unknown_commit;
+		else
+			item->util = lookup_commit(old_item->util);
+		(*left)--;
+	}
+}
+
+int cgit_last_commits(const char *rev, const char *path,
+		      struct string_list *commits)
+{
+	struct string_list old = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	struct strbuf buf = STRBUF_INIT;
+	struct cache_data file;
+	struct tree_desc desc;
+	struct name_entry entry;
+	struct commit *commit;
+	unsigned char tip[20], old_tip[20], tree[20];
+	void *tree_buf;
+	int have_old = 0, left;
+	char *refname, *key = NULL;
+
+	if (get_sha1_committish(rev, tip))
+		return -1;
+	commit = lookup_commit_reference(tip);
+	if (!commit || dir_tree(commit, path, tree))
+		return -1;
+	hashcpy(tip, commit->object.oid.hash);
+
+	tree_buf = fill_tree_descriptor(&desc, tree);
+	while (tree_entry(&desc, &entry))
+		string_list_insert(commits, entry.path);
+	free(tree_buf);
+	left = commits->nr;
+
+	/* Only branches get a data file, arbitrary commits are walked */
+	refname = cgit_branch_refname(rev);
+	if (refname && ctx.cfg.cache_size > 0)
+		key = fmtalloc("%s\n%s\n%s", ctx.repo->path, refname,
+			       path ? path : "");
+	free(refname);
+	if (key && !cache_open_data(&file, "lastcommit", key)) {
+		if (!parse_last_commits(&old, old_tip, file.buf, file.len))
+			have_old = 1;
+		else
+			cache_close_data(&file);
+	}
+
+	if (have_old && !hashcmp(old_tip, tip)) {
+		use_old_commits(commits, &left, &old);
+	} else {
+		if (have_old && !is_ancestor(old_tip, tip)) {
+			string_list_clear(&old, 0);
+			cache_close_data(&file);
+			have_old = 0;
+		}
+		walk_changes(commits, &left, path, tip,
+			     have_old ? old_tip : NULL);
+		if (have_old && left)
+			use_old_commits(commits, &left, &old);
+		/* Entries new to the file can be older than its tip */
+		if (have_old && left)
+			walk_changes(commits, &left, path, tip, NULL);
+		if (key) {
+			write_last_commits(&buf, tip, commits);
+			cache_write_data("lastcommit", key, buf.buf, buf.len);
+		}
+	}
+
+	for_each_string_list_item(item, commits)
+		if (item->util == &unknown_commit)
+			item->util = NULL;
+
+	if (have_old) {
+		string_list_clear(&old, 0);
+		cache_close_data(&file);
+	}
+	strbuf_release(&buf);
+	free(key);
+	return 0;
+}
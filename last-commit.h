@@ -0,0 +1,16 @@
+#ifndef LAST_COMMIT_H
+#define LAST_COMMIT_H
+
+/* Find the last commit that changed each entry of the directory `path`
+ * (NULL for the root) in `rev`. The entry names are added to `commits`,
+ * which must be sorted, with the util pointing at the commit, or NULL if
+ * it cannot be told (e.g. when the entry came from a merge). The commits
+ * are kept in the cache directory and brought up to date with the current
+ * value of `rev` first, so only new commits are walked.
+ *
+ * Returns 0 on success, and -1 if `path` is not a directory in `rev`.
+ */
+extern int cgit_last_commits(const char *rev, const char *path,
+			     struct string_list *commits);
+
+#endif /* LAST_COMMIT_H */
@@ -57,168 +57,174 @@ void cgit_parse_url(const char *url)
 	}
 }
 
-static char *substr(const char *head, const char *tail)
-{
-	char *buf;
-
-	if (tail < head)
-		return xstrdup("");
-	buf = xmalloc(tail - head + 1);
-	strncpy(buf, head, tail - head);
-	buf[tail - head] = '\0';
-	return buf;
-}
-
-static void parse_user(const char *t, char **name, char **email, unsigned long *date)
+/* Split the ident at `t` (which ends at `eol`) in place: the name and
+ * the bracketed email are terminated with a NUL and returned as pointers
+ * into the line.
+ */
+static void parse_user(char *t, char *eol, char **name, char **email,
+		       unsigned long *date)
 {
 	struct ident_split ident;
-	unsigned email_len;
-
-	if (!split_ident_line(&ident, t, strchrnul(t, '\n') - t)) {
-		*name = substr(ident.name_begin, ident.name_end);
 
-		email_len = ident.mail_end - ident.mail_begin;
-		*email = xmalloc(strlen("<") + email_len + strlen(">") + 1);
-		sprintf(*email, "<%.*s>", email_len, ident.mail_begin);
-
-		if (ident.date_begin)
-			*date = strtoul(ident.date_begin, NULL, 10);
+	if (split_ident_line(&ident, t, eol - t))
+		return;
+	if (ident.date_begin)
+		*date = strtoul(ident.date_begin, NULL, 10);
+	*email = (char *)ident.mail_begin - 1;
+	if (ident.mail_end < eol)
+		*((char *)ident.mail_end + 1) = '\0';
+	*name = (char *)ident.name_begin;
+	if (ident.name_end == ident.mail_begin - 1) {
+		/* No room for the NUL between name and email, so move the
+		 * name back over the space following the header field name.
+		 */
+		memmove(*name - 1, *name, ident.name_end - ident.name_begin);
+		(*name)--;
+		ident.name_end--;
 	}
+	*((char *)ident.name_end) = '\0';
 }
 
-#ifdef NO_ICONV
-#define reencode(a, b, c)
-#else
-static const char *reencode(char **txt, const char *src_enc, const char *dst_enc)
+/* Return a private copy of the object in `buf`, converted to
+ * PAGE_ENCODING if its encoding header names a different encoding.
+ */
+static char *copy_object_buffer(const char *buf, unsigned long size)
 {
-	char *tmp;
-
-	if (!txt)
-		return NULL;
-
-	if (!*txt || !src_enc || !dst_enc)
-		return *txt;
-
-	/* no encoding needed if src_enc equals dst_enc */
-	if (!strcasecmp(src_enc, dst_enc))
-		return *txt;
-
-	tmp = reencode_string(*txt, dst_enc, src_enc);
-	if (tmp) {
-		free(*txt);
-		*txt = tmp;
+	char *encoding = NULL, *out = NULL;
+	const char *p, *eol;
+
+	for (p = buf; *p && *p != '\n'; p = eol + 1) {
+		eol = strchrnul(p, '\n');
+		if (skip_prefix(p, "encoding ", &p)) {
+			encoding = xmemdupz(p, eol - p);
+			break;
+		}
+		if (!*eol)
+			break;
 	}
-	return *txt;
-}
+#ifndef NO_ICONV
+	if (encoding && !same_encoding(encoding, PAGE_ENCODING))
+		out = reencode_string(buf, PAGE_ENCODING, encoding);
 #endif
+	free(encoding);
+	return out ? out : xmemdupz(buf, size);
+}
 
-static const char *next_header_line(const char *p)
+/* Return the end of the header line at `p` and advance `next` to the
+ * following line, or to NULL if this was the last one.
+ */
+static char *header_line(char *p, char **next)
 {
-	p = strchr(p, '\n');
-	if (!p)
-		return NULL;
-	return p + 1;
+	char *eol = strchrnul(p, '\n');
+
+	*next = *eol ? eol + 1 : NULL;
+	return eol;
 }
 
 static int end_of_header(const char *p)
 {
-	return !p || (*p == '\n');
+	return !p || (*p == '\n') || !*p;
 }
 
+/* Commits are parsed from a single copy of the commit buffer, which is
+ * re-encoded as a whole only if it isn't in PAGE_ENCODING already. All
+ * the string fields are views into that copy (info->buf), so freeing a
+ * commitinfo is freeing the buffer.
+ */
 struct commitinfo *cgit_parse_commit(struct commit *commit)
 {
 	const int sha1hex_len = 40;
 	struct commitinfo *ret;
-	const char *p = get_cached_commit_buffer(commit, NULL);
-	const char *t;
+	unsigned long size;
+	const char *buf = get_commit_buffer(commit, &size);
+	char *p, *t, *eol, *next;
 
 	ret = xcalloc(1, sizeof(struct commitinfo));
 	ret->commit = commit;
 
-	if (!p)
+	if (!buf)
 		return ret;
+	ret->buf = copy_object_buffer(buf, size);
+	unuse_commit_buffer(commit, buf);
+	p = ret->buf;
 
-	if (!skip_prefix(p, "tree ", &p))
+	if (!skip_prefix(p, "tree ", (const char **)&p))
 		die("Bad commit: %s", oid_to_hex(&commit->object.oid));
 	p += sha1hex_len + 1;
 
-	while (skip_prefix(p, "parent ", &p))
+	while (skip_prefix(p, "parent ", (const char **)&p))
 		p += sha1hex_len + 1;
 
-	if (p && skip_prefix(p, "author ", &p)) {
-		parse_user(p, &ret->author, &ret->author_email,
-			&ret->author_date);
-		p = next_header_line(p);
-	}
-
-	if (p && skip_prefix(p, "committer ", &p)) {
-		parse_user(p, &ret->committer, &ret->committer_email,
-			&ret->committer_date);
-		p = next_header_line(p);
-	}
-
-	if (p && skip_prefix(p, "encoding ", &p)) {
-		t = strchr(p, '\n');
-		if (t) {
-			ret->msg_encoding = substr(p, t + 1);
-			p = t + 1;
+	for (; !end_of_header(p); p = next) {
+		eol = header_line(p, &next);
+		if (skip_prefix(p, "author ", (const char **)&t))
+			parse_user(t, eol, &ret->author, &ret->author_email,
+				   &ret->author_date);
+		else if (skip_prefix(p, "committer ", (const char **)&t))
+			parse_user(t, eol, &ret->committer,
+				   &ret->committer_email, &ret->committer_date);
+		else if (skip_prefix(p, "encoding ", (const char **)&t)) {
+			*eol = '\0';
+			ret->msg_encoding = t;
 		}
 	}
 
 	if (!ret->msg_encoding)
-		ret->msg_encoding = xstrdup("UTF-8");
+		ret->msg_encoding = "UTF-8";
 
-	while (!end_of_header(p))
-		p = next_header_line(p);
 	while (p && *p == '\n')
 		p++;
 	if (!p)
 		return ret;
 
 	t = strchrnul(p, '\n');
-	ret->subject = substr(p, t);
-	while (*t == '\n')
-		t++;
-	ret->msg = xstrdup(t);
-
-	reencode(&ret->author, ret->msg_encoding, PAGE_ENCODING);
-	reencode(&ret->author_email, ret->msg_encoding, PAGE_ENCODING);
-	reencode(&ret->committer, ret->msg_encoding, PAGE_ENCODING);
-	reencode(&ret->committer_email, ret->msg_encoding, PAGE_ENCODING);
-	reencode(&ret->subject, ret->msg_encoding, PAGE_ENCODING);
-	reencode(&ret->msg, ret->msg_encoding, PAGE_ENCODING);
-
+	ret->subject = p;
+	if (*t) {
+		*t++ = '\0';
+		while (*t == '\n')
+			t++;
+	}
+	ret->msg = t;
 	return ret;
 }
 
+/* The tag object is read once, both to fill in the struct tag (unless
+ * it was parsed already) and as the buffer the taginfo fields point
+ * into.
+ */
 struct taginfo *cgit_parse_tag(struct tag *tag)
 {
 	void *data;
 	enum object_type type;
 	unsigned long size;
-	const char *p;
+	char *p, *t, *eol, *next;
 	struct taginfo *ret = NULL;
 
 	data = read_sha1_file(tag->object.oid.hash, &type, &size);
-	if (!data || type != OBJ_TAG)
-		goto cleanup;
+	if (!data || type != OBJ_TAG) {
+		free(data);
+		return NULL;
+	}
+	if (!tag->object.parsed && parse_tag_buffer(tag, data, size)) {
+		free(data);
+		return NULL;
+	}
 
 	ret = xcalloc(1, sizeof(struct taginfo));
+	ret->buf = data;
 
-	for (p = data; !end_of_header(p); p = next_header_line(p)) {
-		if (skip_prefix(p, "tagger ", &p)) {
-			parse_user(p, &ret->tagger, &ret->tagger_email,
-				&ret->tagger_date);
-		}
+	for (p = data; !end_of_header(p); p = next) {
+		eol = header_line(p, &next);
+		if (skip_prefix(p, "tagger ", (const char **)&t))
+			parse_user(t, eol, &ret->tagger, &ret->tagger_email,
+				   &ret->tagger_date);
 	}
 
 	while (p && *p == '\n')
 		p++;
 
 	if (p && *p)
-		ret->msg = xstrdup(p);
+		ret->msg = p;
 
-cleanup:
-	free(data);
 	return ret;
 }
@@ -0,0 +1,281 @@
+/* ref-decorations.c: map commits to the refs pointing at them
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * Git's load_ref_decorations() parses the object of every ref in the
+ * repository, which gets expensive when there are many tags and only a
+ * page full of commits is going to be decorated. Instead, we build a
+ * sorted commit -> ref names map from the peeled ref values once, and
+ * store it as a data file in the cache directory together with a
+ * fingerprint of the ref storage (HEAD, packed-refs and everything
+ * below refs/). As long as the fingerprint matches, decorating a commit
+ * is a binary search in the mapped file.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGRD" version fingerprint nr_entries
+ *   nr_entries * (sha1 offset count)   sorted by sha1
+ *   names                              \0-terminated, per entry
+ */
+
+#include "cgit.h"
+#include "cache.h"
+#include "ref-decorations.h"
+
+#define DECO_SIGNATURE "CGRD"
+#define DECO_VERSION 1
+#define DECO_HEADER_SIZE (4 + 4 + 20 + 4)
+#define DECO_ENTRY_SIZE (20 + 4 + 4)
+
+struct deco_map {
+	unsigned char fingerprint[20];
+	uint32_t nr;
+	const unsigned char *entries;
+	const char *names;
+	size_t names_len;
+};
+
+struct deco_ref {
+	unsigned char sha1[20];
+	int seq;
+	char *name;
+};
+
+struct deco_refs {
+	struct deco_ref *items;
+	int nr, alloc;
+};
+
+static int map_loaded;
+static struct deco_map map;
+static struct cache_data map_data;
+static struct strbuf map_buf = STRBUF_INIT;
+
+static void fingerprint_path(git_SHA_CTX *c, const char *path)
+{
+	struct stat st;
+	uint32_t info[5];
+
+	git_SHA1_Update(c, path, strlen(path) + 1);
+	if (lstat(path, &st))
+		return;
+	info[0] = htonl((uint32_t)st.st_ino);
+	info[1] = htonl((uint32_t)st.st_size);
+	info[2] = htonl((uint32_t)st.st_mtime);
+	info[3] = htonl(ST_MTIME_NSEC(st));
+	info[4] = htonl((uint32_t)st.st_mode);
+	git_SHA1_Update(c, info, sizeof(info));
+}
+
+/* Loose refs are always updated by renaming a lockfile into place, so
+ * a new or changed ref shows up as a changed inode and mtime.
+ */
+static void fingerprint_dir(git_SHA_CTX *c, struct strbuf *path)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	size_t len = path->len;
+
+	fingerprint_path(c, path->buf);
+	dir = opendir(path->buf);
+	if (!dir)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		strbuf_setlen(path, len);
+		strbuf_addf(path, "/%s", ent->d_name);
+		if (lstat(path->buf, &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			fingerprint_dir(c, path);
+		else
+			fingerprint_path(c, path->buf);
+	}
+	strbuf_setlen(path, len);
+	closedir(dir);
+}
+
+static void ref_fingerprint(unsigned char *sha1)
+{
+	git_SHA_CTX c;
+	struct strbuf path = STRBUF_INIT;
+
+	git_SHA1_Init(&c);
+	fingerprint_path(&c, git_path("HEAD"));
+	fingerprint_path(&c, git_path("packed-refs"));
+	fingerprint_path(&c, git_path("info/grafts"));
+	strbuf_addstr(&path, git_path("refs"));
+	fingerprint_dir(&c, &path);
+	strbuf_release(&path);
+	git_SHA1_Final(sha1, &c);
+}
+
+static void add_deco_ref(struct deco_refs *refs, const unsigned char *sha1,
+			 const char *name)
+{
+	ALLOC_GROW(refs->items, refs->nr + 1, refs->alloc);
+	hashcpy(refs->items[refs->nr].sha1, sha1);
+	refs->items[refs->nr].seq = refs->nr;
+	refs->items[refs->nr].name = xstrdup(name);
+	refs->nr++;
+}
+
+/* Like add_ref_decoration() in git's log-tree.c, but the objects are
+ * not parsed. Packed refs know their peeled value, so this usually does
+ * not even need to read the tag objects.
+ */
+static int add_ref_cb(const char *refname, const struct object_id *oid,
+		      int flags, void *cb_data)
+{
+	struct deco_refs *refs = cb_data;
+	unsigned char peeled[20];
+
+	if (starts_with(refname, git_replace_ref_base)) {
+		if (check_replace_refs &&
+		    !get_sha1_hex(refname + strlen(git_replace_ref_base), peeled))
+			add_deco_ref(refs, peeled, "replaced");
+		return 0;
+	}
+	if (!peel_ref(refname, peeled) && !is_null_sha1(peeled))
+		add_deco_ref(refs, peeled, refname);
+	else
+		add_deco_ref(refs, oid->hash, refname);
+	return 0;
+}
+
+static int add_graft_cb(const struct commit_graft *graft, void *cb_data)
+{
+	add_deco_ref(cb_data, graft->oid.hash, "grafted");
+	return 0;
+}
+
+/* Sort by commit, and within a commit in the reverse order of addition,
+ * which is the order of git's name_decoration lists.
+ */
+static int deco_ref_cmp(const void *a, const void *b)
+{
+	const struct deco_ref *ra = a, *rb = b;
+	int cmp = hashcmp(ra->sha1, rb->sha1);
+
+	if (cmp)
+		return cmp;
+	return rb->seq - ra->seq;
+}
+
+static void build_map(struct strbuf *out, const unsigned char *fingerprint)
+{
+	struct deco_refs refs = { NULL, 0, 0 };
+	struct strbuf entries = STRBUF_INIT;
+	struct strbuf names = STRBUF_INIT;
+	uint32_t nr = 0, count;
+	int i, j;
+
+	for_each_ref(add_ref_cb, &refs);
+	head_ref(add_ref_cb, &refs);
+	for_each_commit_graft(add_graft_cb, &refs);
+	qsort(refs.items, refs.nr, sizeof(*refs.items), deco_ref_cmp);
+
+	for (i = 0; i < refs.nr; i = j) {
+		strbuf_add(&entries, refs.items[i].sha1, 20);
+		cache_add_be32(&entries, names.len);
+		for (j = i, count = 0; j < refs.nr &&
+			     !hashcmp(refs.items[j].sha1, refs.items[i].sha1); j++) {
+			strbuf_add(&names, refs.items[j].name,
+				   strlen(refs.items[j].name) + 1);
+			count++;
+		}
+		cache_add_be32(&entries, count);
+		nr++;
+	}
+	for (i = 0; i < refs.nr; i++)
+		free(refs.items[i].name);
+	free(refs.items);
+
+	strbuf_add(out, DECO_SIGNATURE, 4);
+	cache_add_be32(out, DECO_VERSION);
+	strbuf_add(out, fingerprint, 20);
+	cache_add_be32(out, nr);
+	strbuf_addbuf(out, &entries);
+	strbuf_addbuf(out, &names);
+	strbuf_release(&entries);
+	strbuf_release(&names);
+}
+
+static int parse_map(struct deco_map *m, const char *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t size;
+
+	if (len < DECO_HEADER_SIZE || memcmp(p, DECO_SIGNATURE, 4) ||
+	    get_be32(p + 4) != DECO_VERSION)
+		return -1;
+	hashcpy(m->fingerprint, p + 8);
+	m->nr = get_be32(p + 28);
+	size = DECO_HEADER_SIZE + (size_t)m->nr * DECO_ENTRY_SIZE;
+	if (len < size)
+		return -1;
+	m->entries = p + DECO_HEADER_SIZE;
+	m->names = buf + size;
+	m->names_len = len - size;
+	return 0;
+}
+
+static void load_map(void)
+{
+	unsigned char fingerprint[20];
+
+	map_loaded = 1;
+	ref_fingerprint(fingerprint);
+	if (!cache_open_data(&map_data, "decorations", ctx.repo->path)) {
+		if (!parse_map(&map, map_data.buf, map_data.len) &&
+		    !hashcmp(map.fingerprint, fingerprint))
+			return;
+		cache_close_data(&map_data);
+	}
+
+	build_map(&map_buf, fingerprint);
+	cache_write_data("decorations", ctx.repo->path, map_buf.buf,
+			 map_buf.len);
+	if (parse_map(&map, map_buf.buf, map_buf.len))
+		die("BUG: unable to parse generated decoration map");
+}
+
+void cgit_commit_decorations(struct commit *commit, struct string_list *names)
+{
+	const unsigned char *sha1 = commit->object.oid.hash;
+	const unsigned char *entry;
+	uint32_t lo, hi, mi, offset, count;
+	int cmp;
+
+	if (!map_loaded)
+		load_map();
+
+	lo = 0;
+	hi = map.nr;
+	while (lo < hi) {
+		mi = lo + (hi - lo) / 2;
+		entry = map.entries + (size_t)mi * DECO_ENTRY_SIZE;
+		cmp = hashcmp(entry, sha1);
+		if (cmp < 0) {
+			lo = mi + 1;
+			continue;
+		}
+		if (cmp > 0) {
+			hi = mi;
+			continue;
+		}
+		offset = get_be32(entry + 20);
+		count = get_be32(entry + 24);
+		while (count-- && offset < map.names_len &&
+		       memchr(map.names + offset, '\0', map.names_len - offset)) {
+			string_list_append(names, map.names + offset);
+			offset += strlen(map.names + offset) + 1;
+		}
+		return;
+	}
+}
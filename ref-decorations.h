@@ -0,0 +1,12 @@
+#ifndef REF_DECORATIONS_H
+#define REF_DECORATIONS_H
+
+/* Append the names of the refs pointing at `commit`, directly or through
+ * annotated tags, to `names` (most recently listed ref first, like the
+ * decorations loaded by git's load_ref_decorations()). The strings are
+ * owned by the decoration map and must not be freed.
+ */
+extern void cgit_commit_decorations(struct commit *commit,
+				    struct string_list *names);
+
+#endif /* REF_DECORATIONS_H */
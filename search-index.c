@@ -0,0 +1,547 @@
+/* search-index.c: trigram index for the log search
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The index maps every trigram (three consecutive bytes, with ASCII
+ * letters folded to lower case) found in a commit message, author line
+ * or committer line to the list of commits containing it. A search
+ * pattern is reduced to the literal strings which any match must
+ * contain, and only the commits containing all trigrams of those
+ * literals are handed to the revision walker for the real regex match.
+ *
+ * There is one index per repository and branch, stored as a data file
+ * in the cache directory. When the branch advances, only the new commits
+ * are indexed; if the branch has been rewritten, the index is rebuilt.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGSI" version tip-sha1 nr_commits nr_keys
+ *   nr_commits * sha1                  indexed commits, by ordinal
+ *   nr_keys * (key offset count)       sorted by key
+ *   postings                           ascending ordinals, per key
+ */
+
+#include "cgit.h"
+#include "cache.h"
+#include "search-index.h"
+
+#define INDEX_SIGNATURE "CGSI"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE (4 + 4 + 20 + 4 + 4)
+#define INDEX_KEY_SIZE 12
+
+enum index_field {
+	FIELD_MESSAGE, FIELD_AUTHOR, FIELD_COMMITTER
+};
+
+struct search_index {
+	unsigned char tip[20];
+	uint32_t nr_commits;
+	uint32_t nr_keys;
+	const unsigned char *commits;
+	const unsigned char *keys;
+	const unsigned char *postings;
+	size_t nr_postings;
+};
+
+struct posting {
+	uint32_t key;
+	uint32_t ord;
+};
+
+struct posting_list {
+	struct posting *items;
+	int nr, alloc;
+};
+
+struct key_list {
+	uint32_t *items;
+	int nr, alloc;
+};
+
+static int parse_index(struct search_index *idx, const char *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t size;
+
+	if (len < INDEX_HEADER_SIZE || memcmp(p, INDEX_SIGNATURE, 4) ||
+	    get_be32(p + 4) != INDEX_VERSION)
+		return -1;
+	hashcpy(idx->tip, p + 8);
+	idx->nr_commits = get_be32(p + 28);
+	idx->nr_keys = get_be32(p + 32);
+	size = INDEX_HEADER_SIZE + (size_t)idx->nr_commits * 20 +
+		(size_t)idx->nr_keys * INDEX_KEY_SIZE;
+	if (len < size)
+		return -1;
+	idx->commits = p + INDEX_HEADER_SIZE;
+	idx->keys = idx->commits + (size_t)idx->nr_commits * 20;
+	idx->postings = p + size;
+	idx->nr_postings = (len - size) / 4;
+	return 0;
+}
+
+static int posting_cmp(const void *a, const void *b)
+{
+	const struct posting *pa = a, *pb = b;
+
+	if (pa->key != pb->key)
+		return pa->key < pb->key ? -1 : 1;
+	if (pa->ord != pb->ord)
+		return pa->ord < pb->ord ? -1 : 1;
+	return 0;
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+	uint32_t ka = *(const uint32_t *)a, kb = *(const uint32_t *)b;
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static inline uint32_t trigram(enum index_field field, const char *p)
+{
+	return (uint32_t)field << 24 |
+		(uint32_t)(unsigned char)tolower(p[0]) << 16 |
+		(uint32_t)(unsigned char)tolower(p[1]) << 8 |
+		(uint32_t)(unsigned char)tolower(p[2]);
+}
+
+/* Add the trigrams of `text` to `list`. Since the regex is matched
+ * line by line, trigrams spanning a newline are never needed.
+ */
+static void add_text(struct posting_list *list, enum index_field field,
+		     const char *text, size_t len, uint32_t ord)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < len; i++) {
+		if (text[i] == '\n' || text[i + 1] == '\n' ||
+		    text[i + 2] == '\n')
+			continue;
+		ALLOC_GROW(list->items, list->nr + 1, list->alloc);
+		list->items[list->nr].key = trigram(field, text + i);
+		list->items[list->nr].ord = ord;
+		list->nr++;
+	}
+}
+
+static void index_commit(struct posting_list *list, struct commit *commit,
+			 uint32_t ord)
+{
+	const char *buf, *p, *eol, *value;
+	int i, start = list->nr, nr;
+
+	buf = logmsg_reencode(commit, NULL, PAGE_ENCODING);
+	for (p = buf; *p && *p != '\n'; p = *eol ? eol + 1 : eol) {
+		eol = strchrnul(p, '\n');
+		if (skip_prefix(p, "author ", &value))
+			add_text(list, FIELD_AUTHOR, value, eol - value, ord);
+		else if (skip_prefix(p, "committer ", &value))
+			add_text(list, FIELD_COMMITTER, value, eol - value, ord);
+	}
+	if (*p)
+		add_text(list, FIELD_MESSAGE, p + 1, strlen(p + 1), ord);
+	unuse_commit_buffer(commit, buf);
+
+	/* Each commit should only be listed once per key */
+	qsort(list->items + start, list->nr - start, sizeof(*list->items),
+	      posting_cmp);
+	for (i = nr = start; i < list->nr; i++)
+		if (i == start || list->items[i].key != list->items[nr - 1].key)
+			list->items[nr++] = list->items[i];
+	list->nr = nr;
+}
+
+/* Index the commits reachable from `tip` but not from `old_tip`. The
+ * ordinals of the new commits start at `base`.
+ */
+static void index_new_commits(struct posting_list *list,
+			      struct sha1_array *commits,
+			      const unsigned char *tip,
+			      const unsigned char *old_tip, uint32_t base)
+{
+	struct rev_info rev;
+	struct commit *commit;
+	struct object *obj;
+
+	init_revisions(&rev, NULL);
+	obj = parse_object(tip);
+	if (!obj)
+		return;
+	add_pending_object(&rev, obj, "tip");
+	if (old_tip && (obj = parse_object(old_tip))) {
+		obj->flags |= UNINTERESTING;
+		add_pending_object(&rev, obj, "old-tip");
+	}
+	if (prepare_revision_walk(&rev))
+		return;
+	while ((commit = get_revision(&rev)) != NULL) {
+		index_commit(list, commit, base + commits->nr);
+		sha1_array_append(commits, commit->object.oid.hash);
+		free_commit_buffer(commit);
+	}
+	/* Leave the objects ready for the walk done by the log page */
+	clear_object_flags(ALL_REV_FLAGS);
+}
+
+/* Serialize an index consisting of `old` (if any) followed by the newly
+ * indexed commits and postings.
+ */
+static void write_index(struct strbuf *out, const unsigned char *tip,
+			const struct search_index *old,
+			struct sha1_array *commits, struct posting_list *list)
+{
+	struct strbuf keys = STRBUF_INIT;
+	struct strbuf postings = STRBUF_INIT;
+	uint32_t i = 0, j = 0, nr_keys = 0, nr_postings = 0, key, ord;
+	uint32_t old_keys = old ? old->nr_keys : 0;
+	uint32_t old_commits = old ? old->nr_commits : 0;
+	const unsigned char *entry;
+	uint32_t count, offset;
+	int k;
+
+	qsort(list->items, list->nr, sizeof(*list->items), posting_cmp);
+	while (i < old_keys || j < list->nr) {
+		entry = i < old_keys ? old->keys + (size_t)i * INDEX_KEY_SIZE : NULL;
+		if (entry && (j >= list->nr || get_be32(entry) <= list->items[j].key))
+			key = get_be32(entry);
+		else
+			key = list->items[j].key;
+
+		cache_add_be32(&keys, key);
+		cache_add_be32(&keys, nr_postings);
+		count = 0;
+		if (entry && get_be32(entry) == key) {
+			offset = get_be32(entry + 4);
+			count = get_be32(entry + 8);
+			if (offset + (size_t)count > old->nr_postings)
+				count = 0;
+			strbuf_add(&postings, old->postings + (size_t)offset * 4,
+				   (size_t)count * 4);
+			i++;
+		}
+		for (; j < list->nr && list->items[j].key == key; j++) {
+			ord = list->items[j].ord;
+			cache_add_be32(&postings, ord);
+			count++;
+		}
+		cache_add_be32(&keys, count);
+		nr_postings += count;
+		nr_keys++;
+	}
+
+	strbuf_add(out, INDEX_SIGNATURE, 4);
+	cache_add_be32(out, INDEX_VERSION);
+	strbuf_add(out, tip, 20);
+	cache_add_be32(out, old_commits + commits->nr);
+	cache_add_be32(out, nr_keys);
+	if (old)
+		strbuf_add(out, old->commits, (size_t)old_commits * 20);
+	for (k = 0; k < commits->nr; k++)
+		strbuf_add(out, commits->sha1[k], 20);
+	strbuf_addbuf(out, &keys);
+	strbuf_addbuf(out, &postings);
+	strbuf_release(&keys);
+	strbuf_release(&postings);
+}
+
+static int is_ancestor(const unsigned char *old_tip, const unsigned char *tip)
+{
+	struct commit *old_commit, *commit;
+
+	old_commit = lookup_commit_reference_gently(old_tip, 1);
+	commit = lookup_commit_reference_gently(tip, 1);
+	if (!old_commit || !commit || parse_commit(old_commit))
+		return 0;
+	return in_merge_bases(old_commit, commit);
+}
+
+static void add_literal(struct key_list *keys, enum index_field field,
+			struct strbuf *literal)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < literal->len; i++) {
+		ALLOC_GROW(keys->items, keys->nr + 1, keys->alloc);
+		keys->items[keys->nr++] = trigram(field, literal->buf + i);
+	}
+	strbuf_reset(literal);
+}
+
+/* The ']' closing the bracket expression starting at `p`, or NULL if it
+ * is not closed. A ']' inside [:class:], [=equiv=] or [.coll.] does not
+ * close the expression.
+ */
+static const char *bracket_end(const char *p)
+{
+	char delim;
+
+	p++;
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+	while (*p && *p != ']') {
+		if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+			delim = p[1];
+			p += 2;
+			while (*p && !(*p == delim && p[1] == ']'))
+				p++;
+			if (!*p)
+				return NULL;
+			p += 2;
+		} else
+			p++;
+	}
+	return *p ? p : NULL;
+}
+
+/* Collect the trigrams of the literal strings which must be part of any
+ * match of `pattern`. This errs on the side of caution: anything inside
+ * a group, bracket expression, interval or before a quantifier is
+ * ignored, and a pattern containing an alternation or an unterminated
+ * bracket expression or interval gives up completely (returns -1).
+ */
+static int pattern_keys(const char *pattern, enum index_field field,
+			struct key_list *keys)
+{
+	struct strbuf literal = STRBUF_INIT;
+	const char *p, *end;
+	int depth = 0;
+
+	for (p = pattern; *p; p++) {
+		switch (*p) {
+		case '|':
+			strbuf_release(&literal);
+			return -1;
+		case '\\':
+			if (!p[1])
+				break;
+			p++;
+			if (*p == '|') {
+				strbuf_release(&literal);
+				return -1;
+			} else if (*p == '(') {
+				add_literal(keys, field, &literal);
+				depth++;
+			} else if (*p == ')') {
+				add_literal(keys, field, &literal);
+				depth--;
+			} else if (strchr("{?+*", *p)) {
+				strbuf_setlen(&literal, literal.len ? literal.len - 1 : 0);
+				add_literal(keys, field, &literal);
+				if (*p == '{') {
+					/* skip the bounds up to "\}" */
+					end = strstr(p, "\\}");
+					if (!end) {
+						strbuf_release(&literal);
+						return -1;
+					}
+					p = end + 1;
+				}
+			} else if (isalnum(*p) || *p == '<' || *p == '>' ||
+				   *p == '`' || *p == '\'') {
+				/* character classes, anchors, backrefs */
+				add_literal(keys, field, &literal);
+			} else if (!depth)
+				strbuf_addch(&literal, *p);
+			break;
+		case '(':
+			add_literal(keys, field, &literal);
+			depth++;
+			break;
+		case ')':
+			add_literal(keys, field, &literal);
+			depth--;
+			break;
+		case '*':
+		case '?':
+		case '+':
+		case '{':
+			strbuf_setlen(&literal, literal.len ? literal.len - 1 : 0);
+			add_literal(keys, field, &literal);
+			if (*p == '{' && (end = strchr(p, '}')))
+				p = end;
+			break;
+		case '[':
+			add_literal(keys, field, &literal);
+			p = bracket_end(p);
+			if (!p) {
+				strbuf_release(&literal);
+				return -1;
+			}
+			break;
+		case '.':
+		case '^':
+		case '$':
+			add_literal(keys, field, &literal);
+			break;
+		default:
+			if (!depth)
+				strbuf_addch(&literal, *p);
+			else
+				add_literal(keys, field, &literal);
+		}
+	}
+	add_literal(keys, field, &literal);
+	strbuf_release(&literal);
+	return 0;
+}
+
+static const unsigned char *find_key(const struct search_index *idx,
+				     uint32_t key, uint32_t *count)
+{
+	uint32_t lo = 0, hi = idx->nr_keys, mi, k, offset;
+	const unsigned char *entry;
+
+	while (lo < hi) {
+		mi = lo + (hi - lo) / 2;
+		entry = idx->keys + (size_t)mi * INDEX_KEY_SIZE;
+		k = get_be32(entry);
+		if (k == key) {
+			offset = get_be32(entry + 4);
+			*count = get_be32(entry + 8);
+			if (offset + (size_t)*count > idx->nr_postings)
+				return NULL;
+			return idx->postings + (size_t)offset * 4;
+		}
+		if (k < key)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+struct posting_ref {
+	const unsigned char *postings;
+	uint32_t count;
+};
+
+static int posting_ref_cmp(const void *a, const void *b)
+{
+	const struct posting_ref *ra = a, *rb = b;
+
+	return ra->count < rb->count ? -1 : ra->count > rb->count;
+}
+
+/* Intersect the posting lists of all `keys` and add the matching commits
+ * to `candidates`.
+ */
+static void find_candidates(const struct search_index *idx,
+			    struct key_list *keys,
+			    struct sha1_array *candidates)
+{
+	struct posting_ref *lists;
+	uint32_t *result, ord;
+	uint32_t i, j, n, nr = 0;
+	int k;
+
+	lists = xcalloc(keys->nr, sizeof(*lists));
+	for (k = 0; k < keys->nr; k++) {
+		lists[k].postings = find_key(idx, keys->items[k],
+					     &lists[k].count);
+		if (!lists[k].postings) {
+			free(lists);
+			return;
+		}
+	}
+	qsort(lists, keys->nr, sizeof(*lists), posting_ref_cmp);
+
+	result = xmalloc(sizeof(*result) * (lists[0].count + 1));
+	for (i = 0; i < lists[0].count; i++)
+		result[nr++] = get_be32(lists[0].postings + (size_t)i * 4);
+	for (k = 1; k < keys->nr && nr; k++) {
+		for (i = j = n = 0; i < nr && j < lists[k].count; ) {
+			ord = get_be32(lists[k].postings + (size_t)j * 4);
+			if (result[i] < ord)
+				i++;
+			else if (result[i] > ord)
+				j++;
+			else {
+				result[n++] = ord;
+				i++;
+				j++;
+			}
+		}
+		nr = n;
+	}
+	for (i = 0; i < nr; i++)
+		if (result[i] < idx->nr_commits)
+			sha1_array_append(candidates,
+					  idx->commits + (size_t)result[i] * 20);
+	free(result);
+	free(lists);
+}
+
+int cgit_search_index_lookup(const char *ref, const char *grep,
+			     const char *pattern,
+			     struct sha1_array *candidates)
+{
+	struct key_list keys = { NULL, 0, 0 };
+	struct posting_list list = { NULL, 0, 0 };
+	struct sha1_array commits = SHA1_ARRAY_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct search_index idx, *old;
+	struct cache_data data;
+	enum index_field field;
+	unsigned char tip[20];
+	char *key;
+	int i, n;
+
+	if (!strcmp(grep, "grep"))
+		field = FIELD_MESSAGE;
+	else if (!strcmp(grep, "author"))
+		field = FIELD_AUTHOR;
+	else if (!strcmp(grep, "committer"))
+		field = FIELD_COMMITTER;
+	else
+		return -1;
+
+	/* Without a place to keep the index, walking is cheaper */
+	if (ctx.cfg.cache_size <= 0)
+		return -1;
+
+	if (pattern_keys(pattern, field, &keys) || !keys.nr ||
+	    read_ref(ref, tip)) {
+		free(keys.items);
+		return -1;
+	}
+	qsort(keys.items, keys.nr, sizeof(*keys.items), key_cmp);
+	for (i = n = 0; i < keys.nr; i++)
+		if (!n || keys.items[i] != keys.items[n - 1])
+			keys.items[n++] = keys.items[i];
+	keys.nr = n;
+
+	key = fmtalloc("%s\n%s", ctx.repo->path, ref);
+	old = NULL;
+	if (!cache_open_data(&data, "search", key) &&
+	    !parse_index(&idx, data.buf, data.len))
+		old = &idx;
+
+	if (!old || hashcmp(old->tip, tip)) {
+		if (old && !is_ancestor(old->tip, tip))
+			old = NULL;
+		index_new_commits(&list, &commits, tip, old ? old->tip : NULL,
+				  old ? old->nr_commits : 0);
+		write_index(&buf, tip, old, &commits, &list);
+		cache_write_data("search", key, buf.buf, buf.len);
+		cache_close_data(&data);
+		if (parse_index(&idx, buf.buf, buf.len))
+			die("BUG: unable to parse generated search index");
+	}
+
+	find_candidates(&idx, &keys, candidates);
+
+	cache_close_data(&data);
+	strbuf_release(&buf);
+	sha1_array_clear(&commits);
+	free(list.items);
+	free(keys.items);
+	free(key);
+	return 0;
+}
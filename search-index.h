@@ -0,0 +1,19 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <sha1-array.h>
+
+/* Find the commits reachable from `ref` which might match `pattern` in
+ * the field selected by `grep` ("grep", "author" or "committer"). The
+ * index is brought up to date with the current value of `ref` first.
+ *
+ * The candidates are a superset of the real matches, so the caller must
+ * still verify them against the pattern. Returns 0 if the candidates
+ * were found by using the index, and -1 if the index cannot be used for
+ * this query (in which case the caller should walk the history).
+ */
+extern int cgit_search_index_lookup(const char *ref, const char *grep,
+				    const char *pattern,
+				    struct sha1_array *candidates);
+
+#endif /* SEARCH_INDEX_H */
@@ -7,6 +7,10 @@
  */
 
 #include "cgit.h"
+#include "cache.h"
+#include "html.h"
+#include <streaming.h>
+#include <tree-walk.h>
 
 struct cgit_repolist cgit_repolist;
 struct cgit_context ctx;
@@ -56,11 +60,13 @@ struct cgit_repo *cgit_add_repo(const char *url)
 	ret->owner = NULL;
 	ret->section = ctx.cfg.section;
 	ret->snapshots = ctx.cfg.snapshots;
+	ret->enable_blame = ctx.cfg.enable_blame;
 	ret->enable_commit_graph = ctx.cfg.enable_commit_graph;
 	ret->enable_log_filecount = ctx.cfg.enable_log_filecount;
 	ret->enable_log_linecount = ctx.cfg.enable_log_linecount;
 	ret->enable_remote_branches = ctx.cfg.enable_remote_branches;
 	ret->enable_subject_links = ctx.cfg.enable_subject_links;
+	ret->enable_tree_last_commit = ctx.cfg.enable_tree_last_commit;
 	ret->enable_html_serving = ctx.cfg.enable_html_serving;
 	ret->max_stats = ctx.cfg.max_stats;
 	ret->branch_sort = ctx.cfg.branch_sort;
@@ -94,15 +100,27 @@ struct cgit_repo *cgit_get_repoinfo(const char *url)
 	return NULL;
 }
 
+/* The full name of the branch `rev` refers to, e.g. "refs/heads/master"
+ * for "master", or NULL if it is anything else: a commit id, a tag, a
+ * revision expression or an ambiguous name. Data files kept per branch
+ * are keyed by this, so arbitrary revisions in URLs do not add files.
+ */
+char *cgit_branch_refname(const char *rev)
+{
+	unsigned char sha1[20];
+	char *ref = NULL;
+
+	if (dwim_ref(rev, strlen(rev), sha1, &ref) != 1 ||
+	    !starts_with(ref, "refs/heads/")) {
+		free(ref);
+		return NULL;
+	}
+	return ref;
+}
+
 void *cgit_free_commitinfo(struct commitinfo *info)
 {
-	free(info->author);
-	free(info->author_email);
-	free(info->committer);
-	free(info->committer_email);
-	free(info->subject);
-	free(info->msg);
-	free(info->msg_encoding);
+	free(info->buf);
 	free(info);
 	return NULL;
 }
@@ -191,11 +209,14 @@ static struct refinfo *cgit_mk_refinfo(const char *refname, const struct object_
 
 	ref = xmalloc(sizeof (struct refinfo));
 	ref->refname = xstrdup(refname);
+	/* Tags are read only once, by cgit_parse_tag() */
+	if (sha1_object_info(oid->hash, NULL) == OBJ_TAG) {
+		ref->object = &lookup_tag(oid->hash)->object;
+		ref->tag = cgit_parse_tag((struct tag *)ref->object);
+		return ref;
+	}
 	ref->object = parse_object(oid->hash);
 	switch (ref->object->type) {
-	case OBJ_TAG:
-		ref->tag = cgit_parse_tag((struct tag *)ref->object);
-		break;
 	case OBJ_COMMIT:
 		ref->commit = cgit_parse_commit((struct commit *)ref->object);
 		break;
@@ -205,12 +226,9 @@ static struct refinfo *cgit_mk_refinfo(const char *refname, const struct object_
 
 static void cgit_free_taginfo(struct taginfo *tag)
 {
-	if (tag->tagger)
-		free(tag->tagger);
-	if (tag->tagger_email)
-		free(tag->tagger_email);
-	if (tag->msg)
-		free(tag->msg);
+	if (!tag)
+		return;
+	free(tag->buf);
 	free(tag);
 }
 
@@ -265,15 +283,29 @@ void cgit_diff_tree_cb(struct diff_queue_struct *q,
 static int load_mmfile(mmfile_t *file, const unsigned char *sha1)
 {
 	enum object_type type;
+	unsigned long size = 0;
 
 	if (is_null_sha1(sha1)) {
 		file->ptr = (char *)"";
 		file->size = 0;
-	} else {
-		file->ptr = read_sha1_file(sha1, &type,
-		                           (unsigned long *)&file->size);
+		return 1;
 	}
-	return 1;
+	file->ptr = read_sha1_file(sha1, &type, &size);
+	file->size = size;
+	return file->ptr != NULL;
+}
+
+static void emit_diff_line(struct cgit_diff_job *job, char *line, int len)
+{
+	unsigned char buf[4];
+
+	if (job->record) {
+		put_be32(buf, len);
+		strbuf_add(&job->lines, buf, 4);
+		strbuf_add(&job->lines, line, len);
+	}
+	if (job->fn)
+		job->fn(line, len);
 }
 
 /*
@@ -281,88 +313,471 @@ static int load_mmfile(mmfile_t *file, const unsigned char *sha1)
  * needed across multiple callbacks.
  *
  * This is basically a copy of xdiff-interface.c/xdiff_outf(),
- * ripped from git and modified to use globals instead of
- * a special callback-struct.
+ * ripped from git and modified to keep the incomplete line in
+ * the diff job, so that several jobs can run at the same time.
  */
-static char *diffbuf = NULL;
-static int buflen = 0;
-
 static int filediff_cb(void *priv, mmbuffer_t *mb, int nbuf)
 {
+	struct cgit_diff_job *job = priv;
+	struct strbuf *partial = &job->partial;
 	int i;
 
 	for (i = 0; i < nbuf; i++) {
 		if (mb[i].ptr[mb[i].size-1] != '\n') {
 			/* Incomplete line */
-			diffbuf = xrealloc(diffbuf, buflen + mb[i].size);
-			memcpy(diffbuf + buflen, mb[i].ptr, mb[i].size);
-			buflen += mb[i].size;
+			strbuf_add(partial, mb[i].ptr, mb[i].size);
 			continue;
 		}
 
 		/* we have a complete line */
-		if (!diffbuf) {
-			((linediff_fn)priv)(mb[i].ptr, mb[i].size);
+		if (!partial->len) {
+			emit_diff_line(job, mb[i].ptr, mb[i].size);
 			continue;
 		}
-		diffbuf = xrealloc(diffbuf, buflen + mb[i].size);
-		memcpy(diffbuf + buflen, mb[i].ptr, mb[i].size);
-		((linediff_fn)priv)(diffbuf, buflen + mb[i].size);
-		free(diffbuf);
-		diffbuf = NULL;
-		buflen = 0;
-	}
-	if (diffbuf) {
-		((linediff_fn)priv)(diffbuf, buflen);
-		free(diffbuf);
-		diffbuf = NULL;
-		buflen = 0;
+		strbuf_add(partial, mb[i].ptr, mb[i].size);
+		emit_diff_line(job, partial->buf, partial->len);
+		strbuf_reset(partial);
+	}
+	if (partial->len) {
+		emit_diff_line(job, partial->buf, partial->len);
+		strbuf_reset(partial);
 	}
 	return 0;
 }
 
+/*
+ * Diffs of large blobs are kept in the cache directory, keyed by the blob
+ * ids and the diff options, so that showing the same change again (on
+ * another page, branch or repository) just replays the output lines.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGDF" version old_size new_size binary
+ *   (length line)*
+ */
+#define DIFF_CACHE_SIGNATURE "CGDF"
+#define DIFF_CACHE_VERSION 1
+#define DIFF_CACHE_HEADER_SIZE (4 + 4 + 4 + 4 + 4)
+#define DIFF_CACHE_MIN_SIZE (16 * 1024)
+
+static unsigned long blob_size(const unsigned char *sha1)
+{
+	unsigned long size = 0;
+
+	if (!is_null_sha1(sha1) && sha1_object_info(sha1, &size) < 0)
+		return 0;
+	return size;
+}
+
+/* Return the cache key for a diff worth keeping, or NULL */
+static char *diff_cache_key(const unsigned char *old_sha1,
+			    const unsigned char *new_sha1, unsigned long size,
+			    int context, unsigned long flags)
+{
+	if (ctx.cfg.cache_size <= 0)
+		return NULL;
+	if (size < DIFF_CACHE_MIN_SIZE || size > 0xffffffffUL)
+		return NULL;
+	return fmtalloc("%s %s\n%d %lx %d", sha1_to_hex(old_sha1),
+			sha1_to_hex(new_sha1), context, flags,
+			ctx.cfg.max_diff_lines);
+}
+
+static int read_cached_diff(struct cgit_diff_job *job)
+{
+	struct cache_data data;
+	const unsigned char *p, *start, *end;
+	uint32_t len;
+
+	if (cache_open_data(&data, "diff", job->key))
+		return -1;
+	start = (const unsigned char *)data.buf;
+	end = start + data.len;
+	if (data.len < DIFF_CACHE_HEADER_SIZE ||
+	    memcmp(start, DIFF_CACHE_SIGNATURE, 4) ||
+	    get_be32(start + 4) != DIFF_CACHE_VERSION)
+		goto invalid;
+	for (p = start + DIFF_CACHE_HEADER_SIZE; p < end; p += len) {
+		if (end - p < 4)
+			goto invalid;
+		len = get_be32(p);
+		p += 4;
+		if (len > end - p)
+			goto invalid;
+	}
+
+	job->old_size = get_be32(start + 8);
+	job->new_size = get_be32(start + 12);
+	job->binary = get_be32(start + 16);
+	strbuf_add(&job->lines, start + DIFF_CACHE_HEADER_SIZE,
+		   data.len - DIFF_CACHE_HEADER_SIZE);
+	cache_close_data(&data);
+	return 0;
+
+invalid:
+	cache_close_data(&data);
+	return -1;
+}
+
+static void store_cached_diff(struct cgit_diff_job *job)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char header[DIFF_CACHE_HEADER_SIZE];
+
+	memcpy(header, DIFF_CACHE_SIGNATURE, 4);
+	put_be32(header + 4, DIFF_CACHE_VERSION);
+	put_be32(header + 8, job->old_size);
+	put_be32(header + 12, job->new_size);
+	put_be32(header + 16, job->binary);
+	strbuf_add(&buf, header, sizeof(header));
+	strbuf_addbuf(&buf, &job->lines);
+	cache_write_data("diff", job->key, buf.buf, buf.len);
+	strbuf_release(&buf);
+}
+
+long cgit_diff_algorithm(void)
+{
+	long algorithm;
+
+	if (ctx.qry.algorithm) {
+		algorithm = parse_algorithm_value(ctx.qry.algorithm);
+		if (algorithm >= 0)
+			return algorithm;
+	}
+	return ctx.cfg.diff_algorithm;
+}
+
+static unsigned long count_lines(const mmfile_t *file)
+{
+	const char *p = file->ptr, *end = p + file->size;
+	unsigned long lines = 0;
+
+	while (p && p < end && (p = memchr(p, '\n', end - p))) {
+		lines++;
+		p++;
+	}
+	return lines;
+}
+
+/*
+ * The other algorithms spend much more time on big files than Myers'
+ * with xdiff's heuristics, which bound its cost.
+ */
+static long fallback_algorithm(long flags, unsigned long lines)
+{
+	if (ctx.cfg.max_diff_lines > 0 &&
+	    (flags & (XDF_NEED_MINIMAL | XDF_DIFF_ALGORITHM_MASK)) &&
+	    lines > ctx.cfg.max_diff_lines)
+		flags &= ~(XDF_NEED_MINIMAL | XDF_DIFF_ALGORITHM_MASK);
+	return flags;
+}
+
+static unsigned long filespec_lines(struct diff_filespec *spec)
+{
+	mmfile_t file;
+
+	if (!DIFF_FILE_VALID(spec) || diff_populate_filespec(spec, 0))
+		return 0;
+	file.ptr = spec->data;
+	file.size = spec->size;
+	return count_lines(&file);
+}
+
+/* The algorithm for diffing `pair` with git's own diff code, with the
+ * same fallback for big files as the diffs done by cgit itself. This
+ * loads the blobs, which the diff then reuses.
+ */
+long cgit_filepair_algorithm(struct diff_filepair *pair)
+{
+	if (ctx.cfg.max_diff_lines <= 0)
+		return cgit_diff_algorithm();
+	return fallback_algorithm(cgit_diff_algorithm(),
+				  filespec_lines(pair->one) +
+				  filespec_lines(pair->two));
+}
+
+void cgit_diff_job_init(struct cgit_diff_job *job,
+			const unsigned char *old_sha1,
+			const unsigned char *new_sha1, int context,
+			int ignorews)
+{
+	memset(job, 0, sizeof(*job));
+	hashcpy(job->old_sha1, old_sha1);
+	hashcpy(job->new_sha1, new_sha1);
+	job->context = context;
+	job->ignorews = ignorews;
+	strbuf_init(&job->lines, 0);
+	strbuf_init(&job->partial, 0);
+}
+
+static void free_job_files(struct cgit_diff_job *job)
+{
+	if (job->file1.ptr && !is_null_sha1(job->old_sha1))
+		free(job->file1.ptr);
+	if (job->file2.ptr && !is_null_sha1(job->new_sha1))
+		free(job->file2.ptr);
+	job->file1.ptr = NULL;
+	job->file2.ptr = NULL;
+}
+
+int cgit_diff_job_prepare(struct cgit_diff_job *job)
+{
+	unsigned long old_blob, new_blob, max_blob;
+
+	/* Don't diff blobs above max-diff-blob-size at all */
+	old_blob = blob_size(job->old_sha1);
+	new_blob = blob_size(job->new_sha1);
+	max_blob = (unsigned long)ctx.cfg.max_diff_blob_size * 1024;
+	if (max_blob && (old_blob > max_blob || new_blob > max_blob)) {
+		job->old_size = old_blob;
+		job->new_size = new_blob;
+		job->status = DIFF_FILES_TOO_LARGE;
+		return 0;
+	}
+
+	job->xpp.flags = cgit_diff_algorithm();
+	if (job->ignorews)
+		job->xpp.flags |= XDF_IGNORE_WHITESPACE;
+	if (job->context < 0)
+		job->xecfg.ctxlen = 0;
+	else
+		job->xecfg.ctxlen = job->context > 0 ? job->context : 3;
+	job->xecfg.flags = XDL_EMIT_FUNCNAMES;
+
+	job->key = diff_cache_key(job->old_sha1, job->new_sha1,
+				  old_blob + new_blob, job->xecfg.ctxlen,
+				  job->xpp.flags);
+	if (job->key && !read_cached_diff(job)) {
+		free(job->key);
+		job->key = NULL;
+		return 0;
+	}
+
+	if (!load_mmfile(&job->file1, job->old_sha1) ||
+	    !load_mmfile(&job->file2, job->new_sha1)) {
+		free_job_files(job);
+		free(job->key);
+		job->key = NULL;
+		job->status = DIFF_FILES_ERROR;
+		return 0;
+	}
+
+	job->old_size = job->file1.size;
+	job->new_size = job->file2.size;
+
+	if (buffer_is_binary(job->file1.ptr, job->file1.size) ||
+	    buffer_is_binary(job->file2.ptr, job->file2.size)) {
+		job->binary = 1;
+		return 0;
+	}
+
+	if (ctx.cfg.max_diff_lines > 0)
+		job->xpp.flags = fallback_algorithm(job->xpp.flags,
+				count_lines(&job->file1) +
+				count_lines(&job->file2));
+
+	job->record = job->key || !job->fn;
+	return 1;
+}
+
+void cgit_diff_job_run(struct cgit_diff_job *job)
+{
+	xdemitcb_t emit_cb;
+
+	memset(&emit_cb, 0, sizeof(emit_cb));
+	emit_cb.outf = filediff_cb;
+	emit_cb.priv = job;
+	if (xdl_diff(&job->file1, &job->file2, &job->xpp, &job->xecfg,
+		     &emit_cb)) {
+		/* Don't keep partial output */
+		free(job->key);
+		job->key = NULL;
+	}
+}
+
+void cgit_diff_job_finish(struct cgit_diff_job *job)
+{
+	if (job->key)
+		store_cached_diff(job);
+	free(job->key);
+	job->key = NULL;
+	free_job_files(job);
+	strbuf_release(&job->partial);
+}
+
+/* Pass each of the lines kept by a diff job to fn */
+void cgit_replay_diff_lines(struct strbuf *lines, linediff_fn fn)
+{
+	size_t pos = 0;
+	uint32_t len;
+
+	while (pos + 4 <= lines->len) {
+		len = get_be32(lines->buf + pos);
+		pos += 4;
+		fn(lines->buf + pos, len);
+		pos += len;
+	}
+}
+
+void cgit_diff_job_clear(struct cgit_diff_job *job)
+{
+	cgit_diff_job_finish(job);
+	strbuf_release(&job->lines);
+}
+
 int cgit_diff_files(const unsigned char *old_sha1,
 		    const unsigned char *new_sha1, unsigned long *old_size,
 		    unsigned long *new_size, int *binary, int context,
 		    int ignorews, linediff_fn fn)
 {
-	mmfile_t file1, file2;
-	xpparam_t diff_params;
-	xdemitconf_t emit_params;
-	xdemitcb_t emit_cb;
+	struct cgit_diff_job job;
+	int ret;
 
-	if (!load_mmfile(&file1, old_sha1) || !load_mmfile(&file2, new_sha1))
-		return 1;
+	cgit_diff_job_init(&job, old_sha1, new_sha1, context, ignorews);
+	job.fn = fn;
+	if (cgit_diff_job_prepare(&job))
+		cgit_diff_job_run(&job);
+	else
+		cgit_replay_diff_lines(&job.lines, fn);
+	cgit_diff_job_finish(&job);
+	*old_size = job.old_size;
+	*new_size = job.new_size;
+	*binary = job.binary;
+	ret = job.status;
+	cgit_diff_job_clear(&job);
+	return ret;
+}
 
-	*old_size = file1.size;
-	*new_size = file2.size;
+/*
+ * The file pairs of expensive tree diffs (many files, or many candidates
+ * for rename detection) are kept in the cache directory, keyed by the
+ * trees and the options, so that showing the same commit again only
+ * replays them.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGDT" version nr
+ *   nr * (status score old_mode new_mode old_sha1 new_sha1
+ *         old_path new_path)           status is one byte, paths are
+ *                                      \0-terminated
+ */
+#define TREE_CACHE_SIGNATURE "CGDT"
+#define TREE_CACHE_VERSION 1
+#define TREE_CACHE_HEADER_SIZE (4 + 4 + 4)
+#define TREE_CACHE_PAIR_SIZE (1 + 4 + 4 + 4 + 20 + 20)
+#define TREE_CACHE_MIN_COST 1024
+
+struct tree_record {
+	filepair_fn fn;
+	struct strbuf pairs;
+	uint32_t nr;
+};
+
+static void record_tree_cb(struct diff_queue_struct *q,
+			   struct diff_options *options, void *data)
+{
+	struct tree_record *rec = data;
+	struct diff_filepair *pair;
+	int i;
 
-	if ((file1.ptr && buffer_is_binary(file1.ptr, file1.size)) ||
-	    (file2.ptr && buffer_is_binary(file2.ptr, file2.size))) {
-		*binary = 1;
-		if (file1.size)
-			free(file1.ptr);
-		if (file2.size)
-			free(file2.ptr);
-		return 0;
+	for (i = 0; i < q->nr; i++) {
+		pair = q->queue[i];
+		if (pair->status == 'U')
+			continue;
+		strbuf_addch(&rec->pairs, pair->status);
+		cache_add_be32(&rec->pairs, pair->score);
+		cache_add_be32(&rec->pairs, pair->one->mode);
+		cache_add_be32(&rec->pairs, pair->two->mode);
+		strbuf_add(&rec->pairs, pair->one->sha1, 20);
+		strbuf_add(&rec->pairs, pair->two->sha1, 20);
+		strbuf_add(&rec->pairs, pair->one->path,
+			   strlen(pair->one->path) + 1);
+		strbuf_add(&rec->pairs, pair->two->path,
+			   strlen(pair->two->path) + 1);
+		rec->nr++;
+		rec->fn(pair);
 	}
+}
 
-	memset(&diff_params, 0, sizeof(diff_params));
-	memset(&emit_params, 0, sizeof(emit_params));
-	memset(&emit_cb, 0, sizeof(emit_cb));
-	diff_params.flags = XDF_NEED_MINIMAL;
-	if (ignorews)
-		diff_params.flags |= XDF_IGNORE_WHITESPACE;
-	emit_params.ctxlen = context > 0 ? context : 3;
-	emit_params.flags = XDL_EMIT_FUNCNAMES;
-	emit_cb.outf = filediff_cb;
-	emit_cb.priv = fn;
-	xdl_diff(&file1, &file2, &diff_params, &emit_params, &emit_cb);
-	if (file1.size)
-		free(file1.ptr);
-	if (file2.size)
-		free(file2.ptr);
+/* Estimate the work done by diffcore_std() on the queued file pairs */
+static unsigned long tree_diff_cost(struct diff_options *opt)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	unsigned long added = 0, deleted = 0;
+	int i;
+
+	for (i = 0; i < q->nr; i++) {
+		if (!DIFF_FILE_VALID(q->queue[i]->one))
+			added++;
+		else if (!DIFF_FILE_VALID(q->queue[i]->two))
+			deleted++;
+	}
+	return q->nr + (opt->detect_rename ? added * deleted : 0);
+}
+
+static const char *next_path(const unsigned char **p,
+			     const unsigned char *end)
+{
+	const char *path = (const char *)*p;
+	const unsigned char *nul = memchr(*p, '\0', end - *p);
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+	return path;
+}
+
+static int replay_tree_diff(const char *key, filepair_fn fn)
+{
+	struct cache_data data;
+	struct diff_filepair pair;
+	const unsigned char *p, *start, *end, *entry;
+	const char *old_path, *new_path;
+	uint32_t nr, i;
+
+	if (cache_open_data(&data, "tree", key))
+		return -1;
+	start = (const unsigned char *)data.buf;
+	end = start + data.len;
+	if (data.len < TREE_CACHE_HEADER_SIZE ||
+	    memcmp(start, TREE_CACHE_SIGNATURE, 4) ||
+	    get_be32(start + 4) != TREE_CACHE_VERSION)
+		goto invalid;
+	nr = get_be32(start + 8);
+	p = start + TREE_CACHE_HEADER_SIZE;
+	for (i = 0; i < nr; i++) {
+		if (end - p < TREE_CACHE_PAIR_SIZE)
+			goto invalid;
+		p += TREE_CACHE_PAIR_SIZE;
+		if (!next_path(&p, end) || !next_path(&p, end))
+			goto invalid;
+	}
+	if (p != end)
+		goto invalid;
+
+	p = start + TREE_CACHE_HEADER_SIZE;
+	for (i = 0; i < nr; i++) {
+		entry = p;
+		p += TREE_CACHE_PAIR_SIZE;
+		old_path = next_path(&p, end);
+		new_path = next_path(&p, end);
+		memset(&pair, 0, sizeof(pair));
+		pair.status = entry[0];
+		pair.score = get_be32(entry + 1);
+		pair.one = alloc_filespec(old_path);
+		fill_filespec(pair.one, entry + 13, !is_null_sha1(entry + 13),
+			      get_be32(entry + 5));
+		pair.two = alloc_filespec(new_path);
+		fill_filespec(pair.two, entry + 33, !is_null_sha1(entry + 33),
+			      get_be32(entry + 9));
+		fn(&pair);
+		free_filespec(pair.one);
+		free_filespec(pair.two);
+	}
+	cache_close_data(&data);
 	return 0;
+
+invalid:
+	cache_close_data(&data);
+	return -1;
 }
 
 void cgit_diff_tree(const unsigned char *old_sha1,
@@ -371,6 +786,20 @@ void cgit_diff_tree(const unsigned char *old_sha1,
 {
 	struct diff_options opt;
 	struct pathspec_item item;
+	struct tree_record rec;
+	struct strbuf buf = STRBUF_INIT;
+	char *key = NULL;
+
+	if (ctx.cfg.cache_size > 0) {
+		key = fmtalloc("%s %s\n%d %d\n%s",
+			       sha1_to_hex(old_sha1 ? old_sha1 : null_sha1),
+			       sha1_to_hex(new_sha1), ignorews,
+			       ctx.cfg.renamelimit, prefix ? prefix : "");
+		if (!replay_tree_diff(key, fn)) {
+			free(key);
+			return;
+		}
+	}
 
 	memset(&item, 0, sizeof(item));
 	diff_setup(&opt);
@@ -394,8 +823,27 @@ void cgit_diff_tree(const unsigned char *old_sha1,
 		diff_tree_sha1(old_sha1, new_sha1, "", &opt);
 	else
 		diff_root_tree_sha1(new_sha1, "", &opt);
+
+	if (key && tree_diff_cost(&opt) >= TREE_CACHE_MIN_COST) {
+		rec.fn = fn;
+		strbuf_init(&rec.pairs, 0);
+		rec.nr = 0;
+		opt.format_callback = record_tree_cb;
+		opt.format_callback_data = &rec;
+	}
 	diffcore_std(&opt);
 	diff_flush(&opt);
+
+	if (opt.format_callback == record_tree_cb) {
+		strbuf_add(&buf, TREE_CACHE_SIGNATURE, 4);
+		cache_add_be32(&buf, TREE_CACHE_VERSION);
+		cache_add_be32(&buf, rec.nr);
+		strbuf_addbuf(&buf, &rec.pairs);
+		cache_write_data("tree", key, buf.buf, buf.len);
+		strbuf_release(&buf);
+		strbuf_release(&rec.pairs);
+	}
+	free(key);
 }
 
 void cgit_diff_commit(struct commit *commit, filepair_fn fn, const char *prefix)
@@ -600,3 +1048,238 @@ char *get_mimetype_for_filename(const char *filename)
 	fclose(file);
 	return NULL;
 }
+
+/*
+ * Write a blob to stdout in constant memory. The first few bytes are
+ * read before anything is written and passed to fn, which can look at
+ * them (e.g. with buffer_is_binary()) to print the headers. Returns -1
+ * if the blob cannot be read, in which case nothing has been written;
+ * a read error later on truncates the output.
+ */
+int cgit_stream_blob(const unsigned char *sha1, blob_head_fn fn, void *data)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long size;
+	char buf[16384];
+	size_t len = 0, skip, left;
+	ssize_t readlen;
+
+	st = open_istream(sha1, &type, &size, NULL);
+	if (!st)
+		return -1;
+	while (len < STREAM_HEAD_SIZE && len < size) {
+		readlen = read_istream(st, buf + len, sizeof(buf) - len);
+		if (readlen <= 0)
+			break;
+		len += readlen;
+	}
+	if (len < size && len < STREAM_HEAD_SIZE) {
+		close_istream(st);
+		return -1;
+	}
+
+	if (fn)
+		fn(buf, len, size, data);
+
+	/* The part before a range is inflated and thrown away; there is
+	 * no way to seek in a deflated stream.
+	 */
+	skip = ctx.page.partial ? ctx.page.range_first : 0;
+	left = ctx.page.partial ? ctx.page.range_len : size;
+	readlen = len;
+	while (readlen > 0 && left) {
+		if (skip >= (size_t)readlen) {
+			skip -= readlen;
+		} else {
+			len = readlen - skip;
+			if (len > left)
+				len = left;
+			html_raw(buf + skip, len);
+			left -= len;
+			skip = 0;
+		}
+		if (left)
+			readlen = read_istream(st, buf, sizeof(buf));
+	}
+	close_istream(st);
+	return 0;
+}
+
+static int parse_range_number(const char **p, size_t *value)
+{
+	char *end;
+	uintmax_t n;
+
+	if (!isdigit(**p))
+		return -1;
+	errno = 0;
+	n = strtoumax(*p, &end, 10);
+	if (errno || n != (size_t)n)
+		return -1;
+	*value = n;
+	*p = end;
+	return 0;
+}
+
+int cgit_request_range(const char *etag, size_t size, size_t *first,
+		       size_t *len)
+{
+	const char *p = ctx.env.http_range;
+	size_t last;
+
+	if (!p || !skip_prefix(p, "bytes=", &p))
+		return 0;
+	/* A range only applies to the version of the body named by
+	 * If-Range; dates are not compared, they just get everything.
+	 */
+	if (ctx.env.http_if_range) {
+		if (!etag || *ctx.env.http_if_range != '"' ||
+		    strncmp(ctx.env.http_if_range + 1, etag, strlen(etag)) ||
+		    strcmp(ctx.env.http_if_range + 1 + strlen(etag), "\""))
+			return 0;
+	}
+
+	/* Multiple ranges would need a multipart response, and the
+	 * whole body is a valid answer to those too.
+	 */
+	if (*p == '-') {
+		p++;
+		if (parse_range_number(&p, &last) || *p)
+			return 0;
+		if (!last || !size)
+			return -1;
+		if (last > size)
+			last = size;
+		*first = size - last;
+		*len = last;
+		return 1;
+	}
+	if (parse_range_number(&p, first) || *p++ != '-')
+		return 0;
+	if (!*p)
+		last = size - 1;
+	else if (parse_range_number(&p, &last) || *p || last < *first)
+		return 0;
+	if (*first >= size)
+		return -1;
+	if (last >= size)
+		last = size - 1;
+	*len = last - *first + 1;
+	return 1;
+}
+
+/*
+ * Trees that paths have been looked up in, so that e.g. the readme of
+ * a subdirectory does not read its parents again.
+ */
+#define TREE_CACHE_SIZE 32
+
+struct cached_tree {
+	unsigned char sha1[20];
+	void *buf;
+	struct name_entry *entries;
+	int nr;
+};
+
+static struct cached_tree tree_cache[TREE_CACHE_SIZE];
+static int tree_cache_next;
+
+static struct cached_tree *read_cached_tree(const unsigned char *sha1)
+{
+	struct cached_tree *tree;
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	int i, alloc = 0;
+
+	for (i = 0; i < TREE_CACHE_SIZE; i++)
+		if (tree_cache[i].buf && !hashcmp(tree_cache[i].sha1, sha1))
+			return &tree_cache[i];
+
+	tree = &tree_cache[tree_cache_next];
+	tree_cache_next = (tree_cache_next + 1) % TREE_CACHE_SIZE;
+	free(tree->buf);
+	free(tree->entries);
+	memset(tree, 0, sizeof(*tree));
+
+	tree->buf = read_sha1_file(sha1, &type, &size);
+	if (!tree->buf)
+		return NULL;
+	if (type != OBJ_TREE) {
+		free(tree->buf);
+		tree->buf = NULL;
+		return NULL;
+	}
+	hashcpy(tree->sha1, sha1);
+	init_tree_desc(&desc, tree->buf, size);
+	while (tree_entry(&desc, &entry)) {
+		ALLOC_GROW(tree->entries, tree->nr + 1, alloc);
+		tree->entries[tree->nr++] = entry;
+	}
+	return tree;
+}
+
+/* Tree entries are sorted by name, with a '/' appended to the names of
+ * subtrees. A file and a subtree of the same name sort differently, so
+ * `mode` says which of them to look for.
+ */
+static struct name_entry *find_cached_tree_entry(struct cached_tree *tree,
+						 const char *name, int len,
+						 unsigned mode)
+{
+	struct name_entry *entry;
+	int lo = 0, hi = tree->nr, mi, cmp;
+
+	while (lo < hi) {
+		mi = lo + (hi - lo) / 2;
+		entry = &tree->entries[mi];
+		cmp = base_name_compare(entry->path, tree_entry_len(entry),
+					entry->mode, name, len, mode);
+		if (!cmp)
+			return entry;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+int cgit_get_path_entry(const unsigned char *tree_sha1, const char *path,
+			unsigned char *sha1, unsigned *mode)
+{
+	struct cached_tree *tree;
+	struct name_entry *entry;
+	unsigned char next[20];
+	const char *slash;
+	int len;
+
+	hashcpy(next, tree_sha1);
+	while (1) {
+		tree = read_cached_tree(next);
+		if (!tree)
+			return -1;
+		slash = strchrnul(path, '/');
+		len = slash - path;
+		if (!len)
+			return -1;
+		entry = NULL;
+		if (!*slash)
+			entry = find_cached_tree_entry(tree, path, len, 0);
+		if (!entry)
+			entry = find_cached_tree_entry(tree, path, len, S_IFDIR);
+		if (!entry)
+			return -1;
+		if (!*slash) {
+			hashcpy(sha1, entry->sha1);
+			*mode = entry->mode;
+			return 0;
+		}
+		if (!S_ISDIR(entry->mode))
+			return -1;
+		hashcpy(next, entry->sha1);
+		path = slash + 1;
+	}
+}
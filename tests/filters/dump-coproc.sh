@@ -0,0 +1,24 @@
+#!/bin/sh
+# The same as dump.sh, as a long-running filter speaking the coproc protocol.
+
+[ -n "$CGIT_COPROC_LOG" ] && echo started >>"$CGIT_COPROC_LOG"
+
+tmp=$(mktemp)
+trap 'rm -f "$tmp"' EXIT
+while read -r argc
+do
+	args=
+	while [ "$argc" -gt 0 ]
+	do
+		read -r len
+		args="$args$(head -c "$len") "
+		argc=$((argc - 1))
+	done
+	read -r len
+	{
+		[ -n "$args" ] && printf "%s" "$args"
+		head -c "$len" | tr '[:lower:]' '[:upper:]'
+	} >"$tmp"
+	printf "0\n%d\n" "$(wc -c <"$tmp")"
+	cat "$tmp"
+done
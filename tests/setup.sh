@@ -139,6 +139,15 @@ repo.commit-filter=exec:$FILTER_DIRECTORY/dump.sh
 repo.email-filter=exec:$FILTER_DIRECTORY/dump.sh
 repo.source-filter=exec:$FILTER_DIRECTORY/dump.sh
 repo.readme=master:a+b
+
+repo.url=filter-coproc
+repo.path=$PWD/repos/filter/.git
+repo.desc=filtered repo
+repo.about-filter=coproc:$FILTER_DIRECTORY/dump-coproc.sh
+repo.commit-filter=coproc:$FILTER_DIRECTORY/dump-coproc.sh
+repo.email-filter=coproc:$FILTER_DIRECTORY/dump-coproc.sh
+repo.source-filter=coproc:$FILTER_DIRECTORY/dump-coproc.sh
+repo.readme=master:a+b
 EOF
 
 	if [ $CGIT_HAS_LUA -eq 1 ]; then
@@ -173,4 +182,23 @@ strip_headers() {
 	cat
 }
 
+# Print the body of a page without the generation time in its footer, so
+# that pages generated at different times can be compared.
+cgit_page()
+{
+	cgit_url "$1" | strip_headers |
+	sed -e "s/ at [0-9-]* [0-9:]* (GMT)</</"
+}
+
+# Run a command with its output going to the file $1, and report how many
+# seconds it took.
+bench()
+{
+	out=$1 &&
+	shift &&
+	start=$(date +%s) &&
+	"$@" >"$out" &&
+	say "$*: $(($(date +%s) - start))s"
+}
+
 test -z "$CGIT_TEST_NO_CREATE_REPOS" && setup_repos
@@ -43,7 +43,7 @@ test_expect_success 'verify cache-size=1' '
 	cgit_url "bar/log" &&
 	cgit_url "bar/diff" &&
 	cgit_url "bar/patch" &&
-	ls cache >output &&
+	ls cache | grep "^[0-9a-f]\{8\}$" >output &&
 	test_line_count = 1 output
 '
 
@@ -65,7 +65,7 @@ test_expect_success 'verify cache-size=1021' '
 	cgit_url "bar/log" &&
 	cgit_url "bar/diff" &&
 	cgit_url "bar/patch" &&
-	ls cache >output &&
+	ls cache | grep "^[0-9a-f]\{8\}$" >output &&
 	test_line_count = 13 output &&
 	cgit_url "foo/ls_cache" >output.full &&
 	strip_headers <output.full >output &&
@@ -75,4 +75,21 @@ test_expect_success 'verify cache-size=1021' '
 	test_cmp output.full output.second
 '
 
+test_expect_success 'least recently used data files are pruned' '
+	echo "cache-data-size=2" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/* &&
+	for i in 1 2 3
+	do
+		printf "%01000d" 0 >cache/diff-0000000$i &&
+		touch -d "$((4 - i)) hours ago" cache/diff-0000000$i || return 1
+	done &&
+	cgit_url "foo/log" >/dev/null &&
+	ls cache/decorations-* &&
+	test_path_is_missing cache/diff-00000001 &&
+	test_path_is_missing cache/diff-00000002 &&
+	test_path_is_file cache/diff-00000003
+'
+
 test_done
@@ -21,4 +21,82 @@ test_expect_success 'no links with space in path' '! grep "href=./with space/" t
 test_expect_success 'no links with space in arg' '! grep "q=commit 1" tmp'
 test_expect_success 'commit 2 is not visible' '! grep "commit 2" tmp'
 
+test_expect_success 'log shows branch decoration' '
+	rm -f cache/???????? &&
+	cgit_url "foo/log" >tmp &&
+	grep "<a class=.branch-deco. href=./foo/log/.>master</a>" tmp
+'
+test_expect_success 'decoration map was created' '
+	ls cache | grep "^decorations-"
+'
+test_expect_success 'log shows new tag decorations' '
+	git --git-dir=repos/foo/.git tag -a -m "tag v1" v1 master~1 &&
+	git --git-dir=repos/foo/.git tag v2 master~2 &&
+	rm -f cache/???????? &&
+	cgit_url "foo/log" >tmp &&
+	grep "commit 4</a><span class=.decoration.><a class=.tag-deco. href=./foo/tag/?h=v1.>v1</a>" tmp &&
+	grep "commit 3</a><span class=.decoration.><a class=.tag-deco. href=./foo/tag/?h=v2.>v2</a>" tmp
+'
+test_expect_success 'log drops deleted tag decorations' '
+	git --git-dir=repos/foo/.git tag -d v2 &&
+	git --git-dir=repos/foo/.git pack-refs --all &&
+	rm -f cache/???????? &&
+	cgit_url "foo/log" >tmp &&
+	grep ">v1</a>" tmp &&
+	! grep ">v2</a>" tmp
+'
+
+test_expect_success 'enable search index' '
+	echo "enable-search-index=1" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc
+'
+test_expect_success 'generate "bar/log?qt=grep&q=commit+4"' '
+	cgit_url "bar/log&qt=grep&q=commit+4" >tmp
+'
+test_expect_success 'search index was created' '
+	ls cache | grep "^search-" >output &&
+	test_line_count = 1 output
+'
+test_expect_success 'find commit 4' 'grep "commit 4<" tmp'
+test_expect_success 'find commit 49' 'grep "commit 49<" tmp'
+test_expect_success 'commit 5 is not visible' '! grep "commit 5<" tmp'
+test_expect_success 'search is case insensitive' '
+	cgit_url "bar/log&qt=grep&q=COMMIT+4%24" >tmp &&
+	grep "commit 4<" tmp &&
+	! grep "commit 49<" tmp
+'
+test_expect_success 'search by author' '
+	cgit_url "bar/log&qt=author&q=u+thor" >tmp &&
+	grep "commit 50<" tmp &&
+	cgit_url "bar/log&qt=author&q=nobody" >tmp &&
+	! grep "commit 50<" tmp
+'
+test_expect_success 'index picks up new commits' '
+	(
+		cd repos/bar &&
+		echo 51 >file-51 &&
+		git add file-51 &&
+		git commit -m "commit 51 indexed"
+	) &&
+	cgit_url "bar/log&qt=grep&q=indexed" >tmp &&
+	grep "commit 51 indexed<" tmp &&
+	! grep "commit 50<" tmp
+'
+test_expect_success 'alternation falls back to walking the history' '
+	cgit_url "bar/log&qt=grep&q=commit+1%24%5C%7Ccommit+2%24" >tmp &&
+	grep "commit 1<" tmp &&
+	grep "commit 2<" tmp
+'
+test_expect_success 'search with an interval' '
+	cgit_url "bar/log&qt=grep&q=commi%5C%7B1%2C2%5C%7Dt+42%24" >tmp &&
+	grep "commit 42<" tmp &&
+	! grep "commit 4<" tmp
+'
+test_expect_success 'search with a character class' '
+	cgit_url "bar/log&qt=grep&q=%5B%5B%3Aalpha%3A%5D%5Dommit+42%24" >tmp &&
+	grep "commit 42<" tmp &&
+	! grep "commit 4<" tmp
+'
+
 test_done
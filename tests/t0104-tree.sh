@@ -29,4 +29,341 @@ test_expect_success 'verify a+b?h=1+2 link' '
 	grep "/foo+bar/tree/a+b?h=1%2b2" tmp
 '
 
+test_expect_success 'setup nested paths' '
+	mkdir -p repos/bar/a/b &&
+	echo deep >repos/bar/a/b/c &&
+	echo dot >repos/bar/a.b &&
+	echo dash >repos/bar/a-b &&
+	(cd repos/bar && git add a a.b a-b && git commit -m "nested paths")
+'
+
+test_expect_success 'tree of a nested file' '
+	cgit_url "bar/tree/a/b/c" >tmp &&
+	grep "blob: $(cd repos/bar && git rev-parse HEAD:a/b/c)" tmp &&
+	grep "<code>deep" tmp
+'
+
+test_expect_success 'tree of a nested directory' '
+	cgit_url "bar/tree/a/b" >tmp &&
+	grep "/bar/tree/a/b/c" tmp
+'
+
+test_expect_success 'plain files sorted around a directory' '
+	cgit_url "bar/plain/a.b" | strip_headers >output &&
+	echo dot >expected &&
+	test_cmp expected output &&
+	cgit_url "bar/plain/a-b" | strip_headers >output &&
+	echo dash >expected &&
+	test_cmp expected output
+'
+
+test_expect_success 'plain nested directory' '
+	cgit_url "bar/plain/a/b/" >tmp &&
+	grep "<h2>/a/b/</h2>" tmp &&
+	grep "/bar/plain/a/b/c" tmp
+'
+
+test_expect_success 'missing paths' '
+	cgit_url "bar/tree/a/x" >tmp &&
+	grep "Status: 404" tmp &&
+	cgit_url "bar/plain/a.b/c" >tmp &&
+	grep "Status: 404" tmp &&
+	cgit_url "bar/blob/a/x" >tmp &&
+	grep "Status: 404" tmp
+'
+
+test_expect_success 'setup large and binary files' '
+	test_seq 20000 >repos/bar/large &&
+	printf "bin\000ary" >repos/bar/binary &&
+	(cd repos/bar && git add large binary && git commit -m "large files")
+'
+
+test_expect_success 'plain large file' '
+	cgit_url "bar/plain/large" >tmp &&
+	grep "^Content-Type: text/plain" tmp &&
+	grep "^Content-Length: $(wc -c <repos/bar/large)" tmp &&
+	strip_headers <tmp >output &&
+	test_cmp repos/bar/large output
+'
+
+test_expect_success 'plain binary file' '
+	cgit_url "bar/plain/binary" >tmp &&
+	grep "^Content-Type: application/octet-stream" tmp &&
+	strip_headers <tmp >output &&
+	test_cmp repos/bar/binary output
+'
+
+test_expect_success 'tree view of a binary file' '
+	cgit_url "bar/tree/binary" >tmp &&
+	grep "<td class=.right.>0000</td><td class=.hex.> 62 69 6e 00 61 72 79 </td><td class=.hex.>bin.ary</td>" tmp &&
+	! grep "class=.pager." tmp
+'
+
+test_expect_success 'pages of a large binary file' '
+	{ printf "<&>\000" && test_seq 20000; } >repos/bar/bigbin &&
+	(cd repos/bar && git add bigbin && git commit -m "large binary") &&
+	cgit_url "bar/tree/bigbin" >tmp &&
+	grep "<td class=.right.>0000</td><td class=.hex.> 3c 26 3e 00 31 0a" tmp &&
+	grep "</td><td class=.hex.>&lt;&amp;&gt;.1.2.3" tmp &&
+	grep "<td class=.right.>ffe0</td>" tmp &&
+	! grep "<td class=.right.>10000</td>" tmp &&
+	grep "<a href=./bar/tree/bigbin?ofs=65536.>\[next\]</a>" tmp &&
+	! grep "\[prev\]" tmp &&
+	cgit_url "bar/tree/bigbin&ofs=65536" >tmp &&
+	grep "<td class=.right.>10000</td>" tmp &&
+	! grep "<td class=.right.>ffe0</td>" tmp &&
+	grep "<a href=./bar/tree/bigbin.>\[prev\]</a>" tmp &&
+	! grep "\[next\]" tmp
+'
+
+test_expect_success 'blob of large file' '
+	id=$(cd repos/bar && git rev-parse HEAD:large) &&
+	cgit_url "bar/blob/large&id=$id" >tmp &&
+	grep "^Content-Type: text/plain" tmp &&
+	strip_headers <tmp >output &&
+	test_cmp repos/bar/large output
+'
+
+test_expect_success 'plain range from the cache' '
+	rm -f cache/???????? &&
+	HTTP_RANGE=bytes=100-199 cgit_url "bar/plain/large" >tmp &&
+	grep "^Status: 206 Partial Content" tmp &&
+	grep "^Content-Range: bytes 100-199/$(wc -c <repos/bar/large)" tmp &&
+	grep "^Content-Length: 100" tmp &&
+	strip_headers <tmp >output &&
+	tail -c +101 repos/bar/large | head -c 100 >expected &&
+	test_cmp expected output
+'
+
+test_expect_success 'plain range without the cache' '
+	sed -e "s/^cache-size=.*/cache-size=0/" cgitrc >cgitrc.nocache &&
+	HTTP_RANGE=bytes=50000- CGIT_CONFIG="$PWD/cgitrc.nocache" \
+		QUERY_STRING="url=bar/plain/large" cgit >tmp &&
+	grep "^Status: 206 Partial Content" tmp &&
+	strip_headers <tmp >output &&
+	tail -c +50001 repos/bar/large >expected &&
+	test_cmp expected output
+'
+
+test_expect_success 'blob suffix range' '
+	id=$(cd repos/bar && git rev-parse HEAD:large) &&
+	HTTP_RANGE=bytes=-10 cgit_url "bar/blob/large&id=$id" >tmp &&
+	grep "^Status: 206 Partial Content" tmp &&
+	strip_headers <tmp >output &&
+	tail -c 10 repos/bar/large >expected &&
+	test_cmp expected output
+'
+
+test_expect_success 'unsatisfiable range' '
+	HTTP_RANGE=bytes=999999- cgit_url "bar/plain/large" >tmp &&
+	grep "^Status: 416" tmp &&
+	grep "^Content-Range: bytes \*/$(wc -c <repos/bar/large)" tmp &&
+	strip_headers <tmp >output &&
+	test_must_be_empty output
+'
+
+test_expect_success 'range of a changed object' '
+	HTTP_RANGE=bytes=0-9 HTTP_IF_RANGE="\"0000\"" \
+		cgit_url "bar/plain/large" >tmp &&
+	! grep "^Status:" tmp &&
+	strip_headers <tmp >output &&
+	test_cmp repos/bar/large output
+'
+
+test_expect_success 'tree view of a blob above max-blob-size' '
+	echo "max-blob-size=10" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	cgit_url "bar/tree/large" >tmp &&
+	grep "blob size (106KB) exceeds display size limit (10KB)" tmp
+'
+
+test_expect_success 'enable last commits' '
+	echo "enable-tree-last-commit=1" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc
+'
+
+test_expect_success 'last commit of each entry' '
+	rm -f cache/???????? &&
+	cgit_url "foo/tree" >tmp &&
+	grep "<th class=.left.>Last commit</th>" tmp &&
+	grep "tree/file-1.>file-1</a>.*>commit 1</a>" tmp &&
+	grep "tree/file-5.>file-5</a>.*>commit 5</a>" tmp &&
+	ls cache/lastcommit-* >/dev/null
+'
+
+test_expect_success 'last commit after new commits' '
+	(
+		cd repos/foo &&
+		echo changed >file-3 &&
+		mkdir dir &&
+		echo new >dir/file &&
+		git add file-3 dir &&
+		git commit -m "change 3"
+	) &&
+	rm -f cache/???????? &&
+	cgit_url "foo/tree" >tmp &&
+	grep "tree/file-3.>file-3</a>.*>change 3</a>" tmp &&
+	grep "tree/dir.>dir</a>.*>change 3</a>" tmp &&
+	grep "tree/file-2.>file-2</a>.*>commit 2</a>" tmp
+'
+
+test_expect_success 'last commit in a subdirectory' '
+	cgit_url "foo/tree/dir" >tmp &&
+	grep "tree/dir/file.>file</a>.*>change 3</a>" tmp
+'
+
+test_expect_success 'last commit of a commit id is not saved' '
+	rm -f cache/???????? cache/lastcommit-* &&
+	id=$(git --git-dir=repos/foo/.git rev-parse HEAD) &&
+	cgit_url "foo/tree&id=$id" >tmp &&
+	grep "tree/file-3?id=$id.>file-3</a>.*>change 3</a>" tmp &&
+	! ls cache/lastcommit-*
+'
+
+test_expect_success 'last commit after a rewrite' '
+	(cd repos/foo && git reset --hard HEAD~1) &&
+	rm -f cache/???????? &&
+	cgit_url "foo/tree" >tmp &&
+	grep "tree/file-3.>file-3</a>.*>commit 3</a>" tmp &&
+	! grep "tree/dir" tmp
+'
+
+test_expect_success 'bad object spans all columns' '
+	git init repos/broken &&
+	(
+		cd repos/broken &&
+		echo gone >gone &&
+		git add gone &&
+		git commit -m "gone" &&
+		rm -f .git/objects/$(git rev-parse HEAD:gone | sed "s|^..|&/|")
+	) &&
+	cat >>cgitrc <<-EOF &&
+	repo.url=broken
+	repo.path=$PWD/repos/broken/.git
+	EOF
+	cgit_url "broken/tree" >tmp &&
+	grep "<tr><td colspan=.7.>Bad object: gone " tmp
+'
+
+test_expect_success 'setup a large directory' '
+	mkdir repos/bar/many &&
+	for i in $(test_seq 300)
+	do
+		test_seq $i >repos/bar/many/f-$i || return 1
+	done &&
+	(cd repos/bar && git add many && git commit -m "many files" && git gc -q)
+'
+
+list_sizes() {
+	sed -n -e "s/.*>\(f-[0-9]*\)<\/a><\/td><td class=.ls-size.>\([0-9]*\)<.*/\1 \2/p"
+}
+
+test_expect_success 'sizes of a packed directory' '
+	rm -f cache/???????? &&
+	cgit_url "bar/tree/many" | list_sizes >output &&
+	(cd repos/bar && git ls-tree -l HEAD:many) |
+	awk "{ print \$5, \$4 }" >expected &&
+	test_cmp expected output &&
+	ls cache/treesizes-* >/dev/null
+'
+
+test_expect_success 'sizes of a directory from the cache' '
+	rm -f cache/???????? &&
+	cgit_url "bar/tree/many" | list_sizes >output &&
+	test_cmp expected output
+'
+
+test_expect_success 'pages of a large directory' '
+	echo "max-tree-entries=100" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? &&
+	cgit_url "bar/tree/many" >tmp &&
+	list_sizes <tmp >output &&
+	head -n 100 expected >expected.page &&
+	test_cmp expected.page output &&
+	grep "<a href=./bar/tree/many?ofs=100.>\[next\]</a>" tmp &&
+	! grep "\[prev\]" tmp &&
+	cgit_url "bar/tree/many&ofs=200" >tmp &&
+	list_sizes <tmp >output &&
+	tail -n 100 expected >expected.page &&
+	test_cmp expected.page output &&
+	grep "<a href=./bar/tree/many?ofs=100.>\[prev\]</a>" tmp &&
+	! grep "\[next\]" tmp
+'
+
+test_expect_success 'setup a file to blame' '
+	(
+		cd repos/foo &&
+		test_seq 5 >poem &&
+		git add poem &&
+		git commit -m "first poem" &&
+		sed -e "s/^3\$/three/" poem >poem.tmp &&
+		mv -f poem.tmp poem &&
+		git commit -a -m "second poem"
+	)
+'
+
+test_expect_success 'no blame unless enabled' '
+	cgit_url "foo/tree/poem" >tmp &&
+	! grep "/foo/blame/poem" tmp &&
+	cgit_url "foo/blame/poem" >tmp &&
+	grep "Status: 403" tmp
+'
+
+test_expect_success 'enable blame' '
+	echo "enable-blame=1" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc
+'
+
+test_expect_success 'blame of a file' '
+	rm -f cache/???????? &&
+	cgit_url "foo/tree/poem" >tmp &&
+	grep "/foo/blame/poem" tmp &&
+	cgit_url "foo/blame/poem" >tmp &&
+	grep "first poem.*<a id=.n1. href=.#n1.>1</a>" tmp &&
+	grep "second poem.*<a id=.n3. href=.#n3.>3</a>" tmp &&
+	grep "first poem.*<a id=.n4. href=.#n4.>4</a>" tmp &&
+	grep "<code>three$" tmp &&
+	ls cache/blame-* >/dev/null
+'
+
+test_expect_success 'blame after a new commit' '
+	(
+		cd repos/foo &&
+		echo 6 >>poem &&
+		git commit -a -m "third poem"
+	) &&
+	rm -f cache/???????? &&
+	cgit_url "foo/blame/poem" >tmp &&
+	grep "first poem.*<a id=.n1. href=.#n1.>1</a>" tmp &&
+	grep "second poem.*<a id=.n3. href=.#n3.>3</a>" tmp &&
+	grep "third poem.*<a id=.n6. href=.#n6.>6</a>" tmp
+'
+
+test_expect_success 'blame of an older revision' '
+	cgit_url "foo/blame/poem&id=HEAD~2" >tmp &&
+	grep "first poem.*<a id=.n1. href=.#n1.>1</a>" tmp &&
+	grep "<code>1$" tmp &&
+	! grep "second poem" tmp
+'
+
+test_expect_success 'blame of a commit not changing the file is kept' '
+	(
+		cd repos/foo &&
+		echo prose >prose &&
+		git add prose &&
+		git commit -m "prose"
+	) &&
+	ls cache | grep "^blame-" >before &&
+	rm -f cache/???????? &&
+	cgit_url "foo/blame/poem" >tmp &&
+	grep "third poem.*<a id=.n6. href=.#n6.>6</a>" tmp &&
+	ls cache | grep "^blame-" >after &&
+	test $(wc -l <after) = $(($(wc -l <before) + 1))
+'
+
 test_done
@@ -33,4 +33,41 @@ test_expect_success 'root commit contains diff' '
 	grep "<div class=.add.>+1</div>" tmp
 '
 
+test_expect_success 'generate commit with non-UTF-8 encoding' '
+	tree=$(cd repos/foo && git rev-parse HEAD^{tree}) &&
+	printf "tree %s\nauthor Ren\351<rene@example.org> 1 +0000\ncommitter C O Mitter <committer@example.com> 1 +0000\nencoding ISO-8859-1\n\nS\351ance\n\nbody\n" "$tree" >commit-obj &&
+	latin1=$(cd repos/foo && git hash-object -t commit -w ../../commit-obj) &&
+	cgit_url "foo/commit&id=$latin1" >tmp
+'
+
+test_expect_success 'commit subject is re-encoded' '
+	grep "<div class=.commit-subject.>Séance<" tmp
+'
+
+test_expect_success 'author without space before email' '
+	grep ">René &lt;rene@example.org&gt;<" tmp
+'
+
+test_expect_success 'generate commit renaming many files' '
+	mkdir repos/foo/many &&
+	for i in $(test_seq 40)
+	do
+		printf "file $i\nline 2\nline 3\n" >repos/foo/many/file-$i ||
+		return 1
+	done &&
+	(cd repos/foo && git add many && git commit -m "many files" &&
+	 git mv many moved && git commit -m "move many files") &&
+	rm -f cache/???????? cache/tree-* &&
+	cgit_page "foo/commit" >uncached &&
+	grep "40 files changed, 0 insertions, 0 deletions" uncached &&
+	grep "moved/file-7</a> (renamed from many/file-7)" uncached
+'
+
+test_expect_success 'file pairs of the commit are cached' '
+	test $(ls cache/tree-* | wc -l) = 1 &&
+	rm -f cache/???????? &&
+	cgit_page "foo/commit" >cached &&
+	test_cmp uncached cached
+'
+
 test_done
@@ -16,4 +16,214 @@ test_expect_success 'find added line' '
 	grep "<div class=.add.>+5</div>" tmp
 '
 
+test_expect_success 'generate diff of several files' '
+	id=$(cd repos/bar && git rev-parse HEAD~10) &&
+	cgit_page "bar/diff&id2=$id" >diff-buffered &&
+	grep "10 files changed, 10 insertions, 0 deletions" diff-buffered &&
+	cgit_page "bar/diff&id2=$id&dt=1" >ssdiff-buffered
+'
+
+test_expect_success 'diff without buffering is the same' '
+	echo "max-diff-buffer-size=0" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? &&
+	cgit_page "bar/diff&id2=$id" >diff-unbuffered &&
+	test_cmp diff-buffered diff-unbuffered &&
+	cgit_page "bar/diff&id2=$id&dt=1" >ssdiff-unbuffered &&
+	test_cmp ssdiff-buffered ssdiff-unbuffered
+'
+
+test_expect_success 'diff with several threads is the same' '
+	echo "diff-threads=4" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? &&
+	cgit_page "bar/diff&id2=$id" >diff-threads &&
+	test_cmp diff-buffered diff-threads &&
+	cgit_page "bar/diff&id2=$id&dt=1" >ssdiff-threads &&
+	test_cmp ssdiff-buffered ssdiff-threads
+'
+
+test_expect_success 'diff exceeding the buffer size is the same' '
+	sed -e "s/^max-diff-buffer-size=0$/max-diff-buffer-size=1/" \
+		cgitrc >cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	for i in $(test_seq 100)
+	do
+		echo "line $i" || return 1
+	done >repos/bar/file-50 &&
+	(cd repos/bar && git commit -a -m "long file") &&
+	id=$(cd repos/bar && git rev-parse HEAD~10) &&
+	rm -f cache/???????? &&
+	cgit_url "bar/diff&id2=$id" >diff-spilled &&
+	grep "9 files changed, 108 insertions, 0 deletions" diff-spilled &&
+	grep "<div class=.add.>+line 100</div>" diff-spilled
+'
+
+test_expect_success 'diff of large file is cached' '
+	for i in $(test_seq 3000)
+	do
+		echo "line $i" || return 1
+	done >repos/foo/file-1 &&
+	(cd repos/foo && git commit -a -m "large file") &&
+	rm -f cache/???????? &&
+	cgit_page "foo/diff" >diff-uncached &&
+	grep "<div class=.add.>+line 3000</div>" diff-uncached &&
+	ls cache | grep "^diff-" >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'cached diff is the same' '
+	rm -f cache/???????? &&
+	cgit_page "foo/diff" >diff-cached &&
+	test_cmp diff-uncached diff-cached
+'
+
+test_expect_success 'max-blob-size does not hide diffs' '
+	echo "max-blob-size=1" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? &&
+	cgit_url "foo/diff" >tmp &&
+	! grep "Large diff not shown" tmp &&
+	grep "+line 3000" tmp
+'
+
+test_expect_success 'diff of large blob is not shown' '
+	sed -e "s/^max-diff-buffer-size=1$/max-diff-blob-size=1/" \
+		cgitrc >cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? &&
+	cgit_url "foo/diff" >tmp &&
+	grep "<td class=.right.>large</td>" tmp &&
+	grep "Large diff not shown" tmp &&
+	grep "<a href=./foo/rawdiff/file-1.>raw diff</a>" tmp &&
+	! grep "+line 3000" tmp
+'
+
+test_expect_success 'raw diff is limited to the path' '
+	echo 6 >repos/foo/file-6 &&
+	(cd repos/foo && git add file-6 && git commit -a -m "file 6 and 1" &&
+	 echo 1 >file-1 && git commit -a -m "two files") &&
+	cgit_url "foo/rawdiff/file-1" >tmp &&
+	grep "^diff --git a/file-1 b/file-1" tmp &&
+	! grep "file-6" tmp
+'
+
+test_expect_success 'setup commit diffing differently per algorithm' '
+	printf "a\nb\nc\na\nb\nc\nx\n" >repos/foo/algo &&
+	(cd repos/foo && git add algo && git commit -m "algo") &&
+	printf "x\na\nb\nc\nd\na\nb\nc\n" >repos/foo/algo &&
+	(cd repos/foo && git commit -a -m "algo changed")
+'
+
+test_expect_success 'histogram is the default algorithm' '
+	rm -f cache/???????? &&
+	cgit_url "foo/diff" >tmp &&
+	grep "1 files changed, 7 insertions, 6 deletions" tmp &&
+	grep "<option value=.histogram. selected=.selected.>" tmp
+'
+
+test_expect_success 'algorithm can be chosen per request' '
+	cgit_url "foo/diff&algorithm=myers" >tmp &&
+	grep "1 files changed, 2 insertions, 1 deletions" tmp &&
+	grep "<option value=.myers. selected=.selected.>" tmp &&
+	grep "<a href=./foo/diff/algo?algorithm=myers.>" tmp
+'
+
+test_expect_success 'large files fall back to myers' '
+	echo "max-diff-lines=10" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? &&
+	cgit_url "foo/diff" >tmp &&
+	grep "1 files changed, 2 insertions, 1 deletions" tmp
+'
+
+test_expect_success 'raw diff falls back to myers too' '
+	cgit_url "foo/rawdiff" >tmp &&
+	grep "^+[^+]" tmp >output &&
+	test_line_count = 2 output
+'
+
+test_expect_success 'patch falls back to myers too' '
+	cgit_url "foo/patch" >tmp &&
+	grep "1 file changed, 2 insertions(+), 1 deletion(-)" tmp &&
+	grep "^+[^+]" tmp >output &&
+	test_line_count = 2 output
+'
+
+test_expect_success 'diff of many files is split into pages' '
+	echo "max-diff-files=4" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	id=$(cd repos/bar && git rev-parse HEAD~10) &&
+	rm -f cache/???????? cache/diffstat-* &&
+	cgit_url "bar/diff&id2=$id" >tmp &&
+	grep "9 files changed, 108 insertions, 0 deletions (showing files 1 to 4)" tmp &&
+	ls cache | grep "^diffstat-" >output &&
+	test_line_count = 1 output &&
+	test $(grep -o "<div class=.head. id=.diff-[0-9]*.>" tmp | wc -l) = 4 &&
+	grep "<div class=.head. id=.diff-3.>" tmp &&
+	grep "id2=$id&amp;ofs=4#diff-4.>file-46</a>" tmp &&
+	grep "id2=$id&amp;ofs=4.>\[next\]</a>" tmp &&
+	! grep "\[prev\]" tmp
+'
+
+test_expect_success 'last page of a split diff' '
+	cgit_url "bar/diff&id2=$id&ofs=8" >tmp &&
+	grep "9 files changed, 108 insertions, 0 deletions (showing files 9 to 9)" tmp &&
+	grep "<div class=.head. id=.diff-8.>diff --git a/file-50 b/file-50" tmp &&
+	! grep "<div class=.head. id=.diff-7.>" tmp &&
+	grep "id2=$id&amp;ofs=4.>\[prev\]</a>" tmp &&
+	! grep "\[next\]" tmp
+'
+
+test_expect_success 'diff that fits on one page keeps no diffstat' '
+	rm -f cache/???????? cache/diffstat-* &&
+	cgit_url "bar/diff" >tmp &&
+	grep "1 files changed, 100 insertions, 1 deletions" tmp &&
+	! ls cache | grep "^diffstat-"
+'
+
+test_expect_success 'hunks of a single file' '
+	cgit_url "bar/hunks/file-50&id2=$id" >tmp &&
+	grep "diff --git a/file-50 b/file-50" tmp &&
+	grep "<div class=.add.>+line 100</div>" tmp &&
+	! grep "diffstat" tmp &&
+	! grep "file-49" tmp &&
+	! grep "<html" tmp
+'
+
+test_expect_success 'changes in long lines are highlighted' '
+	long=$(printf "%0200d" 0) &&
+	echo "$long a" >repos/foo/long &&
+	(cd repos/foo && git add long && git commit -m "long line") &&
+	echo "$long b" >repos/foo/long &&
+	(cd repos/foo && git commit -a -m "long line changed") &&
+	rm -f cache/???????? &&
+	cgit_url "foo/diff&dt=1" >tmp &&
+	grep "<td class=.changed.>$long <span class=.del.>a" tmp &&
+	grep "<td class=.changed.>$long <span class=.add.>b" tmp
+'
+
+test_expect_success EXPENSIVE 'benchmark side-by-side diff of source lines' '
+	sed -e "s/^max-diff-blob-size=1$/max-diff-blob-size=0/" \
+		-e "s/^max-diff-lines=10$/max-diff-lines=0/" \
+		cgitrc >cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	for i in $(test_seq 10)
+	do
+		cat ../../*.c || return 1
+	done >repos/foo/source &&
+	(cd repos/foo && git add source && git commit -m "source") &&
+	sed -e "s/[a-z]/X/" repos/foo/source >source.tmp &&
+	mv -f source.tmp repos/foo/source &&
+	(cd repos/foo && git commit -a -m "source changed") &&
+	rm -f cache/???????? &&
+	bench ssdiff-source cgit_url "foo/diff&dt=1" &&
+	grep "<span class=.del.>" ssdiff-source
+'
+
 test_done
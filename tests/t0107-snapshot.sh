@@ -19,6 +19,15 @@ test_expect_success 'strip off the header lines' '
 	strip_headers <tmp >master.tar.gz
 '
 
+test_expect_success 'resume a cached snapshot' '
+	HTTP_RANGE=bytes=100- cgit_url "foo/snapshot/master.tar.gz" >tmp &&
+	grep "^Status: 206 Partial Content" tmp &&
+	grep "^Content-Range: bytes 100-" tmp &&
+	strip_headers <tmp >output &&
+	tail -c +101 master.tar.gz >expected &&
+	test_cmp expected output
+'
+
 test_expect_success 'verify gzip format' '
 	gunzip --test master.tar.gz
 '
@@ -3,7 +3,7 @@
 test_description='Check filtered content'
 . ./setup.sh
 
-prefixes="exec"
+prefixes="exec coproc"
 if [ $CGIT_HAS_LUA -eq 1 ]; then
 	prefixes="$prefixes lua"
 fi
@@ -43,4 +43,97 @@ do
 	'
 done
 
+test_expect_success 'coproc filters are started once per request' '
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/log/" >tmp &&
+	test $(grep -c "<author@example.com> log A U THOR" tmp) -eq 6 &&
+	echo started >expected &&
+	test_cmp expected coproc.log
+'
+
+test_expect_success 'filter output is not cached by default' '
+	rm -f cache/???????? cache/filter-* coproc.log &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/tree/a%2bb" >tmp &&
+	rm -f cache/???????? &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/tree/a%2bb" >tmp &&
+	grep "<code>a+b HELLO$" tmp &&
+	test_line_count = 2 coproc.log &&
+	! ls cache | grep "^filter-"
+'
+
+test_expect_success 'enable filter caching' '
+	echo "cache-filters=1" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc
+'
+
+test_expect_success 'source filter output is cached' '
+	rm -f cache/???????? cache/filter-* coproc.log &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/tree/a%2bb" >tmp &&
+	grep "<code>a+b HELLO$" tmp &&
+	test_line_count = 1 coproc.log &&
+	rm -f cache/???????? &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/tree/a%2bb" >tmp &&
+	grep "<code>a+b HELLO$" tmp &&
+	test_line_count = 1 coproc.log
+'
+
+test_expect_success 'about filter output is cached' '
+	rm -f cache/???????? cache/filter-* coproc.log &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/about/" >tmp &&
+	test_line_count = 1 coproc.log &&
+	rm -f cache/???????? &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-coproc/about/" >tmp &&
+	grep "<div id='"'"'summary'"'"'>a+b HELLO$" tmp &&
+	test_line_count = 1 coproc.log
+'
+
+test_expect_success 'changing the filter script runs it again' '
+	cp "$FILTER_DIRECTORY/dump-coproc.sh" coproc.sh &&
+	cat >>cgitrc <<-EOF &&
+	repo.url=filter-copy
+	repo.path=$PWD/repos/filter/.git
+	repo.source-filter=coproc:$PWD/coproc.sh
+	EOF
+	rm -f cache/???????? cache/filter-* coproc.log &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-copy/tree/a%2bb" >tmp &&
+	rm -f cache/???????? &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-copy/tree/a%2bb" >tmp &&
+	test_line_count = 1 coproc.log &&
+	echo >>coproc.sh &&
+	rm -f cache/???????? &&
+	CGIT_COPROC_LOG="$PWD/coproc.log" cgit_url "filter-copy/tree/a%2bb" >tmp &&
+	grep "<code>a+b HELLO$" tmp &&
+	test_line_count = 2 coproc.log
+'
+
+test_expect_success 'setup a counting email filter' '
+	write_script count.sh <<-EOF &&
+	echo "\$1" >>"$PWD/count.log"
+	exec "$FILTER_DIRECTORY/dump.sh" "\$@"
+	EOF
+	cat >>cgitrc <<-EOF
+	repo.url=filter-count
+	repo.path=$PWD/repos/filter/.git
+	repo.email-filter=exec:$PWD/count.sh
+	EOF
+'
+
+test_expect_success 'email filter runs once per author' '
+	rm -f cache/???????? count.log &&
+	cgit_url "filter-count/log/" >tmp &&
+	test $(grep -c "<author@example.com> log A U THOR" tmp) -eq 6 &&
+	echo "<author@example.com>" >expected &&
+	test_cmp expected count.log
+'
+
+test_expect_success 'email filter without memoization' '
+	echo "memoize-filters=0" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc &&
+	rm -f cache/???????? count.log &&
+	cgit_url "filter-count/log/" >tmp &&
+	test $(grep -c "<author@example.com> log A U THOR" tmp) -eq 6 &&
+	test_line_count = 6 count.log
+'
+
 test_done
@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='Check content on stats page'
+. ./setup.sh
+
+test_expect_success 'enable stats' '
+	echo "max-stats=year" >cgitrc.tmp &&
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc
+'
+
+test_expect_success 'generate foo/stats' 'cgit_url "foo/stats" >tmp'
+test_expect_success 'find author row' '
+	grep "<td class=.left.>A U Thor</td>.*<td class=.sum.>5</td></tr>" tmp
+'
+
+test_expect_success 'author stats were saved' '
+	ls cache | grep "^stats-" >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'stats of a commit id are not saved' '
+	rm -f cache/???????? cache/stats-* &&
+	id=$(git --git-dir=repos/foo/.git rev-parse HEAD) &&
+	cgit_url "foo/stats&h=$id" >tmp &&
+	grep "<td class=.left.>A U Thor</td>.*<td class=.sum.>5</td></tr>" tmp &&
+	! ls cache/stats-*
+'
+
+test_expect_success 'new commit is counted' '
+	(
+		cd repos/foo &&
+		echo 6 >file-6 &&
+		git add file-6 &&
+		GIT_AUTHOR_NAME="Other Author" git commit -m "commit 6"
+	) &&
+	rm -f cache/???????? &&
+	cgit_url "foo/stats" >tmp &&
+	grep "<td class=.left.>A U Thor</td>.*<td class=.sum.>5</td></tr>" tmp &&
+	grep "<td class=.left.>Other Author</td>.*<td class=.sum.>1</td></tr>" tmp &&
+	grep "<td class=.total.>Total</td>.*<td class=.sum.>6</td></tr>" tmp
+'
+
+test_expect_success 'yearly stats use the same counts' '
+	cgit_url "foo/stats&period=y" >tmp &&
+	grep "<td class=.total.>Total</td>.*<td class=.sum.>6</td></tr>" tmp
+'
+
+test_expect_success 'rewritten branch is counted again' '
+	(
+		cd repos/foo &&
+		git reset --hard HEAD~2
+	) &&
+	rm -f cache/???????? &&
+	cgit_url "foo/stats" >tmp &&
+	grep "<td class=.total.>Total</td>.*<td class=.sum.>4</td></tr>" tmp &&
+	! grep "Other Author" tmp
+'
+
+test_expect_success 'path limited stats' '
+	cgit_url "foo/stats/file-1" >tmp &&
+	grep "<td class=.total.>Total</td>.*<td class=.sum.>1</td></tr>" tmp
+'
+
+# A microbenchmark for the bookkeeping done per commit: with many
+# authors and commits within the shown periods, the page should take
+# about as long as walking the history does.
+test_expect_success EXPENSIVE 'setup large history' '
+	git init --bare repos/large.git &&
+	now=$(date +%s) &&
+	awk -v now=$now "BEGIN {
+		for (i = 0; i < 50000; i++) {
+			printf \"commit refs/heads/master\n\"
+			printf \"author Author %d <a%d@example.org> %d +0000\n\", i % 2000, i % 2000, now - 3600 * 24 * 300 + i * 500
+			printf \"committer C O Mitter <c@example.org> %d +0000\n\", now - 3600 * 24 * 300 + i * 500
+			printf \"data 12\ncommit %05d\n\", i
+		}
+	}" | (cd repos/large.git && git fast-import --quiet) &&
+	cat >>cgitrc <<-EOF
+	repo.url=large
+	repo.path=$PWD/repos/large.git
+	EOF
+'
+
+test_expect_success EXPENSIVE 'time walk of large history' '
+	bench /dev/null git --git-dir=repos/large.git rev-list --no-merges \
+		--since="1 year ago" master
+'
+
+test_expect_success EXPENSIVE 'time stats of large history' '
+	rm -f cache/???????? &&
+	bench tmp cgit_url "large/stats&period=y&ofs=-1" &&
+	grep "<td class=.total.>Total</td>.*<td class=.sum.>50000</td></tr>" tmp &&
+	bench tmp cgit_url "large/stats&period=m&ofs=-1" &&
+	grep "<td class=.left.>Author 1999</td>" tmp
+'
+
+test_done
@@ -0,0 +1,145 @@
+#!/bin/sh
+
+test_description='Check signed authentication cookies'
+. ./setup.sh
+
+bob="username|bob|0|abc|7b561fdaad692c93d9bc0fdd6aef3b2f36029c7e"
+alice="username|alice|0|abc|3be195ab8bdb9856ae148a482a51c15dbec20ed2"
+expired="username|bob|1|abc|db7024003a295c0cb7dbc195fe4bdcba45923e4f"
+spaced="username%7Cbob%2520smith%7C4102444800%7Cabc%7C8b01f976188828e84359ebee50ec4ef4924728e6"
+
+test_expect_success 'setup an auth filter letting bob see foo only' '
+	write_script auth.sh <<-EOF &&
+	echo "\$1 \$9" >>"$PWD/auth.log"
+	test "\$1" = body && echo "LOGIN FORM"
+	test "\$1" = authenticate-cookie || exit 0
+	case "\$9:\$2" in
+	foo:*"cgitauth=$bob"*|foo:*"cgitauth=$spaced"*|*:*"cgitauth=$alice"*)
+		exit 1;;
+	esac
+	exit 0
+	EOF
+	cat >cgitrc.tmp <<-EOF &&
+	auth-filter=exec:$PWD/auth.sh
+	auth-cookie-secret=secret
+	EOF
+	cat cgitrc >>cgitrc.tmp &&
+	mv -f cgitrc.tmp cgitrc
+'
+
+test_expect_success 'no cookie runs the filter' '
+	rm -f auth.log &&
+	cgit_url "foo/" >tmp &&
+	grep "LOGIN FORM" tmp &&
+	printf "authenticate-cookie foo\nbody foo\n" >expected &&
+	test_cmp expected auth.log
+'
+
+test_expect_success 'signed cookie runs the filter once per repository' '
+	rm -f auth.log &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "foo/" >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	grep "<a href=./foo/log/.>log</a>" tmp &&
+	rm -f cache/???????? &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "foo/" >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	grep "<a href=./foo/log/.>log</a>" tmp &&
+	echo "authenticate-cookie foo" >expected &&
+	test_cmp expected auth.log
+'
+
+test_expect_success 'signed cookie does not grant other repositories' '
+	rm -f auth.log &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "bar/" >tmp &&
+	grep "LOGIN FORM" tmp &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "bar/" >tmp &&
+	grep "LOGIN FORM" tmp &&
+	grep -c "authenticate-cookie" auth.log >count &&
+	echo 1 >expected &&
+	test_cmp expected count
+'
+
+test_expect_success 'the filter decides for each user' '
+	rm -f auth.log &&
+	HTTP_COOKIE="cgitauth=$alice" cgit_url "bar/" >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	echo "authenticate-cookie bar" >expected &&
+	test_cmp expected auth.log
+'
+
+test_expect_success 'changing the filter script runs it again' '
+	echo >>auth.sh &&
+	rm -f auth.log cache/???????? &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "foo/" >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	echo "authenticate-cookie foo" >expected &&
+	test_cmp expected auth.log
+'
+
+test_expect_success 'remembered answers expire' '
+	for f in cache/auth-*
+	do
+		size=$(wc -c <"$f") &&
+		printf "\000\000\000\000" |
+		dd of="$f" bs=1 seek=$((size - 4)) conv=notrunc 2>/dev/null ||
+		return 1
+	done &&
+	rm -f auth.log cache/???????? &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "foo/" >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	echo "authenticate-cookie foo" >expected &&
+	test_cmp expected auth.log
+'
+
+test_expect_success 'answers are not remembered with cache-auth-ttl=0' '
+	{ echo "cache-auth-ttl=0" && cat cgitrc; } >cgitrc.ttl &&
+	rm -f auth.log cache/???????? &&
+	HTTP_COOKIE="cgitauth=$bob" CGIT_CONFIG="$PWD/cgitrc.ttl" \
+		QUERY_STRING="url=foo/" cgit >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	echo "authenticate-cookie foo" >expected &&
+	test_cmp expected auth.log
+'
+
+test_expect_success 'signed cookie among other cookies' '
+	rm -f auth.log &&
+	HTTP_COOKIE="a=b; cgitauth=$spaced; c=d" cgit_url "foo/" >tmp &&
+	! grep "LOGIN FORM" tmp &&
+	grep "<a href=./foo/log/.>log</a>" tmp
+'
+
+test_expect_success 'forged cookie runs the filter' '
+	rm -f auth.log &&
+	HTTP_COOKIE="cgitauth=$(echo "$bob" | sed "s/bob/eve/")" \
+		cgit_url "foo/" >tmp &&
+	grep "LOGIN FORM" tmp &&
+	grep "authenticate-cookie" auth.log
+'
+
+test_expect_success 'expired cookie runs the filter' '
+	rm -f auth.log &&
+	HTTP_COOKIE="cgitauth=$expired" cgit_url "bar/" >tmp &&
+	grep "LOGIN FORM" tmp &&
+	grep "authenticate-cookie" auth.log
+'
+
+test_expect_success 'cookie with another secret runs the filter' '
+	sed "s/^auth-cookie-secret=.*/auth-cookie-secret=other/" cgitrc \
+		>cgitrc.other &&
+	rm -f auth.log &&
+	HTTP_COOKIE="cgitauth=$bob" CGIT_CONFIG="$PWD/cgitrc.other" \
+		QUERY_STRING="url=bar/" cgit >tmp &&
+	grep "LOGIN FORM" tmp &&
+	grep "authenticate-cookie" auth.log
+'
+
+test_expect_success 'pages are cached per user' '
+	rm -f cache/???????? &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "foo/" >tmp &&
+	HTTP_COOKIE="cgitauth=$bob" cgit_url "foo/" >tmp &&
+	HTTP_COOKIE="cgitauth=$alice" cgit_url "foo/" >tmp &&
+	ls cache | grep "^........$" >output &&
+	test_line_count = 2 output
+'
+
+test_done
@@ -0,0 +1,149 @@
+/* ui-blame.c: functions for blame output
+ *
+ * Copyright (C) 2006-2016 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ */
+
+#include "cgit.h"
+#include "ui-blame.h"
+#include "html.h"
+#include "ui-shared.h"
+#include "blame.h"
+
+static void print_commit(struct commit *commit)
+{
+	struct commitinfo *info;
+	char *rev, *title, shortrev[11];
+
+	info = cgit_parse_commit(commit);
+	rev = oid_to_hex(&commit->object.oid);
+	strlcpy(shortrev, rev, sizeof(shortrev));
+	title = fmtalloc("%s: %s", info->author, info->subject);
+	cgit_commit_link(shortrev, title, NULL, ctx.qry.head, rev, NULL);
+	html(" ");
+	cgit_open_filter(ctx.repo->email_filter, info->author_email, "blame");
+	html_txt(info->author);
+	cgit_close_filter(ctx.repo->email_filter);
+	html(" ");
+	cgit_print_age(commit->date, TM_WEEK * 2, FMT_SHORTDATE);
+	free(title);
+	cgit_free_commitinfo(info);
+}
+
+/* Print the lines from `first` up to `last`, which start at `buf`, and
+ * return the end of the last one.
+ */
+static char *print_lines(char *buf, char *end, int first, int last)
+{
+	char *p = buf, c;
+	int lineno;
+
+	html("<td class='linenumbers'><pre>");
+	for (lineno = first + 1; lineno <= last; lineno++)
+		htmlf("<a id='n%1$d' href='#n%1$d'>%1$d</a>\n", lineno);
+	html("</pre></td><td class='lines'><pre><code>");
+	for (lineno = first; lineno < last && p < end; lineno++) {
+		p = memchr(p, '\n', end - p);
+		p = p ? p + 1 : end;
+	}
+	c = *p;
+	*p = '\0';
+	html_txt(buf);
+	*p = c;
+	html("</code></pre></td>");
+	return p;
+}
+
+static void print_blame(struct cgit_blame *blame, char *buf,
+			unsigned long size)
+{
+	char *end = buf + size;
+	int i, j;
+
+	html("<table summary='blame' class='blob blame'>\n");
+	for (i = 0; i < blame->nr; i = j) {
+		for (j = i + 1; j < blame->nr; j++)
+			if (blame->lines[j] != blame->lines[i])
+				break;
+		html("<tr><td class='blame-commit'>");
+		print_commit(blame->lines[i]);
+		html("</td>");
+		buf = print_lines(buf, end, i, j);
+		html("</tr>\n");
+	}
+	html("</table>\n");
+}
+
+/*
+ * Show the commit that last changed each line of a file
+ *   rev:  the commit containing the file
+ *   path: path to the file
+ */
+void cgit_print_blame(const char *rev, const char *path)
+{
+	unsigned char sha1[20];
+	struct commit *commit;
+	struct cgit_blame blame;
+	enum object_type type;
+	unsigned long size;
+	unsigned mode;
+	char *buf;
+
+	if (!rev)
+		rev = ctx.qry.head;
+
+	if (get_sha1(rev, sha1)) {
+		cgit_print_error_page(404, "Not found",
+			"Invalid revision name: %s", rev);
+		return;
+	}
+	commit = lookup_commit_reference(sha1);
+	if (!commit || parse_commit(commit)) {
+		cgit_print_error_page(404, "Not found",
+			"Invalid commit reference: %s", rev);
+		return;
+	}
+	if (!path || cgit_get_path_entry(commit->tree->object.oid.hash, path,
+					 sha1, &mode) || !S_ISREG(mode)) {
+		cgit_print_error_page(404, "Not found", "Path not found");
+		return;
+	}
+
+	type = sha1_object_info(sha1, &size);
+	if (type != OBJ_BLOB) {
+		cgit_print_error_page(404, "Not found",
+			"Bad object name: %s", sha1_to_hex(sha1));
+		return;
+	}
+	if (ctx.cfg.max_blob_size && size / 1024 > ctx.cfg.max_blob_size) {
+		cgit_print_layout_start();
+		htmlf("<div class='error'>blob size (%ldKB) exceeds display size limit (%dKB).</div>",
+		      size / 1024, ctx.cfg.max_blob_size);
+		cgit_print_layout_end();
+		return;
+	}
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf) {
+		cgit_print_error_page(500, "Internal server error",
+			"Error reading object %s", sha1_to_hex(sha1));
+		return;
+	}
+
+	cgit_print_layout_start();
+	htmlf("blob: %s (", sha1_to_hex(sha1));
+	cgit_tree_link("tree", NULL, NULL, ctx.qry.head, rev, path);
+	html(", ");
+	cgit_plain_link("plain", NULL, NULL, ctx.qry.head, rev, path);
+	html(")\n");
+
+	if (buffer_is_binary(buf, size))
+		html("<div class='error'>Cannot blame a binary file.</div>");
+	else if (cgit_blame(commit, path, &blame))
+		html("<div class='error'>Unable to find the blame of the file.</div>");
+	else
+		print_blame(&blame, buf, size);
+	free(buf);
+	cgit_print_layout_end();
+}
@@ -0,0 +1,6 @@
+#ifndef UI_BLAME_H
+#define UI_BLAME_H
+
+extern void cgit_print_blame(const char *rev, const char *path);
+
+#endif /* UI_BLAME_H */
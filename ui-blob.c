@@ -11,25 +11,21 @@
 #include "html.h"
 #include "ui-shared.h"
 
-struct walk_tree_context {
-	const char *match_path;
-	unsigned char *matched_sha1;
-	unsigned int found_path:1;
-	unsigned int file_only:1;
-};
-
-static int walk_tree(const unsigned char *sha1, struct strbuf *base,
-		const char *pathname, unsigned mode, int stage, void *cbdata)
+/* Find the blob (or with !file_only, any object) at `path` in commit */
+static int find_path(const unsigned char *commit_sha1, const char *path,
+		     int file_only, unsigned char *sha1)
 {
-	struct walk_tree_context *walk_tree_ctx = cbdata;
-
-	if (walk_tree_ctx->file_only && !S_ISREG(mode))
-		return READ_TREE_RECURSIVE;
-	if (strncmp(base->buf, walk_tree_ctx->match_path, base->len)
-		|| strcmp(walk_tree_ctx->match_path + base->len, pathname))
-		return READ_TREE_RECURSIVE;
-	memmove(walk_tree_ctx->matched_sha1, sha1, 20);
-	walk_tree_ctx->found_path = 1;
+	struct commit *commit;
+	unsigned mode;
+
+	commit = lookup_commit_reference(commit_sha1);
+	if (!commit || parse_commit(commit))
+		return -1;
+	if (cgit_get_path_entry(commit->tree->object.oid.hash, path, sha1,
+				&mode))
+		return -1;
+	if (file_only && !S_ISREG(mode))
+		return -1;
 	return 0;
 }
 
@@ -37,93 +33,63 @@ int cgit_ref_path_exists(const char *path, const char *ref, int file_only)
 {
 	unsigned char sha1[20];
 	unsigned long size;
-	struct pathspec_item path_items = {
-		.match = path,
-		.len = strlen(path)
-	};
-	struct pathspec paths = {
-		.nr = 1,
-		.items = &path_items
-	};
-	struct walk_tree_context walk_tree_ctx = {
-		.match_path = path,
-		.matched_sha1 = sha1,
-		.found_path = 0,
-		.file_only = file_only
-	};
 
 	if (get_sha1(ref, sha1))
 		return 0;
 	if (sha1_object_info(sha1, &size) != OBJ_COMMIT)
 		return 0;
-	read_tree_recursive(lookup_commit_reference(sha1)->tree, "", 0, 0, &paths, walk_tree, &walk_tree_ctx);
-	return walk_tree_ctx.found_path;
+	return !find_path(sha1, path, file_only, sha1);
 }
 
-int cgit_print_file(char *path, const char *head, int file_only)
+int cgit_find_file(char *path, const char *head, int file_only,
+		   unsigned char *sha1)
 {
-	unsigned char sha1[20];
 	enum object_type type;
-	char *buf;
 	unsigned long size;
-	struct commit *commit;
-	struct pathspec_item path_items = {
-		.match = path,
-		.len = strlen(path)
-	};
-	struct pathspec paths = {
-		.nr = 1,
-		.items = &path_items
-	};
-	struct walk_tree_context walk_tree_ctx = {
-		.match_path = path,
-		.matched_sha1 = sha1,
-		.found_path = 0,
-		.file_only = file_only
-	};
 
 	if (get_sha1(head, sha1))
 		return -1;
 	type = sha1_object_info(sha1, &size);
 	if (type == OBJ_COMMIT) {
-		commit = lookup_commit_reference(sha1);
-		read_tree_recursive(commit->tree, "", 0, 0, &paths, walk_tree, &walk_tree_ctx);
-		if (!walk_tree_ctx.found_path)
+		if (find_path(sha1, path, file_only, sha1))
 			return -1;
 		type = sha1_object_info(sha1, &size);
 	}
 	if (type == OBJ_BAD)
 		return -1;
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf)
-		return -1;
-	buf[size] = '\0';
-	html_raw(buf, size);
-	free(buf);
 	return 0;
 }
 
+int cgit_print_file(char *path, const char *head, int file_only)
+{
+	unsigned char sha1[20];
+
+	if (cgit_find_file(path, head, file_only, sha1))
+		return -1;
+	return cgit_stream_blob(sha1, NULL, NULL);
+}
+
+static void print_blob_headers(const char *buf, unsigned long len,
+			       unsigned long size, void *data)
+{
+	if (buffer_is_binary(buf, len))
+		ctx.page.mimetype = "application/octet-stream";
+	else
+		ctx.page.mimetype = "text/plain";
+	ctx.page.filename = data;
+	ctx.page.size = size;
+	ctx.page.ranges = 1;
+
+	html("X-Content-Type-Options: nosniff\n");
+	html("Content-Security-Policy: default-src 'none'\n");
+	cgit_print_http_headers();
+}
+
 void cgit_print_blob(const char *hex, char *path, const char *head, int file_only)
 {
 	unsigned char sha1[20];
 	enum object_type type;
-	char *buf;
 	unsigned long size;
-	struct commit *commit;
-	struct pathspec_item path_items = {
-		.match = path,
-		.len = path ? strlen(path) : 0
-	};
-	struct pathspec paths = {
-		.nr = 1,
-		.items = &path_items
-	};
-	struct walk_tree_context walk_tree_ctx = {
-		.match_path = path,
-		.matched_sha1 = sha1,
-		.found_path = 0,
-		.file_only = file_only
-	};
 
 	if (hex) {
 		if (get_sha1_hex(hex, sha1)) {
@@ -142,9 +108,12 @@ void cgit_print_blob(const char *hex, char *path, const char *head, int file_onl
 	type = sha1_object_info(sha1, &size);
 
 	if ((!hex) && type == OBJ_COMMIT && path) {
-		commit = lookup_commit_reference(sha1);
-		read_tree_recursive(commit->tree, "", 0, 0, &paths, walk_tree, &walk_tree_ctx);
-		type = sha1_object_info(sha1,&size);
+		if (find_path(sha1, path, file_only, sha1)) {
+			cgit_print_error_page(404, "Not found",
+					"Path not found: %s", path);
+			return;
+		}
+		type = sha1_object_info(sha1, &size);
 	}
 
 	if (type == OBJ_BAD) {
@@ -153,23 +122,8 @@ void cgit_print_blob(const char *hex, char *path, const char *head, int file_onl
 		return;
 	}
 
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf) {
+	ctx.page.etag = sha1_to_hex(sha1);
+	if (cgit_stream_blob(sha1, print_blob_headers, path))
 		cgit_print_error_page(500, "Internal server error",
 				"Error reading object %s", hex);
-		return;
-	}
-
-	buf[size] = '\0';
-	if (buffer_is_binary(buf, size))
-		ctx.page.mimetype = "application/octet-stream";
-	else
-		ctx.page.mimetype = "text/plain";
-	ctx.page.filename = path;
-
-	html("X-Content-Type-Options: nosniff\n");
-	html("Content-Security-Policy: default-src 'none'\n");
-	cgit_print_http_headers();
-	html_raw(buf, size);
-	free(buf);
 }
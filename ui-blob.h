@@ -2,6 +2,8 @@
 #define UI_BLOB_H
 
 extern int cgit_ref_path_exists(const char *path, const char *ref, int file_only);
+extern int cgit_find_file(char *path, const char *head, int file_only,
+			  unsigned char *sha1);
 extern int cgit_print_file(char *path, const char *head, int file_only);
 extern void cgit_print_blob(const char *hex, char *path, const char *head, int file_only);
 
@@ -41,8 +41,6 @@ void cgit_print_commit(char *hex, const char *prefix)
 
 	format_display_notes(sha1, &notes, PAGE_ENCODING, 0);
 
-	load_ref_decorations(DECORATE_FULL_REFS);
-
 	cgit_print_layout_start();
 	cgit_print_diff_ctrls();
 	html("<table summary='commit info' class='commit-info'>\n");
@@ -138,7 +136,7 @@ void cgit_print_commit(char *hex, const char *prefix)
 			tmp = oid_to_hex(&commit->parents->item->object.oid);
 		else
 			tmp = NULL;
-		cgit_print_diff(ctx.qry.sha1, tmp, prefix, 0, 0);
+		cgit_print_diff(ctx.qry.sha1, tmp, prefix, 0, DIFF_OUTPUT_PAGE);
 	}
 	strbuf_release(&notes);
 	cgit_free_commitinfo(info);
@@ -8,16 +8,18 @@
 
 #include "cgit.h"
 #include "ui-diff.h"
+#include "cache.h"
 #include "html.h"
 #include "ui-shared.h"
 #include "ui-ssdiff.h"
+#include "diff-pool.h"
 
 unsigned char old_rev_sha1[20];
 unsigned char new_rev_sha1[20];
 
 static int files, slots;
 static int total_adds, total_rems, max_changes;
-static int lines_added, lines_removed;
+static int lines_added, lines_removed, diff_errors;
 
 static struct fileinfo {
 	char status;
@@ -32,24 +34,59 @@ static struct fileinfo {
 	unsigned long old_size;
 	unsigned long new_size;
 	unsigned int binary:1;
+	unsigned int too_large:1;
+	unsigned int buffered:1;
+	struct strbuf lines;
 } *items;
 
 static int use_ssdiff = 0;
-static struct diff_filepair *current_filepair;
-static const char *current_prefix;
+static struct diff_filespec *current_old_file, *current_new_file;
+static const char *current_prefix, *diff_prefix;
+
+/*
+ * Diffs of more than max-diff-files files are split into pages of that
+ * many files: the diffstat lists all of them, but only the files from
+ * first_file up to last_file are shown.
+ */
+static int page_files, first_file, last_file;
+
+/*
+ * The diff of each file is computed once, while collecting the diffstat,
+ * and the output lines are kept in the fileinfo to render the diff
+ * itself. Once more than max_buffered bytes of output have been kept,
+ * the remaining files are diffed again when they are shown.
+ */
+static size_t buffered, max_buffered;
+
+/*
+ * The diffstat of a diff split into pages is kept in the cache directory,
+ * so that the other pages only diff their own files.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGDS" version nr
+ *   nr * (flags added removed old_size new_size)
+ *                                      flags is one byte: 1 for binary
+ *                                      files, 2 for files too large to
+ *                                      diff
+ */
+#define DIFFSTAT_SIGNATURE "CGDS"
+#define DIFFSTAT_VERSION 1
+#define DIFFSTAT_HEADER_SIZE (4 + 4 + 4)
+#define DIFFSTAT_FILE_SIZE (1 + 4 + 4 + 4 + 4)
 
 struct diff_filespec *cgit_get_current_old_file(void)
 {
-	return current_filepair->one;
+	return current_old_file;
 }
 
 struct diff_filespec *cgit_get_current_new_file(void)
 {
-	return current_filepair->two;
+	return current_new_file;
 }
 
-static void print_fileinfo(struct fileinfo *info)
+static void print_fileinfo(int nr)
 {
+	struct fileinfo *info = &items[nr];
 	char *class;
 
 	switch (info->status) {
@@ -97,8 +134,13 @@ static void print_fileinfo(struct fileinfo *info)
 		html("]</span>");
 	}
 	htmlf("</td><td class='%s'>", class);
-	cgit_diff_link(info->new_path, NULL, NULL, ctx.qry.head, ctx.qry.sha1,
-		       ctx.qry.sha2, info->new_path);
+	if (page_files)
+		cgit_diff_page_link(info->new_path, NULL, NULL, ctx.qry.head,
+				    ctx.qry.sha1, ctx.qry.sha2, diff_prefix,
+				    nr - nr % page_files, fmt("diff-%d", nr));
+	else
+		cgit_diff_link(info->new_path, NULL, NULL, ctx.qry.head,
+			       ctx.qry.sha1, ctx.qry.sha2, info->new_path);
 	if (info->status == DIFF_STATUS_COPIED || info->status == DIFF_STATUS_RENAMED) {
 		htmlf(" (%s from ",
 		      info->status == DIFF_STATUS_COPIED ? "copied" : "renamed");
@@ -106,8 +148,9 @@ static void print_fileinfo(struct fileinfo *info)
 		html(")");
 	}
 	html("</td><td class='right'>");
-	if (info->binary) {
-		htmlf("bin</td><td class='graph'>%ld -> %ld bytes",
+	if (info->binary || info->too_large) {
+		htmlf("%s</td><td class='graph'>%ld -> %ld bytes",
+		      info->binary ? "bin" : "large",
 		      info->old_size, info->new_size);
 		return;
 	}
@@ -150,18 +193,12 @@ static int show_filepair(struct diff_filepair *pair)
 
 static void inspect_filepair(struct diff_filepair *pair)
 {
-	int binary = 0;
-	unsigned long old_size = 0;
-	unsigned long new_size = 0;
+	struct fileinfo *info;
 
 	if (!show_filepair(pair))
 		return;
 
 	files++;
-	lines_added = 0;
-	lines_removed = 0;
-	cgit_diff_files(pair->one->sha1, pair->two->sha1, &old_size, &new_size,
-			&binary, 0, ctx.qry.ignorews, count_diff_lines);
 	if (files >= slots) {
 		if (slots == 0)
 			slots = 4;
@@ -169,28 +206,158 @@ static void inspect_filepair(struct diff_filepair *pair)
 			slots = slots * 2;
 		items = xrealloc(items, slots * sizeof(struct fileinfo));
 	}
-	items[files-1].status = pair->status;
-	hashcpy(items[files-1].old_sha1, pair->one->sha1);
-	hashcpy(items[files-1].new_sha1, pair->two->sha1);
-	items[files-1].old_mode = pair->one->mode;
-	items[files-1].new_mode = pair->two->mode;
-	items[files-1].old_path = xstrdup(pair->one->path);
-	items[files-1].new_path = xstrdup(pair->two->path);
-	items[files-1].added = lines_added;
-	items[files-1].removed = lines_removed;
-	items[files-1].old_size = old_size;
-	items[files-1].new_size = new_size;
-	items[files-1].binary = binary;
-	if (lines_added + lines_removed > max_changes)
-		max_changes = lines_added + lines_removed;
-	total_adds += lines_added;
-	total_rems += lines_removed;
+	info = &items[files-1];
+	memset(info, 0, sizeof(*info));
+	strbuf_init(&info->lines, 0);
+	info->status = pair->status;
+	hashcpy(info->old_sha1, pair->one->sha1);
+	hashcpy(info->new_sha1, pair->two->sha1);
+	info->old_mode = pair->one->mode;
+	info->new_mode = pair->two->mode;
+	info->old_path = xstrdup(pair->one->path);
+	info->new_path = xstrdup(pair->two->path);
 }
 
-static void cgit_print_diffstat(const unsigned char *old_sha1,
-				const unsigned char *new_sha1,
-				const char *prefix)
+static void add_changes(struct fileinfo *info)
 {
+	if (info->added + info->removed > max_changes)
+		max_changes = info->added + info->removed;
+	total_adds += info->added;
+	total_rems += info->removed;
+}
+
+static void count_file(int nr, struct cgit_diff_job *job, void *data)
+{
+	struct fileinfo *info = &items[nr];
+
+	if (!job)
+		return;
+
+	if (job->status == DIFF_FILES_ERROR)
+		diff_errors++;
+	lines_added = 0;
+	lines_removed = 0;
+	cgit_replay_diff_lines(&job->lines, count_diff_lines);
+	if (max_buffered && job->status != DIFF_FILES_ERROR &&
+	    nr >= first_file && nr < last_file) {
+		/* Otherwise let print_file() report the error */
+		if (buffered + job->lines.len <= max_buffered) {
+			strbuf_swap(&info->lines, &job->lines);
+			buffered += info->lines.len;
+			info->buffered = 1;
+		} else {
+			max_buffered = 0;
+		}
+	}
+	info->too_large = job->status == DIFF_FILES_TOO_LARGE;
+	info->added = lines_added;
+	info->removed = lines_removed;
+	info->old_size = job->old_size;
+	info->new_size = job->new_size;
+	info->binary = job->binary;
+	add_changes(info);
+	cgit_diff_job_clear(job);
+}
+
+/*
+ * Diff the files that need it and pass each of them to fn in order. The
+ * file diffs are independent, so they can be run by several threads.
+ */
+static void diff_files(diff_job_fn fn, int context, int first, int last)
+{
+	struct cgit_diff_job *jobs, **todo;
+	struct fileinfo *info;
+	int i;
+
+	jobs = xcalloc(files, sizeof(*jobs));
+	todo = xcalloc(files, sizeof(*todo));
+	for (i = first; i < last; i++) {
+		info = &items[i];
+		if (S_ISGITLINK(info->old_mode) || S_ISGITLINK(info->new_mode))
+			continue;
+		if (info->buffered || info->too_large)
+			continue;
+		todo[i] = &jobs[i];
+		/* Files of other pages are only counted */
+		cgit_diff_job_init(todo[i], info->old_sha1, info->new_sha1,
+				   i >= first_file && i < last_file ? context : -1,
+				   ctx.qry.ignorews);
+	}
+	cgit_run_diff_jobs(todo, files, fn, NULL);
+	free(todo);
+	free(jobs);
+}
+
+static char *diffstat_key(const char *prefix)
+{
+	if (ctx.cfg.cache_size <= 0)
+		return NULL;
+	return fmtalloc("%s %s\n%d %d %ld %d %d\n%s\n%s",
+			sha1_to_hex(old_rev_sha1), sha1_to_hex(new_rev_sha1),
+			ctx.qry.ignorews, ctx.cfg.renamelimit,
+			cgit_diff_algorithm(), ctx.cfg.max_diff_lines,
+			ctx.cfg.max_diff_blob_size, prefix ? prefix : "",
+			current_prefix ? current_prefix : "");
+}
+
+static int read_diffstat(const char *key)
+{
+	struct cache_data data;
+	const unsigned char *p;
+	struct fileinfo *info;
+	int i;
+
+	if (cache_open_data(&data, "diffstat", key))
+		return -1;
+	p = (const unsigned char *)data.buf;
+	if (data.len != DIFFSTAT_HEADER_SIZE + files * DIFFSTAT_FILE_SIZE ||
+	    memcmp(p, DIFFSTAT_SIGNATURE, 4) ||
+	    get_be32(p + 4) != DIFFSTAT_VERSION || get_be32(p + 8) != files) {
+		cache_close_data(&data);
+		return -1;
+	}
+	p += DIFFSTAT_HEADER_SIZE;
+	for (i = 0; i < files; i++, p += DIFFSTAT_FILE_SIZE) {
+		info = &items[i];
+		info->binary = !!(p[0] & 1);
+		info->too_large = !!(p[0] & 2);
+		info->added = get_be32(p + 1);
+		info->removed = get_be32(p + 5);
+		info->old_size = get_be32(p + 9);
+		info->new_size = get_be32(p + 13);
+		add_changes(info);
+	}
+	cache_close_data(&data);
+	return 0;
+}
+
+static void write_diffstat(const char *key)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct fileinfo *info;
+	int i;
+
+	strbuf_add(&buf, DIFFSTAT_SIGNATURE, 4);
+	cache_add_be32(&buf, DIFFSTAT_VERSION);
+	cache_add_be32(&buf, files);
+	for (i = 0; i < files; i++) {
+		info = &items[i];
+		if (info->old_size > 0xffffffff || info->new_size > 0xffffffff)
+			goto out;
+		strbuf_addch(&buf, info->binary | info->too_large << 1);
+		cache_add_be32(&buf, info->added);
+		cache_add_be32(&buf, info->removed);
+		cache_add_be32(&buf, info->old_size);
+		cache_add_be32(&buf, info->new_size);
+	}
+	cache_write_data("diffstat", key, buf.buf, buf.len);
+out:
+	strbuf_release(&buf);
+}
+
+static void cgit_print_diffstat(const char *prefix)
+{
+	char *key;
 	int i;
 
 	html("<div class='diffstat-header'>");
@@ -204,17 +371,44 @@ static void cgit_print_diffstat(const unsigned char *old_sha1,
 	html("</div>");
 	html("<table summary='diffstat' class='diffstat'>");
 	max_changes = 0;
-	cgit_diff_tree(old_sha1, new_sha1, inspect_filepair, prefix,
-		       ctx.qry.ignorews);
+	key = diffstat_key(prefix);
+	if (!key || read_diffstat(key)) {
+		diff_files(count_file, max_buffered ? ctx.qry.context : -1,
+			   0, files);
+		if (key && page_files && !diff_errors)
+			write_diffstat(key);
+	}
+	free(key);
 	for (i = 0; i<files; i++)
-		print_fileinfo(&items[i]);
+		print_fileinfo(i);
 	html("</table>");
 	html("<div class='diffstat-summary'>");
 	htmlf("%d files changed, %d insertions, %d deletions",
 	      files, total_adds, total_rems);
+	if (page_files)
+		htmlf(" (showing files %d to %d)", first_file + 1, last_file);
 	html("</div>");
 }
 
+static void print_pager(void)
+{
+	html("<ul class='pager'>");
+	if (first_file > 0) {
+		html("<li>");
+		cgit_diff_page_link("[prev]", NULL, NULL, ctx.qry.head,
+				    ctx.qry.sha1, ctx.qry.sha2, diff_prefix,
+				    first_file - page_files, NULL);
+		html("</li>");
+	}
+	if (last_file < files) {
+		html("<li>");
+		cgit_diff_page_link("[next]", NULL, NULL, ctx.qry.head,
+				    ctx.qry.sha1, ctx.qry.sha2, diff_prefix,
+				    last_file, NULL);
+		html("</li>");
+	}
+	html("</ul>");
+}
 
 /*
  * print a single line returned from xdiff
@@ -238,14 +432,17 @@ static void print_line(char *line, int len)
 	line[len-1] = c;
 }
 
-static void header(unsigned char *sha1, char *path1, int mode1,
+static void header(int nr, unsigned char *sha1, char *path1, int mode1,
 		   unsigned char *sha2, char *path2, int mode2)
 {
 	char *abbrev1, *abbrev2;
 	int subproject;
 
 	subproject = (S_ISGITLINK(mode1) || S_ISGITLINK(mode2));
-	html("<div class='head'>");
+	if (page_files)
+		htmlf("<div class='head' id='diff-%d'>", nr);
+	else
+		html("<div class='head'>");
 	html("diff --git a/");
 	html_txt(path1);
 	html(" b/");
@@ -292,38 +489,48 @@ static void header(unsigned char *sha1, char *path1, int mode1,
 	html("</div>");
 }
 
-static void filepair_cb(struct diff_filepair *pair)
+static void print_file(int nr, struct cgit_diff_job *job, void *data)
 {
-	unsigned long old_size = 0;
-	unsigned long new_size = 0;
+	struct fileinfo *info = &items[nr];
 	int binary = 0;
 	linediff_fn print_line_fn = print_line;
 
-	if (!show_filepair(pair))
+	if (nr < first_file || nr >= last_file)
 		return;
-
-	current_filepair = pair;
+	current_old_file = alloc_filespec(info->old_path);
+	fill_filespec(current_old_file, info->old_sha1, 1, info->old_mode);
+	current_new_file = alloc_filespec(info->new_path);
+	fill_filespec(current_new_file, info->new_sha1, 1, info->new_mode);
 	if (use_ssdiff) {
 		cgit_ssdiff_header_begin();
 		print_line_fn = cgit_ssdiff_line_cb;
 	}
-	header(pair->one->sha1, pair->one->path, pair->one->mode,
-	       pair->two->sha1, pair->two->path, pair->two->mode);
+	header(nr, info->old_sha1, info->old_path, info->old_mode,
+	       info->new_sha1, info->new_path, info->new_mode);
 	if (use_ssdiff)
 		cgit_ssdiff_header_end();
-	if (S_ISGITLINK(pair->one->mode) || S_ISGITLINK(pair->two->mode)) {
-		if (S_ISGITLINK(pair->one->mode))
-			print_line_fn(fmt("-Subproject %s", sha1_to_hex(pair->one->sha1)), 52);
-		if (S_ISGITLINK(pair->two->mode))
-			print_line_fn(fmt("+Subproject %s", sha1_to_hex(pair->two->sha1)), 52);
+	if (S_ISGITLINK(info->old_mode) || S_ISGITLINK(info->new_mode)) {
+		if (S_ISGITLINK(info->old_mode))
+			print_line_fn(fmt("-Subproject %s", sha1_to_hex(info->old_sha1)), 52);
+		if (S_ISGITLINK(info->new_mode))
+			print_line_fn(fmt("+Subproject %s", sha1_to_hex(info->new_sha1)), 52);
+	} else if (info->too_large) {
 		if (use_ssdiff)
-			cgit_ssdiff_footer();
-		return;
-	}
-	if (cgit_diff_files(pair->one->sha1, pair->two->sha1, &old_size,
-			    &new_size, &binary, ctx.qry.context,
-			    ctx.qry.ignorews, print_line_fn))
+			html("<tr><td colspan='4'>");
+		html("Large diff not shown, see the ");
+		cgit_rawdiff_link("raw diff", NULL, NULL, ctx.qry.head,
+				  ctx.qry.sha1, ctx.qry.sha2, info->new_path);
+		if (use_ssdiff)
+			html("</td></tr>");
+	} else if (info->buffered) {
+		cgit_replay_diff_lines(&info->lines, print_line_fn);
+		binary = info->binary;
+	} else if (job->status) {
 		cgit_print_error("Error running diff");
+	} else {
+		cgit_replay_diff_lines(&job->lines, print_line_fn);
+		binary = job->binary;
+	}
 	if (binary) {
 		if (use_ssdiff)
 			html("<tr><td colspan='4'>Binary files differ</td></tr>");
@@ -332,10 +539,33 @@ static void filepair_cb(struct diff_filepair *pair)
 	}
 	if (use_ssdiff)
 		cgit_ssdiff_footer();
+	strbuf_release(&info->lines);
+	if (job)
+		cgit_diff_job_clear(job);
+	free_filespec(current_old_file);
+	free_filespec(current_new_file);
+}
+
+static void print_files(void)
+{
+	if (use_ssdiff) {
+		html("<table summary='ssdiff' class='ssdiff'>");
+	} else {
+		html("<table summary='diff' class='diff'>");
+		html("<tr><td>");
+	}
+	diff_files(print_file, ctx.qry.context, first_file, last_file);
+	if (!use_ssdiff)
+		html("</td></tr>");
+	html("</table>");
 }
 
 void cgit_print_diff_ctrls(void)
 {
+	static const char *algorithms[] = {
+		"myers", "minimal", "patience", "histogram"
+	};
+	const char *algorithm = NULL;
 	int i, curr;
 
 	html("<div class='cgit-panel'>");
@@ -366,6 +596,17 @@ void cgit_print_diff_ctrls(void)
 	html("</select>");
 	html("</td>");
 	html("</tr><tr>");
+	html("<td class='label'>algorithm:</td>");
+	html("<td class='ctrl'>");
+	html("<select name='algorithm' onchange='this.form.submit();'>");
+	for (i = 0; i < ARRAY_SIZE(algorithms); i++)
+		if (parse_algorithm_value(algorithms[i]) == cgit_diff_algorithm())
+			algorithm = algorithms[i];
+	for (i = 0; i < ARRAY_SIZE(algorithms); i++)
+		html_option(algorithms[i], algorithms[i], algorithm);
+	html("</select>");
+	html("</td>");
+	html("</tr><tr>");
 	html("<td class='label'>mode:</td>");
 	html("<td class='ctrl'>");
 	html("<select name='dt' onchange='this.form.submit();'>");
@@ -381,8 +622,27 @@ void cgit_print_diff_ctrls(void)
 	html("</div>");
 }
 
+/* Print the queued diff one file at a time, so that each file gets the
+ * algorithm cgit_filepair_algorithm() picks for it.
+ */
+static void flush_raw_diff(struct diff_options *diffopt)
+{
+	struct diff_queue_struct q = diff_queued_diff;
+	long algorithm_mask = XDF_NEED_MINIMAL | XDF_DIFF_ALGORITHM_MASK;
+	int i;
+
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	for (i = 0; i < q.nr; i++) {
+		diffopt->xdl_opts &= ~algorithm_mask;
+		diffopt->xdl_opts |= cgit_filepair_algorithm(q.queue[i]);
+		diff_q(&diff_queued_diff, q.queue[i]);
+		diff_flush(diffopt);
+	}
+	free(q.queue);
+}
+
 void cgit_print_diff(const char *new_rev, const char *old_rev,
-		     const char *prefix, int show_ctrls, int raw)
+		     const char *prefix, int show_ctrls, enum diff_output output)
 {
 	struct commit *commit, *commit2;
 	const unsigned char *old_tree_sha1, *new_tree_sha1;
@@ -393,6 +653,7 @@ void cgit_print_diff(const char *new_rev, const char *old_rev,
 	 * entire commit to detect renames so we must limit the paths in our
 	 * own callbacks and not pass the prefix to the diff machinery.
 	 */
+	diff_prefix = prefix;
 	if (ctx.qry.follow && ctx.cfg.enable_follow_links) {
 		current_prefix = prefix;
 		prefix = "";
@@ -439,12 +700,20 @@ void cgit_print_diff(const char *new_rev, const char *old_rev,
 		old_tree_sha1 = NULL;
 	}
 
-	if (raw) {
+	if (output == DIFF_OUTPUT_RAW) {
 		struct diff_options diffopt;
+		struct pathspec_item item;
 
 		diff_setup(&diffopt);
 		diffopt.output_format = DIFF_FORMAT_PATCH;
 		DIFF_OPT_SET(&diffopt, RECURSIVE);
+		if (prefix) {
+			memset(&item, 0, sizeof(item));
+			item.match = prefix;
+			item.len = strlen(prefix);
+			diffopt.pathspec.nr = 1;
+			diffopt.pathspec.items = &item;
+		}
 		diff_setup_done(&diffopt);
 
 		ctx.page.mimetype = "text/plain";
@@ -456,14 +725,34 @@ void cgit_print_diff(const char *new_rev, const char *old_rev,
 			diff_root_tree_sha1(new_tree_sha1, "", &diffopt);
 		}
 		diffcore_std(&diffopt);
-		diff_flush(&diffopt);
+		flush_raw_diff(&diffopt);
 
 		return;
 	}
 
 	difftype = ctx.qry.has_difftype ? ctx.qry.difftype : ctx.cfg.difftype;
+	if (output == DIFF_OUTPUT_HUNKS && difftype == DIFF_STATONLY)
+		difftype = DIFF_UNIFIED;
 	use_ssdiff = difftype == DIFF_SSDIFF;
 
+	cgit_diff_tree(old_rev_sha1, new_rev_sha1, inspect_filepair, prefix,
+		       ctx.qry.ignorews);
+	first_file = 0;
+	last_file = files;
+	if (ctx.cfg.max_diff_files > 0 && files > ctx.cfg.max_diff_files) {
+		page_files = ctx.cfg.max_diff_files;
+		if (ctx.qry.ofs > 0 && ctx.qry.ofs < files)
+			first_file = ctx.qry.ofs;
+		if (first_file + page_files < files)
+			last_file = first_file + page_files;
+	}
+
+	if (output == DIFF_OUTPUT_HUNKS) {
+		cgit_print_http_headers();
+		print_files();
+		return;
+	}
+
 	if (show_ctrls) {
 		cgit_print_layout_start();
 		cgit_print_diff_ctrls();
@@ -479,22 +768,16 @@ void cgit_print_diff(const char *new_rev, const char *old_rev,
 	if (difftype == DIFF_STATONLY)
 		ctx.qry.difftype = ctx.cfg.difftype;
 
-	cgit_print_diffstat(old_rev_sha1, new_rev_sha1, prefix);
+	if (difftype != DIFF_STATONLY)
+		max_buffered = (size_t)ctx.cfg.max_diff_buffer_size * 1024;
+	cgit_print_diffstat(prefix);
 
 	if (difftype == DIFF_STATONLY)
 		return;
 
-	if (use_ssdiff) {
-		html("<table summary='ssdiff' class='ssdiff'>");
-	} else {
-		html("<table summary='diff' class='diff'>");
-		html("<tr><td>");
-	}
-	cgit_diff_tree(old_rev_sha1, new_rev_sha1, filepair_cb, prefix,
-		       ctx.qry.ignorews);
-	if (!use_ssdiff)
-		html("</td></tr>");
-	html("</table>");
+	print_files();
+	if (page_files)
+		print_pager();
 
 	if (show_ctrls)
 		cgit_print_layout_end();
@@ -3,8 +3,16 @@
 
 extern void cgit_print_diff_ctrls(void);
 
+/* What cgit_print_diff() writes */
+enum diff_output {
+	DIFF_OUTPUT_PAGE,	/* diffstat and diff, as HTML */
+	DIFF_OUTPUT_RAW,	/* plain text patch */
+	DIFF_OUTPUT_HUNKS,	/* HTML diff of each file, without layout */
+};
+
 extern void cgit_print_diff(const char *new_hex, const char *old_hex,
-			    const char *prefix, int show_ctrls, int raw);
+			    const char *prefix, int show_ctrls,
+			    enum diff_output output);
 
 extern struct diff_filespec *cgit_get_current_old_file(void);
 extern struct diff_filespec *cgit_get_current_new_file(void);
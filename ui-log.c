@@ -11,6 +11,8 @@
 #include "html.h"
 #include "ui-shared.h"
 #include "argv-array.h"
+#include "search-index.h"
+#include "ref-decorations.h"
 
 static int files, add_lines, rem_lines, lines_counted;
 
@@ -56,46 +58,44 @@ static void inspect_files(struct diff_filepair *pair)
 
 void show_commit_decorations(struct commit *commit)
 {
-	const struct name_decoration *deco;
+	struct string_list decorations = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+	const char *name;
 	static char buf[1024];
 
 	buf[sizeof(buf) - 1] = 0;
-	deco = get_name_decoration(&commit->object);
+	cgit_commit_decorations(commit, &decorations);
 	html("<span class='decoration'>");
-	while (deco) {
-		if (starts_with(deco->name, "refs/heads/")) {
-			strncpy(buf, deco->name + 11, sizeof(buf) - 1);
+	for_each_string_list_item(item, &decorations) {
+		name = item->string;
+		if (starts_with(name, "refs/heads/")) {
+			strncpy(buf, name + 11, sizeof(buf) - 1);
 			cgit_log_link(buf, NULL, "branch-deco", buf, NULL,
 				      ctx.qry.vpath, 0, NULL, NULL,
 				      ctx.qry.showmsg, 0);
 		}
-		else if (starts_with(deco->name, "tag: refs/tags/")) {
-			strncpy(buf, deco->name + 15, sizeof(buf) - 1);
+		else if (starts_with(name, "refs/tags/")) {
+			strncpy(buf, name + 10, sizeof(buf) - 1);
 			cgit_tag_link(buf, NULL, "tag-deco", buf);
 		}
-		else if (starts_with(deco->name, "refs/tags/")) {
-			strncpy(buf, deco->name + 10, sizeof(buf) - 1);
-			cgit_tag_link(buf, NULL, "tag-deco", buf);
-		}
-		else if (starts_with(deco->name, "refs/remotes/")) {
+		else if (starts_with(name, "refs/remotes/")) {
 			if (!ctx.repo->enable_remote_branches)
-				goto next;
-			strncpy(buf, deco->name + 13, sizeof(buf) - 1);
+				continue;
+			strncpy(buf, name + 13, sizeof(buf) - 1);
 			cgit_log_link(buf, NULL, "remote-deco", NULL,
 				      oid_to_hex(&commit->object.oid),
 				      ctx.qry.vpath, 0, NULL, NULL,
 				      ctx.qry.showmsg, 0);
 		}
 		else {
-			strncpy(buf, deco->name, sizeof(buf) - 1);
+			strncpy(buf, name, sizeof(buf) - 1);
 			cgit_commit_link(buf, NULL, "deco", ctx.qry.head,
 					 oid_to_hex(&commit->object.oid),
 					 ctx.qry.vpath);
 		}
-next:
-		deco = deco->next;
 	}
 	html("</span>");
+	string_list_clear(&decorations, 0);
 }
 
 static void handle_rename(struct diff_filepair *pair)
@@ -360,8 +360,9 @@ void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern
 	struct rev_info rev;
 	struct commit *commit;
 	struct argv_array rev_argv = ARGV_ARRAY_INIT;
+	struct sha1_array candidates = SHA1_ARRAY_INIT;
 	int i, columns = commit_graph ? 4 : 3;
-	int must_free_tip = 0;
+	int must_free_tip = 0, use_index = 0;
 
 	/* rev_argv.argv[0] will be ignored by setup_revisions */
 	argv_array_push(&rev_argv, "log_rev_setup");
@@ -376,6 +377,19 @@ void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern
 		if (!strcmp(grep, "grep") || !strcmp(grep, "author") ||
 		    !strcmp(grep, "committer")) {
 			argv_array_pushf(&rev_argv, "--%s=%s", grep, pattern);
+			/*
+			 * The search index only knows which commits are
+			 * reachable from a branch; it can't do path limiting
+			 * and the commit graph of a sparse set of commits is
+			 * meaningless, so walk the history in those cases.
+			 */
+			if (ctx.cfg.enable_search_index && !path &&
+			    !commit_graph && starts_with(tip, "refs/heads/") &&
+			    !cgit_search_index_lookup(tip, grep, pattern,
+						      &candidates)) {
+				use_index = 1;
+				argv_array_push(&rev_argv, "--no-walk");
+			}
 		} else if (!strcmp(grep, "range")) {
 			char *arg;
 			/* Split the pattern at whitespace and add each token
@@ -430,8 +444,13 @@ void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern
 	rev.ignore_missing = 1;
 	rev.simplify_history = 1;
 	setup_revisions(rev_argv.argc, rev_argv.argv, &rev, NULL);
-	load_ref_decorations(DECORATE_FULL_REFS);
-	rev.show_decorations = 1;
+	if (use_index) {
+		/* Replace the tip with the candidates found by the index */
+		object_array_clear(&rev.pending);
+		for (i = 0; i < candidates.nr; i++)
+			add_pending_sha1(&rev, "candidate", candidates.sha1[i], 0);
+		sha1_array_clear(&candidates);
+	}
 	rev.grep_filter.regflags |= REG_ICASE;
 
 	rev.diffopt.detect_rename = 1;
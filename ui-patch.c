@@ -11,6 +11,83 @@
 #include "html.h"
 #include "ui-shared.h"
 
+/* Print the queued diff as a diffstat, summary and patch, like
+ * diff_flush() does, but diff each file with the algorithm
+ * cgit_filepair_algorithm() picks for it. git computes the diffstat of
+ * all files at once, so it falls back for all of them if any file needs
+ * it.
+ */
+static void flush_patch(struct diff_options *diffopt)
+{
+	struct diff_queue_struct q = diff_queued_diff;
+	long algorithm_mask = XDF_NEED_MINIMAL | XDF_DIFF_ALGORITHM_MASK;
+	long stat_algorithm = cgit_diff_algorithm(), *algorithms;
+	int output_format = diffopt->output_format;
+	struct diff_filepair *pair;
+	int i;
+
+	algorithms = xcalloc(q.nr, sizeof(*algorithms));
+	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+	for (i = 0; i < q.nr; i++) {
+		algorithms[i] = cgit_filepair_algorithm(q.queue[i]);
+		if (algorithms[i] != cgit_diff_algorithm())
+			stat_algorithm = algorithms[i];
+		/* diff_flush() frees the pairs, keep them for the patch */
+		pair = xmalloc(sizeof(*pair));
+		*pair = *q.queue[i];
+		pair->one->count++;
+		pair->two->count++;
+		diff_q(&diff_queued_diff, pair);
+	}
+	diffopt->xdl_opts &= ~algorithm_mask;
+	diffopt->xdl_opts |= stat_algorithm;
+	diffopt->output_format = DIFF_FORMAT_DIFFSTAT | DIFF_FORMAT_SUMMARY;
+	diff_flush(diffopt);
+	fputc('\n', diffopt->file);
+
+	diffopt->output_format = DIFF_FORMAT_PATCH;
+	for (i = 0; i < q.nr; i++) {
+		diffopt->xdl_opts &= ~algorithm_mask;
+		diffopt->xdl_opts |= algorithms[i];
+		diff_q(&diff_queued_diff, q.queue[i]);
+		diff_flush(diffopt);
+	}
+	diffopt->output_format = output_format;
+	free(algorithms);
+	free(q.queue);
+}
+
+/* Like log_tree_commit() for a commit with at most one parent, with the
+ * diff printed by flush_patch().
+ */
+static void print_commit(struct rev_info *rev, struct commit *commit)
+{
+	struct log_info log = { commit, NULL };
+	struct commit *parent;
+
+	parse_commit_or_die(commit);
+	if (commit->parents) {
+		parent = commit->parents->item;
+		parse_commit_or_die(parent);
+		diff_tree_sha1(parent->tree->object.oid.hash,
+			       commit->tree->object.oid.hash, "", &rev->diffopt);
+	} else {
+		diff_root_tree_sha1(commit->tree->object.oid.hash, "",
+				    &rev->diffopt);
+	}
+	diffcore_std(&rev->diffopt);
+	if (diff_queue_is_empty()) {
+		diff_flush(&rev->diffopt);
+		return;
+	}
+
+	rev->loginfo = &log;
+	show_log(rev);
+	rev->loginfo = NULL;
+	printf("---\n");
+	flush_patch(&rev->diffopt);
+}
+
 void cgit_print_patch(const char *new_rev, const char *old_rev,
 		      const char *prefix)
 {
@@ -79,12 +156,13 @@ void cgit_print_patch(const char *new_rev, const char *old_rev,
 	rev.max_parents = 1;
 	rev.diffopt.output_format |= DIFF_FORMAT_DIFFSTAT |
 			DIFF_FORMAT_PATCH | DIFF_FORMAT_SUMMARY;
+	rev.diffopt.xdl_opts |= cgit_diff_algorithm();
 	setup_revisions(ARRAY_SIZE(rev_argv), (const char **)rev_argv, &rev,
 			NULL);
 	prepare_revision_walk(&rev);
 
 	while ((commit = get_revision(&rev)) != NULL) {
-		log_tree_commit(&rev, commit);
+		print_commit(&rev, commit);
 		printf("-- \ncgit %s\n\n", cgit_version);
 	}
 
@@ -11,30 +11,18 @@
 #include "html.h"
 #include "ui-shared.h"
 
-struct walk_tree_context {
-	int match_baselen;
-	int match;
+struct plain_object {
+	const unsigned char *sha1;
+	const char *path;
+	char *mimetype;
 };
 
-static int print_object(const unsigned char *sha1, const char *path)
+static void print_object_headers(const char *buf, unsigned long len,
+				 unsigned long size, void *data)
 {
-	enum object_type type;
-	char *buf, *mimetype;
-	unsigned long size;
-
-	type = sha1_object_info(sha1, &size);
-	if (type == OBJ_BAD) {
-		cgit_print_error_page(404, "Not found", "Not found");
-		return 0;
-	}
-
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf) {
-		cgit_print_error_page(404, "Not found", "Not found");
-		return 0;
-	}
+	struct plain_object *obj = data;
+	char *mimetype = obj->mimetype;
 
-	mimetype = get_mimetype_for_filename(path);
 	ctx.page.mimetype = mimetype;
 
 	if (!ctx.repo->enable_html_serving) {
@@ -48,21 +36,38 @@ static int print_object(const unsigned char *sha1, const char *path)
 	}
 
 	if (!ctx.page.mimetype) {
-		if (buffer_is_binary(buf, size)) {
+		if (buffer_is_binary(buf, len)) {
 			ctx.page.mimetype = "application/octet-stream";
 			ctx.page.charset = NULL;
 		} else {
 			ctx.page.mimetype = "text/plain";
 		}
 	}
-	ctx.page.filename = path;
+	ctx.page.filename = obj->path;
 	ctx.page.size = size;
-	ctx.page.etag = sha1_to_hex(sha1);
+	ctx.page.etag = sha1_to_hex(obj->sha1);
+	ctx.page.ranges = 1;
 	cgit_print_http_headers();
-	html_raw(buf, size);
-	free(mimetype);
-	free(buf);
-	return 1;
+}
+
+static void print_object(const unsigned char *sha1, const char *path)
+{
+	struct plain_object obj;
+	unsigned long size;
+	int ret;
+
+	if (sha1_object_info(sha1, &size) == OBJ_BAD) {
+		cgit_print_error_page(404, "Not found", "Not found");
+		return;
+	}
+
+	obj.sha1 = sha1;
+	obj.path = path;
+	obj.mimetype = get_mimetype_for_filename(path);
+	ret = cgit_stream_blob(sha1, print_object_headers, &obj);
+	free(obj.mimetype);
+	if (ret)
+		cgit_print_error_page(404, "Not found", "Not found");
 }
 
 static char *buildpath(const char *base, int baselen, const char *path)
@@ -129,54 +134,46 @@ static void print_dir_tail(void)
 	html(" </ul>\n</body></html>\n");
 }
 
-static int walk_tree(const unsigned char *sha1, struct strbuf *base,
+static int list_dir_entry(const unsigned char *sha1, struct strbuf *base,
 		const char *pathname, unsigned mode, int stage, void *cbdata)
 {
-	struct walk_tree_context *walk_tree_ctx = cbdata;
-
-	if (base->len == walk_tree_ctx->match_baselen) {
-		if (S_ISREG(mode)) {
-			if (print_object(sha1, pathname))
-				walk_tree_ctx->match = 1;
-		} else if (S_ISDIR(mode)) {
-			print_dir(sha1, base->buf, base->len, pathname);
-			walk_tree_ctx->match = 2;
-			return READ_TREE_RECURSIVE;
-		}
-	} else if (base->len > walk_tree_ctx->match_baselen) {
-		print_dir_entry(sha1, base->buf, base->len, pathname, mode);
-		walk_tree_ctx->match = 2;
-	} else if (S_ISDIR(mode)) {
-		return READ_TREE_RECURSIVE;
-	}
-
+	print_dir_entry(sha1, base->buf, base->len, pathname, mode);
 	return 0;
 }
 
-static int basedir_len(const char *path)
+static void print_tree(const unsigned char *sha1, const char *path)
 {
-	char *p = strrchr(path, '/');
-	if (p)
-		return p - path + 1;
-	return 0;
+	struct pathspec paths = {
+		.nr = 0
+	};
+	struct strbuf base = STRBUF_INIT;
+	const char *basename;
+	struct tree *tree;
+
+	tree = parse_tree_indirect(sha1);
+	if (!tree) {
+		cgit_print_error_page(404, "Not found", "Not found");
+		return;
+	}
+	basename = strrchr(path, '/');
+	basename = basename ? basename + 1 : path;
+	print_dir(sha1, path, basename - path, basename);
+	if (*path)
+		strbuf_addf(&base, "%s/", path);
+	read_tree_recursive(tree, base.buf, base.len, 0, &paths,
+			    list_dir_entry, NULL);
+	print_dir_tail();
+	strbuf_release(&base);
 }
 
 void cgit_print_plain(void)
 {
 	const char *rev = ctx.qry.sha1;
+	const char *path = ctx.qry.path;
 	unsigned char sha1[20];
 	struct commit *commit;
-	struct pathspec_item path_items = {
-		.match = ctx.qry.path,
-		.len = ctx.qry.path ? strlen(ctx.qry.path) : 0
-	};
-	struct pathspec paths = {
-		.nr = 1,
-		.items = &path_items
-	};
-	struct walk_tree_context walk_tree_ctx = {
-		.match = 0
-	};
+	const char *basename;
+	unsigned mode;
 
 	if (!rev)
 		rev = ctx.qry.head;
@@ -190,17 +187,23 @@ void cgit_print_plain(void)
 		cgit_print_error_page(404, "Not found", "Not found");
 		return;
 	}
-	if (!path_items.match) {
-		path_items.match = "";
-		walk_tree_ctx.match_baselen = -1;
-		print_dir(commit->tree->object.oid.hash, "", 0, "");
-		walk_tree_ctx.match = 2;
+	if (!path) {
+		print_tree(commit->tree->object.oid.hash, "");
+		return;
+	}
+	if (cgit_get_path_entry(commit->tree->object.oid.hash, path, sha1,
+				&mode)) {
+		cgit_print_error_page(404, "Not found", "Not found");
+		return;
+	}
+	if (S_ISDIR(mode)) {
+		print_tree(sha1, path);
+		return;
 	}
+	basename = strrchr(path, '/');
+	basename = basename ? basename + 1 : path;
+	if (S_ISREG(mode))
+		print_object(sha1, basename);
 	else
-		walk_tree_ctx.match_baselen = basedir_len(path_items.match);
-	read_tree_recursive(commit->tree, "", 0, 0, &paths, walk_tree, &walk_tree_ctx);
-	if (!walk_tree_ctx.match)
 		cgit_print_error_page(404, "Not found", "Not found");
-	else if (walk_tree_ctx.match == 2)
-		print_dir_tail();
 }
@@ -298,6 +298,34 @@ void cgit_tree_link(const char *name, const char *title, const char *class,
 	reporevlink("tree", name, title, class, head, rev, path);
 }
 
+void cgit_tree_page_link(const char *name, const char *title,
+			 const char *class, const char *head, const char *rev,
+			 const char *path, int ofs)
+{
+	char *delim;
+
+	delim = repolink(title, class, "tree", head, path);
+	if (rev && ctx.qry.head != NULL && strcmp(rev, ctx.qry.head)) {
+		html(delim);
+		html("id=");
+		html_url_arg(rev);
+		delim = "&amp;";
+	}
+	if (ofs > 0) {
+		html(delim);
+		htmlf("ofs=%d", ofs);
+	}
+	html("'>");
+	html_txt(name);
+	html("</a>");
+}
+
+void cgit_blame_link(const char *name, const char *title, const char *class,
+		     const char *head, const char *rev, const char *path)
+{
+	reporevlink("blame", name, title, class, head, rev, path);
+}
+
 void cgit_plain_link(const char *name, const char *title, const char *class,
 		     const char *head, const char *rev, const char *path)
 {
@@ -382,6 +410,12 @@ void cgit_commit_link(char *name, const char *title, const char *class,
 		html("ignorews=1");
 		delim = "&amp;";
 	}
+	if (ctx.qry.algorithm) {
+		html(delim);
+		html("algorithm=");
+		html_url_arg(ctx.qry.algorithm);
+		delim = "&amp;";
+	}
 	if (ctx.qry.follow) {
 		html(delim);
 		html("follow=1");
@@ -407,9 +441,10 @@ void cgit_snapshot_link(const char *name, const char *title, const char *class,
 	reporevlink("snapshot", name, title, class, head, rev, archivename);
 }
 
-void cgit_diff_link(const char *name, const char *title, const char *class,
-		    const char *head, const char *new_rev, const char *old_rev,
-		    const char *path)
+void cgit_diff_page_link(const char *name, const char *title,
+			 const char *class, const char *head,
+			 const char *new_rev, const char *old_rev,
+			 const char *path, int ofs, const char *anchor)
 {
 	char *delim;
 
@@ -442,9 +477,61 @@ void cgit_diff_link(const char *name, const char *title, const char *class,
 		html("ignorews=1");
 		delim = "&amp;";
 	}
+	if (ctx.qry.algorithm) {
+		html(delim);
+		html("algorithm=");
+		html_url_arg(ctx.qry.algorithm);
+		delim = "&amp;";
+	}
 	if (ctx.qry.follow) {
 		html(delim);
 		html("follow=1");
+		delim = "&amp;";
+	}
+	if (ofs > 0) {
+		html(delim);
+		htmlf("ofs=%d", ofs);
+	}
+	if (anchor) {
+		html("#");
+		html_attr(anchor);
+	}
+	html("'>");
+	html_txt(name);
+	html("</a>");
+}
+
+void cgit_diff_link(const char *name, const char *title, const char *class,
+		    const char *head, const char *new_rev, const char *old_rev,
+		    const char *path)
+{
+	cgit_diff_page_link(name, title, class, head, new_rev, old_rev, path,
+			    0, NULL);
+}
+
+void cgit_rawdiff_link(const char *name, const char *title, const char *class,
+		       const char *head, const char *new_rev, const char *old_rev,
+		       const char *path)
+{
+	char *delim;
+
+	delim = repolink(title, class, "rawdiff", head, path);
+	if (new_rev && ctx.qry.head != NULL && strcmp(new_rev, ctx.qry.head)) {
+		html(delim);
+		html("id=");
+		html_url_arg(new_rev);
+		delim = "&amp;";
+	}
+	if (old_rev) {
+		html(delim);
+		html("id2=");
+		html_url_arg(old_rev);
+		delim = "&amp;";
+	}
+	if (ctx.qry.algorithm) {
+		html(delim);
+		html("algorithm=");
+		html_url_arg(ctx.qry.algorithm);
 	}
 	html("'>");
 	html_txt(name);
@@ -481,6 +568,10 @@ static void cgit_self_link(char *name, const char *title, const char *class)
 		cgit_plain_link(name, title, class, ctx.qry.head,
 				ctx.qry.has_sha1 ? ctx.qry.sha1 : NULL,
 				ctx.qry.path);
+	else if (!strcmp(ctx.qry.page, "blame"))
+		cgit_blame_link(name, title, class, ctx.qry.head,
+				ctx.qry.has_sha1 ? ctx.qry.sha1 : NULL,
+				ctx.qry.path);
 	else if (!strcmp(ctx.qry.page, "log"))
 		cgit_log_link(name, title, class, ctx.qry.head,
 			      ctx.qry.has_sha1 ? ctx.qry.sha1 : NULL,
@@ -680,9 +771,25 @@ void cgit_print_age(time_t t, time_t max_relative, const char *format)
 
 void cgit_print_http_headers(void)
 {
+	int range = 0;
+
 	if (ctx.env.no_http && !strcmp(ctx.env.no_http, "1"))
 		return;
 
+	if (ctx.page.ranges && ctx.page.size && !ctx.page.status)
+		range = cgit_request_range(ctx.page.etag, ctx.page.size,
+					   &ctx.page.range_first,
+					   &ctx.page.range_len);
+	if (range > 0) {
+		ctx.page.status = 206;
+		ctx.page.statusmsg = "Partial Content";
+	} else if (range < 0) {
+		ctx.page.status = 416;
+		ctx.page.statusmsg = "Range Not Satisfiable";
+		ctx.page.range_len = 0;
+	}
+	ctx.page.partial = range != 0;
+
 	if (ctx.page.status)
 		htmlf("Status: %d %s\n", ctx.page.status, ctx.page.statusmsg);
 	if (ctx.page.mimetype && ctx.page.charset)
@@ -690,13 +797,23 @@ void cgit_print_http_headers(void)
 		      ctx.page.charset);
 	else if (ctx.page.mimetype)
 		htmlf("Content-Type: %s\n", ctx.page.mimetype);
-	if (ctx.page.size)
+	if (ctx.page.partial)
+		htmlf("Content-Length: %zu\n", ctx.page.range_len);
+	else if (ctx.page.size)
 		htmlf("Content-Length: %zd\n", ctx.page.size);
 	if (ctx.page.filename) {
 		html("Content-Disposition: inline; filename=\"");
 		html_header_arg_in_quotes(ctx.page.filename);
 		html("\"\n");
 	}
+	if (ctx.page.ranges)
+		html("Accept-Ranges: bytes\n");
+	if (range > 0)
+		htmlf("Content-Range: bytes %zu-%zu/%zu\n", ctx.page.range_first,
+		      ctx.page.range_first + ctx.page.range_len - 1,
+		      ctx.page.size);
+	else if (range < 0)
+		htmlf("Content-Range: bytes */%zu\n", ctx.page.size);
 	if (!ctx.env.authenticated)
 		html("Cache-Control: no-cache, no-store\n");
 	htmlf("Last-Modified: %s\n", http_date(ctx.page.modified));
@@ -23,6 +23,12 @@ extern void cgit_tag_link(const char *name, const char *title,
 extern void cgit_tree_link(const char *name, const char *title,
 			   const char *class, const char *head,
 			   const char *rev, const char *path);
+extern void cgit_tree_page_link(const char *name, const char *title,
+				const char *class, const char *head,
+				const char *rev, const char *path, int ofs);
+extern void cgit_blame_link(const char *name, const char *title,
+			    const char *class, const char *head,
+			    const char *rev, const char *path);
 extern void cgit_plain_link(const char *name, const char *title,
 			    const char *class, const char *head,
 			    const char *rev, const char *path);
@@ -46,6 +52,14 @@ extern void cgit_diff_link(const char *name, const char *title,
 			   const char *class, const char *head,
 			   const char *new_rev, const char *old_rev,
 			   const char *path);
+extern void cgit_diff_page_link(const char *name, const char *title,
+				const char *class, const char *head,
+				const char *new_rev, const char *old_rev,
+				const char *path, int ofs, const char *anchor);
+extern void cgit_rawdiff_link(const char *name, const char *title,
+			      const char *class, const char *head,
+			      const char *new_rev, const char *old_rev,
+			      const char *path);
 extern void cgit_stats_link(const char *name, const char *title,
 			    const char *class, const char *head,
 			    const char *path);
@@ -124,6 +124,10 @@ static int make_snapshot(const struct cgit_snapshot_format *format,
 	ctx.page.etag = sha1_to_hex(sha1);
 	ctx.page.mimetype = xstrdup(format->mimetype);
 	ctx.page.filename = xstrdup(filename);
+	/* The size of an archive is only known once it has been written
+	 * to a cache slot, which is where ranges are served from.
+	 */
+	ctx.page.ranges = ctx.cfg.cache_size > 0 && ctx.cfg.cache_snapshot_ttl;
 	cgit_print_http_headers();
 	format->write_func(hex, prefix);
 	return 0;
@@ -7,86 +7,147 @@
 extern int use_ssdiff;
 
 static int current_old_line, current_new_line;
-static int **L = NULL;
 
+/*
+ * The removed and added lines of a block of changes are kept until the
+ * block ends, and then printed side by side, pairing them by index. The
+ * text of all of them is kept in deferred_text, which like the arrays
+ * is reused for the next block.
+ */
 struct deferred_lines {
-	int line_no;
-	char *line;
-	struct deferred_lines *next;
+	struct {
+		int line_no;
+		size_t offset;
+	} *items;
+	int nr, alloc;
 };
 
-static struct deferred_lines *deferred_old, *deferred_old_last;
-static struct deferred_lines *deferred_new, *deferred_new_last;
+static struct deferred_lines deferred_old, deferred_new;
+static struct strbuf deferred_text = STRBUF_INIT;
 
-static void create_or_reset_lcs_table(void)
-{
-	int i;
+/* The per line output of replace_tabs() and longest_common_subsequence() */
+static struct strbuf old_text = STRBUF_INIT, new_text = STRBUF_INIT;
+static struct strbuf lcs_text = STRBUF_INIT;
 
-	if (L != NULL) {
-		memset(*L, 0, sizeof(int) * MAX_SSDIFF_SIZE);
-		return;
-	}
+/*
+ * The longest common subsequence of two lines is found with the
+ * bit-parallel algorithm of Allison and Dix, as improved by Hyyrö: the
+ * DP row of each character of the old line is a bit vector over the new
+ * line, 64 characters per word, and is computed from the previous one
+ * with a few word operations. The rows are kept to trace the subsequence
+ * back, which takes (m + 1) * n / 8 bytes.
+ */
+#define LCS_WORD_BITS 64
 
-	// xcalloc will die if we ran out of memory;
-	// not very helpful for debugging
-	L = (int**)xcalloc(MAX_SSDIFF_M, sizeof(int *));
-	*L = (int*)xcalloc(MAX_SSDIFF_SIZE, sizeof(int));
+static uint64_t *lcs_match;	/* positions of each byte, zero between calls */
+static uint64_t *lcs_rows;
+static size_t lcs_match_alloc, lcs_rows_alloc;
 
-	for (i = 1; i < MAX_SSDIFF_M; i++) {
-		L[i] = *L + i * MAX_SSDIFF_N;
+static int popcount64(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(x);
+#else
+	int count = 0;
+
+	while (x) {
+		x &= x - 1;
+		count++;
 	}
+	return count;
+#endif
+}
+
+/* Length of the LCS of the first k characters of the reversed old line
+ * and the first len characters of the reversed new line, i.e. of the
+ * old line from m - k and the new line from n - len on. Each zero bit
+ * in the row below len adds one.
+ */
+static int lcs_length(const uint64_t *row, int len)
+{
+	int i, ones = 0;
+
+	for (i = 0; i < len / LCS_WORD_BITS; i++)
+		ones += popcount64(row[i]);
+	if (len % LCS_WORD_BITS)
+		ones += popcount64(row[i] &
+				   (((uint64_t)1 << (len % LCS_WORD_BITS)) - 1));
+	return len - ones;
 }
 
 static char *longest_common_subsequence(char *A, char *B)
 {
-	int i, j, ri;
+	int i, j, w, words;
+	char seen[256];
 	int m = strlen(A);
 	int n = strlen(B);
-	int tmp1, tmp2;
-	int lcs_length;
-	char *result;
+	const unsigned char *a = (const unsigned char *)A;
+	const unsigned char *b = (const unsigned char *)B;
+	uint64_t *match, *prev, *row, u, v, sum, carry;
 
 	// We bail if the lines are too long
-	if (m >= MAX_SSDIFF_M || n >= MAX_SSDIFF_N)
+	if ((size_t)(m + 1) * (n + LCS_WORD_BITS) > MAX_SSDIFF_SIZE)
 		return NULL;
 
-	create_or_reset_lcs_table();
-
-	for (i = m; i >= 0; i--) {
-		for (j = n; j >= 0; j--) {
-			if (A[i] == '\0' || B[j] == '\0') {
-				L[i][j] = 0;
-			} else if (A[i] == B[j]) {
-				L[i][j] = 1 + L[i + 1][j + 1];
-			} else {
-				tmp1 = L[i + 1][j];
-				tmp2 = L[i][j + 1];
-				L[i][j] = (tmp1 > tmp2 ? tmp1 : tmp2);
-			}
+	words = n / LCS_WORD_BITS + 1;
+	if (256 * words > lcs_match_alloc) {
+		free(lcs_match);
+		lcs_match_alloc = 256 * words;
+		lcs_match = xcalloc(lcs_match_alloc, sizeof(*lcs_match));
+	}
+	ALLOC_GROW(lcs_rows, (size_t)(m + 1) * words, lcs_rows_alloc);
+
+	/* Both lines are processed from the end, so that the rows hold
+	 * the LCS lengths of suffixes, which the traceback walks forward.
+	 */
+	for (j = 0; j < n; j++)
+		lcs_match[b[n - 1 - j] * words + j / LCS_WORD_BITS] |=
+			(uint64_t)1 << (j % LCS_WORD_BITS);
+	memset(lcs_rows, 0xff, sizeof(*lcs_rows) * words);
+	for (i = 1; i <= m; i++) {
+		prev = lcs_rows + (size_t)(i - 1) * words;
+		row = prev + words;
+		match = lcs_match + a[m - i] * words;
+		carry = 0;
+		for (w = 0; w < words; w++) {
+			v = prev[w];
+			u = v & match[w];
+			sum = v + carry;
+			carry = sum < v;
+			sum += u;
+			carry |= sum < u;
+			row[w] = sum | (v & ~match[w]);
 		}
 	}
 
-	lcs_length = L[0][0];
-	result = xmalloc(lcs_length + 2);
-	memset(result, 0, sizeof(*result) * (lcs_length + 2));
+	strbuf_reset(&lcs_text);
+	strbuf_grow(&lcs_text, lcs_length(lcs_rows + (size_t)m * words, n));
 
-	ri = 0;
 	i = 0;
 	j = 0;
 	while (i < m && j < n) {
 		if (A[i] == B[j]) {
-			result[ri] = A[i];
-			ri += 1;
+			strbuf_addch(&lcs_text, A[i]);
 			i += 1;
 			j += 1;
-		} else if (L[i + 1][j] >= L[i][j + 1]) {
+		} else if (lcs_length(lcs_rows + (size_t)(m - i - 1) * words,
+				      n - j) >=
+			   lcs_length(lcs_rows + (size_t)(m - i) * words,
+				      n - j - 1)) {
 			i += 1;
 		} else {
 			j += 1;
 		}
 	}
 
-	return result;
+	memset(seen, 0, sizeof(seen));
+	for (j = 0; j < n; j++) {
+		if (seen[b[j]])
+			continue;
+		seen[b[j]] = 1;
+		memset(lcs_match + b[j] * words, 0, sizeof(*lcs_match) * words);
+	}
+	return lcs_text.buf;
 }
 
 static int line_from_hunk(char *line, char type)
@@ -110,79 +171,32 @@ static int line_from_hunk(char *line, char type)
 	return res;
 }
 
-static char *replace_tabs(char *line)
+static void replace_tabs(struct strbuf *out, const char *line)
 {
-	char *prev_buf = line;
-	char *cur_buf;
-	int linelen = strlen(line);
-	int n_tabs = 0;
-	int i;
-	char *result;
-	char *spaces = "        ";
-
-	if (linelen == 0) {
-		result = xmalloc(1);
-		result[0] = '\0';
-		return result;
-	}
+	const char *tab;
 
-	for (i = 0; i < linelen; i++)
-		if (line[i] == '\t')
-			n_tabs += 1;
-	result = xmalloc(linelen + n_tabs * 8 + 1);
-	result[0] = '\0';
-
-	while (1) {
-		cur_buf = strchr(prev_buf, '\t');
-		if (!cur_buf) {
-			strcat(result, prev_buf);
-			break;
-		} else {
-			strncat(result, prev_buf, cur_buf - prev_buf);
-			strncat(result, spaces, 8 - (strlen(result) % 8));
-		}
-		prev_buf = cur_buf + 1;
+	strbuf_reset(out);
+	while ((tab = strchr(line, '\t')) != NULL) {
+		strbuf_add(out, line, tab - line);
+		strbuf_addchars(out, ' ', 8 - out->len % 8);
+		line = tab + 1;
 	}
-	return result;
+	strbuf_addstr(out, line);
 }
 
-static int calc_deferred_lines(struct deferred_lines *start)
+static void deferred_add(struct deferred_lines *lines, char *line,
+			 int line_no)
 {
-	struct deferred_lines *item = start;
-	int result = 0;
-	while (item) {
-		result += 1;
-		item = item->next;
-	}
-	return result;
-}
-
-static void deferred_old_add(char *line, int line_no)
-{
-	struct deferred_lines *item = xmalloc(sizeof(struct deferred_lines));
-	item->line = xstrdup(line);
-	item->line_no = line_no;
-	item->next = NULL;
-	if (deferred_old) {
-		deferred_old_last->next = item;
-		deferred_old_last = item;
-	} else {
-		deferred_old = deferred_old_last = item;
-	}
+	ALLOC_GROW(lines->items, lines->nr + 1, lines->alloc);
+	lines->items[lines->nr].line_no = line_no;
+	lines->items[lines->nr].offset = deferred_text.len;
+	lines->nr++;
+	strbuf_add(&deferred_text, line, strlen(line) + 1);
 }
 
-static void deferred_new_add(char *line, int line_no)
+static char *deferred_line(struct deferred_lines *lines, int i)
 {
-	struct deferred_lines *item = xmalloc(sizeof(struct deferred_lines));
-	item->line = xstrdup(line);
-	item->line_no = line_no;
-	item->next = NULL;
-	if (deferred_new) {
-		deferred_new_last->next = item;
-		deferred_new_last = item;
-	} else {
-		deferred_new = deferred_new_last = item;
-	}
+	return deferred_text.buf + lines->items[i].offset;
 }
 
 static void print_part_with_lcs(char *class, char *line, char *lcs)
@@ -219,10 +233,14 @@ static void print_ssdiff_line(char *class,
 {
 	char *lcs = NULL;
 
-	if (old_line)
-		old_line = replace_tabs(old_line + 1);
-	if (new_line)
-		new_line = replace_tabs(new_line + 1);
+	if (old_line) {
+		replace_tabs(&old_text, old_line + 1);
+		old_line = old_text.buf;
+	}
+	if (new_line) {
+		replace_tabs(&new_text, new_line + 1);
+		new_line = new_text.buf;
+	}
 	if (individual_chars && old_line && new_line)
 		lcs = longest_common_subsequence(old_line, new_line);
 	html("<tr>\n");
@@ -272,87 +290,31 @@ static void print_ssdiff_line(char *class,
 	}
 
 	html("</td></tr>");
-	if (lcs)
-		free(lcs);
-	if (new_line)
-		free(new_line);
-	if (old_line)
-		free(old_line);
-}
-
-static void print_deferred_old_lines(void)
-{
-	struct deferred_lines *iter_old, *tmp;
-	iter_old = deferred_old;
-	while (iter_old) {
-		print_ssdiff_line("del", iter_old->line_no,
-				  iter_old->line, -1, NULL, 0);
-		tmp = iter_old->next;
-		free(iter_old);
-		iter_old = tmp;
-	}
-}
-
-static void print_deferred_new_lines(void)
-{
-	struct deferred_lines *iter_new, *tmp;
-	iter_new = deferred_new;
-	while (iter_new) {
-		print_ssdiff_line("add", -1, NULL,
-				  iter_new->line_no, iter_new->line, 0);
-		tmp = iter_new->next;
-		free(iter_new);
-		iter_new = tmp;
-	}
-}
-
-static void print_deferred_changed_lines(void)
-{
-	struct deferred_lines *iter_old, *iter_new, *tmp;
-	int n_old_lines = calc_deferred_lines(deferred_old);
-	int n_new_lines = calc_deferred_lines(deferred_new);
-	int individual_chars = (n_old_lines == n_new_lines ? 1 : 0);
-
-	iter_old = deferred_old;
-	iter_new = deferred_new;
-	while (iter_old || iter_new) {
-		if (iter_old && iter_new)
-			print_ssdiff_line("changed", iter_old->line_no,
-					  iter_old->line,
-					  iter_new->line_no, iter_new->line,
-					  individual_chars);
-		else if (iter_old)
-			print_ssdiff_line("changed", iter_old->line_no,
-					  iter_old->line, -1, NULL, 0);
-		else if (iter_new)
-			print_ssdiff_line("changed", -1, NULL,
-					  iter_new->line_no, iter_new->line, 0);
-		if (iter_old) {
-			tmp = iter_old->next;
-			free(iter_old);
-			iter_old = tmp;
-		}
-
-		if (iter_new) {
-			tmp = iter_new->next;
-			free(iter_new);
-			iter_new = tmp;
-		}
-	}
 }
 
 void cgit_ssdiff_print_deferred_lines(void)
 {
-	if (!deferred_old && !deferred_new)
-		return;
-	if (deferred_old && !deferred_new)
-		print_deferred_old_lines();
-	else if (!deferred_old && deferred_new)
-		print_deferred_new_lines();
-	else
-		print_deferred_changed_lines();
-	deferred_old = deferred_old_last = NULL;
-	deferred_new = deferred_new_last = NULL;
+	int old_nr = deferred_old.nr, new_nr = deferred_new.nr;
+	int i, old, new;
+	char *class = "changed";
+
+	if (!new_nr)
+		class = "del";
+	else if (!old_nr)
+		class = "add";
+	for (i = 0; i < old_nr || i < new_nr; i++) {
+		old = i < old_nr;
+		new = i < new_nr;
+		print_ssdiff_line(class,
+				  old ? deferred_old.items[i].line_no : -1,
+				  old ? deferred_line(&deferred_old, i) : NULL,
+				  new ? deferred_new.items[i].line_no : -1,
+				  new ? deferred_line(&deferred_new, i) : NULL,
+				  old && new && old_nr == new_nr);
+	}
+	deferred_old.nr = 0;
+	deferred_new.nr = 0;
+	strbuf_reset(&deferred_text);
 }
 
 /*
@@ -368,17 +330,17 @@ void cgit_ssdiff_line_cb(char *line, int len)
 	}
 
 	if (line[0] == ' ') {
-		if (deferred_old || deferred_new)
+		if (deferred_old.nr || deferred_new.nr)
 			cgit_ssdiff_print_deferred_lines();
 		print_ssdiff_line("ctx", current_old_line, line,
 				  current_new_line, line, 0);
 		current_old_line += 1;
 		current_new_line += 1;
 	} else if (line[0] == '+') {
-		deferred_new_add(line, current_new_line);
+		deferred_add(&deferred_new, line, current_new_line);
 		current_new_line += 1;
 	} else if (line[0] == '-') {
-		deferred_old_add(line, current_old_line);
+		deferred_add(&deferred_old, line, current_old_line);
 		current_old_line += 1;
 	} else if (line[0] == '@') {
 		html("<tr><td colspan='4' class='hunk'>");
@@ -407,7 +369,7 @@ void cgit_ssdiff_header_end(void)
 
 void cgit_ssdiff_footer(void)
 {
-	if (deferred_old || deferred_new)
+	if (deferred_old.nr || deferred_new.nr)
 		cgit_ssdiff_print_deferred_lines();
 	html("<tr><td class='foot' colspan='4'></td></tr>");
 }
@@ -2,17 +2,13 @@
 #define UI_SSDIFF_H
 
 /*
- * ssdiff line limits
+ * ssdiff line limit: changed characters are highlighted in pairs of lines
+ * whose lengths multiply to about this at most
  */
-#ifndef MAX_SSDIFF_M
-#define MAX_SSDIFF_M 128
+#ifndef MAX_SSDIFF_SIZE
+#define MAX_SSDIFF_SIZE (4096 * 4096)
 #endif
 
-#ifndef MAX_SSDIFF_N
-#define MAX_SSDIFF_N 128
-#endif
-#define MAX_SSDIFF_SIZE ((MAX_SSDIFF_M) * (MAX_SSDIFF_N))
-
 extern void cgit_ssdiff_print_deferred_lines(void);
 
 extern void cgit_ssdiff_line_cb(char *line, int len);
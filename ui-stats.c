@@ -2,17 +2,7 @@
 #include "ui-stats.h"
 #include "html.h"
 #include "ui-shared.h"
-
-#ifdef NO_C99_FORMAT
-#define SZ_FMT "%u"
-#else
-#define SZ_FMT "%zu"
-#endif
-
-struct authorstat {
-	long total;
-	struct string_list list;
-};
+#include "author-stats.h"
 
 #define DAY_SECS (60 * 60 * 24)
 #define WEEK_SECS (DAY_SECS * 7)
@@ -164,69 +154,187 @@ const char *cgit_find_stats_periodname(int idx)
 		return "";
 }
 
-static void add_commit(struct string_list *authors, struct commit *commit,
-	const struct cgit_period *period)
+/* The counts are kept in a dense matrix with one row per author and one
+ * column per period shown. Authors are numbered in the order they are
+ * first seen, with a hashmap to find the number for a name, and a date
+ * is mapped to its column by searching the period boundaries.
+ */
+struct author {
+	struct hashmap_entry ent;
+	int id;
+	char name[FLEX_ARRAY];
+};
+
+struct authorstats {
+	const struct cgit_period *period;
+	time_t bounds[13];	/* start of each column, and end of the last */
+	struct hashmap map;
+	struct author **authors;
+	int nr, alloc;
+	unsigned long *counts;	/* nr * period->count, row by row */
+	unsigned long *totals;
+	int rows;
+};
+
+static int author_cmp(const void *a, const void *b, const void *keydata)
+{
+	const struct author *aa = a, *ab = b;
+
+	return strcmp(aa->name, keydata ? keydata : ab->name);
+}
+
+/* The first day shown for `period` */
+static void period_first(const struct cgit_period *period, struct tm *tm)
+{
+	time_t now;
+	long i;
+
+	time(&now);
+	gmtime_r(&now, tm);
+	period->trunc(tm);
+	for (i = 1; i < period->count; i++)
+		period->dec(tm);
+	tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
+}
+
+static void init_authorstats(struct authorstats *stats,
+			     const struct cgit_period *period)
+{
+	struct tm tm;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->period = period;
+	if (period->count >= ARRAY_SIZE(stats->bounds))
+		die("BUG: too many periods for stats");
+	period_first(period, &tm);
+	for (i = 0; i <= period->count; i++) {
+		stats->bounds[i] = timegm(&tm);
+		period->inc(&tm);
+	}
+	hashmap_init(&stats->map, author_cmp, 0);
+}
+
+static void free_authorstats(struct authorstats *stats)
+{
+	hashmap_free(&stats->map, 1);
+	free(stats->authors);
+	free(stats->counts);
+	free(stats->totals);
+}
+
+static int author_id(struct authorstats *stats, const char *name)
+{
+	unsigned int hash = strhash(name);
+	struct author *author;
+	int columns = stats->period->count;
+
+	author = hashmap_get_from_hash(&stats->map, hash, name);
+	if (author)
+		return author->id;
+
+	author = xmalloc(sizeof(*author) + strlen(name) + 1);
+	hashmap_entry_init(author, hash);
+	author->id = stats->nr;
+	strcpy(author->name, name);
+	hashmap_add(&stats->map, author);
+	ALLOC_GROW(stats->authors, stats->nr + 1, stats->alloc);
+	stats->authors[stats->nr] = author;
+	if (stats->rows < stats->alloc) {
+		stats->rows = stats->alloc;
+		REALLOC_ARRAY(stats->counts, (size_t)stats->rows * columns);
+		REALLOC_ARRAY(stats->totals, stats->rows);
+	}
+	memset(stats->counts + (size_t)stats->nr * columns, 0,
+	       columns * sizeof(*stats->counts));
+	stats->totals[stats->nr] = 0;
+	return stats->nr++;
+}
+
+static int period_index(const struct authorstats *stats, time_t t)
+{
+	int lo = 0, hi = stats->period->count, mi;
+
+	if (t < stats->bounds[0] || t >= stats->bounds[hi])
+		return -1;
+	while (hi - lo > 1) {
+		mi = lo + (hi - lo) / 2;
+		if (t < stats->bounds[mi])
+			hi = mi;
+		else
+			lo = mi;
+	}
+	return lo;
+}
+
+static void add_count(struct authorstats *stats, const char *name,
+		      time_t t, unsigned long count)
+{
+	int column, id;
+
+	column = period_index(stats, t);
+	if (column < 0)
+		return;
+	id = author_id(stats, name);
+	stats->counts[(size_t)id * stats->period->count + column] += count;
+	stats->totals[id] += count;
+}
+
+static void add_commit(struct authorstats *stats, struct commit *commit)
 {
 	struct commitinfo *info;
-	struct string_list_item *author, *item;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	char *tmp;
-	struct tm *date;
-	time_t t;
 
 	info = cgit_parse_commit(commit);
-	tmp = xstrdup(info->author);
-	author = string_list_insert(authors, tmp);
-	if (!author->util)
-		author->util = xcalloc(1, sizeof(struct authorstat));
-	else
-		free(tmp);
-	authorstat = author->util;
-	items = &authorstat->list;
-	t = info->committer_date;
-	date = gmtime(&t);
-	period->trunc(date);
-	tmp = xstrdup(period->pretty(date));
-	item = string_list_insert(items, tmp);
-	if (item->util)
-		free(tmp);
-	item->util++;
-	authorstat->total++;
+	if (info->author)
+		add_count(stats, info->author, info->committer_date, 1);
 	cgit_free_commitinfo(info);
 }
 
-static int cmp_total_commits(const void *a1, const void *a2)
+static void add_bucket(const char *author, unsigned long day,
+		       unsigned long count, void *data)
 {
-	const struct string_list_item *i1 = a1;
-	const struct string_list_item *i2 = a2;
-	const struct authorstat *auth1 = i1->util;
-	const struct authorstat *auth2 = i2->util;
+	add_count(data, author, (time_t)day * DAY_SECS, count);
+}
 
-	return auth2->total - auth1->total;
+/* Collect the counts from the per-day buckets kept in the cache, which
+ * are made to cover the longest period enabled for the repo so that
+ * switching between periods does not mean walking more history.
+ */
+static int collect_stats_buckets(struct authorstats *stats)
+{
+	unsigned long since, start;
+	struct tm tm;
+	int i;
+
+	since = stats->bounds[0] / DAY_SECS;
+	for (i = 0; i < ctx.repo->max_stats; i++) {
+		period_first(&periods[i], &tm);
+		start = timegm(&tm) / DAY_SECS;
+		if (start < since)
+			since = start;
+	}
+	return cgit_author_stats_foreach(ctx.qry.head, since, add_bucket,
+					 stats);
 }
 
-/* Walk the commit DAG and collect number of commits per author per
- * timeperiod into a nested string_list collection.
+/* Walk the commit DAG and collect the number of commits per author per
+ * timeperiod. Without a path limit, the counts per day kept in the cache
+ * are used instead.
  */
-static struct string_list collect_stats(const struct cgit_period *period)
+static void collect_stats(struct authorstats *stats)
 {
-	struct string_list authors;
 	struct rev_info rev;
 	struct commit *commit;
 	const char *argv[] = {NULL, ctx.qry.head, NULL, NULL, NULL, NULL};
 	int argc = 3;
-	time_t now;
-	long i;
-	struct tm *tm;
+	struct tm tm;
 	char tmp[11];
 
-	time(&now);
-	tm = gmtime(&now);
-	period->trunc(tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(tm);
-	strftime(tmp, sizeof(tmp), "%Y-%m-%d", tm);
+	if (!ctx.qry.path && !collect_stats_buckets(stats))
+		return;
+
+	gmtime_r(&stats->bounds[0], &tm);
+	strftime(tmp, sizeof(tmp), "%Y-%m-%d", &tm);
 	argv[2] = xstrdup(fmt("--since=%s", tmp));
 	if (ctx.qry.path) {
 		argv[3] = "--";
@@ -241,128 +349,102 @@ static struct string_list collect_stats(const struct cgit_period *period)
 	rev.show_root_diff = 0;
 	setup_revisions(argc, argv, &rev, NULL);
 	prepare_revision_walk(&rev);
-	memset(&authors, 0, sizeof(authors));
 	while ((commit = get_revision(&rev)) != NULL) {
-		add_commit(&authors, commit, period);
+		add_commit(stats, commit);
 		free_commit_buffer(commit);
 		free_commit_list(commit->parents);
 		commit->parents = NULL;
 	}
-	return authors;
 }
 
-static void print_combined_authorrow(struct string_list *authors, int from,
+static const struct authorstats *sort_stats;
+
+static int cmp_total_commits(const void *a1, const void *a2)
+{
+	const struct author *author1 = *(const struct author **)a1;
+	const struct author *author2 = *(const struct author **)a2;
+	unsigned long total1 = sort_stats->totals[author1->id];
+	unsigned long total2 = sort_stats->totals[author2->id];
+
+	if (total1 != total2)
+		return total1 < total2 ? 1 : -1;
+	return strcmp(author1->name, author2->name);
+}
+
+/* Print the sums of the rows for the authors at positions `from` to
+ * `to` in the sorted author list.
+ */
+static void print_combined_authorrow(struct authorstats *stats, int from,
 				     int to, const char *name,
 				     const char *leftclass,
 				     const char *centerclass,
-				     const char *rightclass,
-				     const struct cgit_period *period)
+				     const char *rightclass)
 {
-	struct string_list_item *author;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	struct string_list_item *date;
-	time_t now;
-	long i, j, total, subtotal;
-	struct tm *tm;
-	char *tmp;
-
-	time(&now);
-	tm = gmtime(&now);
-	period->trunc(tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(tm);
+	int columns = stats->period->count;
+	unsigned long *sums = xcalloc(columns, sizeof(*sums));
+	unsigned long total = 0;
+	const unsigned long *row;
+	int i, j;
+
+	for (i = from; i <= to; i++) {
+		row = stats->counts + (size_t)stats->authors[i]->id * columns;
+		for (j = 0; j < columns; j++)
+			sums[j] += row[j];
+	}
 
-	total = 0;
 	htmlf("<tr><td class='%s'>%s</td>", leftclass,
 		fmt(name, to - from + 1));
-	for (j = 0; j < period->count; j++) {
-		tmp = period->pretty(tm);
-		period->inc(tm);
-		subtotal = 0;
-		for (i = from; i <= to; i++) {
-			author = &authors->items[i];
-			authorstat = author->util;
-			items = &authorstat->list;
-			date = string_list_lookup(items, tmp);
-			if (date)
-				subtotal += (size_t)date->util;
-		}
-		htmlf("<td class='%s'>%ld</td>", centerclass, subtotal);
-		total += subtotal;
+	for (j = 0; j < columns; j++) {
+		htmlf("<td class='%s'>%lu</td>", centerclass, sums[j]);
+		total += sums[j];
 	}
-	htmlf("<td class='%s'>%ld</td></tr>", rightclass, total);
+	htmlf("<td class='%s'>%lu</td></tr>", rightclass, total);
+	free(sums);
 }
 
-static void print_authors(struct string_list *authors, int top,
-			  const struct cgit_period *period)
+static void print_authors(struct authorstats *stats, int top)
 {
-	struct string_list_item *author;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	struct string_list_item *date;
-	time_t now;
-	long i, j, total;
-	struct tm *tm;
-	char *tmp;
-
-	time(&now);
-	tm = gmtime(&now);
-	period->trunc(tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(tm);
+	const struct cgit_period *period = stats->period;
+	const unsigned long *row;
+	struct tm tm;
+	long i, j;
 
 	html("<table class='stats'><tr><th>Author</th>");
 	for (j = 0; j < period->count; j++) {
-		tmp = period->pretty(tm);
-		htmlf("<th>%s</th>", tmp);
-		period->inc(tm);
+		gmtime_r(&stats->bounds[j], &tm);
+		htmlf("<th>%s</th>", period->pretty(&tm));
 	}
 	html("<th>Total</th></tr>\n");
 
-	if (top <= 0 || top > authors->nr)
-		top = authors->nr;
+	if (top <= 0 || top > stats->nr)
+		top = stats->nr;
 
 	for (i = 0; i < top; i++) {
-		author = &authors->items[i];
 		html("<tr><td class='left'>");
-		html_txt(author->string);
+		html_txt(stats->authors[i]->name);
 		html("</td>");
-		authorstat = author->util;
-		items = &authorstat->list;
-		total = 0;
+		row = stats->counts + (size_t)stats->authors[i]->id * period->count;
 		for (j = 0; j < period->count; j++)
-			period->dec(tm);
-		for (j = 0; j < period->count; j++) {
-			tmp = period->pretty(tm);
-			period->inc(tm);
-			date = string_list_lookup(items, tmp);
-			if (!date)
-				html("<td>0</td>");
-			else {
-				htmlf("<td>"SZ_FMT"</td>", (size_t)date->util);
-				total += (size_t)date->util;
-			}
-		}
-		htmlf("<td class='sum'>%ld</td></tr>", total);
+			htmlf("<td>%lu</td>", row[j]);
+		htmlf("<td class='sum'>%lu</td></tr>",
+		      stats->totals[stats->authors[i]->id]);
 	}
 
-	if (top < authors->nr)
-		print_combined_authorrow(authors, top, authors->nr - 1,
-			"Others (%ld)", "left", "", "sum", period);
+	if (top < stats->nr)
+		print_combined_authorrow(stats, top, stats->nr - 1,
+			"Others (%ld)", "left", "", "sum");
 
-	print_combined_authorrow(authors, 0, authors->nr - 1, "Total",
-		"total", "sum", "sum", period);
+	print_combined_authorrow(stats, 0, stats->nr - 1, "Total",
+		"total", "sum", "sum");
 	html("</table>");
 }
 
-/* Create a sorted string_list with one entry per author. The util-field
- * for each author is another string_list which is used to calculate the
- * number of commits per time-interval.
+/* Count the commits per author and period, and sort the authors by
+ * their total number of commits.
  */
 void cgit_show_stats(void)
 {
-	struct string_list authors;
+	struct authorstats stats;
 	const struct cgit_period *period;
 	int top, i;
 	const char *code = "w";
@@ -381,9 +463,10 @@ void cgit_show_stats(void)
 			"Statistics type disabled: %s", period->name);
 		return;
 	}
-	authors = collect_stats(period);
-	qsort(authors.items, authors.nr, sizeof(struct string_list_item),
-		cmp_total_commits);
+	init_authorstats(&stats, period);
+	collect_stats(&stats);
+	sort_stats = &stats;
+	qsort(stats.authors, stats.nr, sizeof(*stats.authors), cmp_total_commits);
 
 	top = ctx.qry.ofs;
 	if (!top)
@@ -423,7 +506,8 @@ void cgit_show_stats(void)
 		html("')");
 	}
 	html("</h2>");
-	print_authors(&authors, top, period);
+	print_authors(&stats, top);
 	cgit_print_layout_end();
+	free_authorstats(&stats);
 }
 
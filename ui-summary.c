@@ -99,9 +99,26 @@ static char* append_readme_path(const char *filename, const char *ref, const cha
 	return full_path;
 }
 
+/* What the about-filter output for a readme depends on, or NULL if it
+ * cannot be found. The caller must free the return value.
+ */
+static char *readme_id(char *filename, const char *ref)
+{
+	unsigned char sha1[20];
+	struct stat st;
+
+	if (ref)
+		return cgit_find_file(filename, ref, 1, sha1) ? NULL :
+			xstrdup(sha1_to_hex(sha1));
+	if (stat(filename, &st))
+		return NULL;
+	return fmtalloc("%"PRIuMAX" %"PRIuMAX, (uintmax_t)st.st_mtime,
+			(uintmax_t)st.st_size);
+}
+
 void cgit_print_repo_readme(char *path)
 {
-	char *filename, *ref, *mimetype;
+	char *filename, *ref, *mimetype, *id;
 	int free_filename = 0;
 
 	mimetype = get_mimetype_for_filename(path);
@@ -132,12 +149,15 @@ void cgit_print_repo_readme(char *path)
 	 * filesystem, while applying the about-filter.
 	 */
 	html("<div id='summary'>");
-	cgit_open_filter(ctx.repo->about_filter, filename);
-	if (ref)
-		cgit_print_file(filename, ref, 1);
-	else
-		html_include(filename);
-	cgit_close_filter(ctx.repo->about_filter);
+	id = readme_id(filename, ref);
+	if (!cgit_open_cached_filter(ctx.repo->about_filter, id, filename)) {
+		if (ref)
+			cgit_print_file(filename, ref, 1);
+		else
+			html_include(filename);
+		cgit_close_cached_filter(ctx.repo->about_filter);
+	}
+	free(id);
 
 	html("</div>");
 	if (free_filename)
@@ -56,15 +56,9 @@ void cgit_print_tag(char *revname)
 			"Bad tag reference: %s", revname);
 		goto cleanup;
 	}
-	obj = parse_object(sha1);
-	if (!obj) {
-		cgit_print_error_page(500, "Internal server error",
-			"Bad object id: %s", sha1_to_hex(sha1));
-		goto cleanup;
-	}
-	if (obj->type == OBJ_TAG) {
+	if (sha1_object_info(sha1, NULL) == OBJ_TAG) {
 		tag = lookup_tag(sha1);
-		if (!tag || parse_tag(tag) || !(info = cgit_parse_tag(tag))) {
+		if (!tag || !(info = cgit_parse_tag(tag))) {
 			cgit_print_error_page(500, "Internal server error",
 				"Bad tag object: %s", revname);
 			goto cleanup;
@@ -99,6 +93,12 @@ void cgit_print_tag(char *revname)
 		print_tag_content(info->msg);
 		cgit_print_layout_end();
 	} else {
+		obj = parse_object(sha1);
+		if (!obj) {
+			cgit_print_error_page(500, "Internal server error",
+				"Bad object id: %s", sha1_to_hex(sha1));
+			goto cleanup;
+		}
 		cgit_print_layout_start();
 		html("<table class='commit-info'>\n");
 		htmlf("<tr><td>tag name</td><td>");
@@ -10,14 +10,33 @@
 #include "ui-tree.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "cache.h"
+#include "last-commit.h"
+#include <tree-walk.h>
+
+#define SIZES_SIGNATURE "CGTS"
+#define SIZES_VERSION 1
+#define SIZES_HEADER_SIZE (4 + 4 + 4)
+#define SIZES_MIN_ENTRIES 256
+#define BAD_SIZE ((unsigned long)-1)
 
 struct walk_tree_context {
 	char *curr_rev;
-	char *match_path;
-	int state;
+	struct string_list *last_commits;
+	unsigned long *sizes;	/* of the entries from first to last */
+	int nr, first, last;
+};
+
+struct size_request {
+	const unsigned char *sha1;
+	struct packed_git *pack;
+	int pack_nr;
+	off_t offset;
+	int nr;
 };
 
-static void print_text_buffer(const char *name, char *buf, unsigned long size)
+static void print_text_buffer(const unsigned char *sha1, const char *name,
+			      char *buf, unsigned long size)
 {
 	unsigned long lineno, idx;
 	const char *numberfmt = "<a id='n%1$d' href='#n%1$d'>%1$d</a>\n";
@@ -46,9 +65,11 @@ static void print_text_buffer(const char *name, char *buf, unsigned long size)
 	if (ctx.repo->source_filter) {
 		char *filter_arg = xstrdup(name);
 		html("<td class='lines'><pre><code>");
-		cgit_open_filter(ctx.repo->source_filter, filter_arg);
-		html_raw(buf, size);
-		cgit_close_filter(ctx.repo->source_filter);
+		if (!cgit_open_cached_filter(ctx.repo->source_filter,
+					     sha1_to_hex(sha1), filter_arg)) {
+			html_raw(buf, size);
+			cgit_close_cached_filter(ctx.repo->source_filter);
+		}
 		free(filter_arg);
 		html("</code></pre></td></tr></table>\n");
 		return;
@@ -60,35 +81,112 @@ static void print_text_buffer(const char *name, char *buf, unsigned long size)
 }
 
 #define ROWLEN 32
+#define BINARY_PAGE_SIZE (64 * 1024)
+#define BINARY_FLUSH_SIZE 16384
+
+static const char hex_digits[] = "0123456789abcdef";
 
-static void print_binary_buffer(char *buf, unsigned long size)
+/* Append one row of the hex dump of `len` bytes at `ofs` */
+static void add_hex_row(struct strbuf *out, const unsigned char *buf,
+			unsigned long ofs, int len)
 {
-	unsigned long ofs, idx;
-	static char ascii[ROWLEN + 1];
+	char *p;
+	int idx, digits;
+
+	strbuf_addstr(out, "<tr><td class='right'>");
+	for (digits = 4; digits < 2 * sizeof(ofs) && ofs >> (4 * digits);
+	     digits++)
+		;
+	strbuf_grow(out, digits);
+	p = out->buf + out->len;
+	strbuf_setlen(out, out->len + digits);
+	while (digits--) {
+		p[digits] = hex_digits[ofs & 0xf];
+		ofs >>= 4;
+	}
+
+	strbuf_addstr(out, "</td><td class='hex'>");
+	strbuf_grow(out, 3 * ROWLEN + 3);
+	p = out->buf + out->len;
+	for (idx = 0; idx < len; idx++) {
+		if (idx == 16) {
+			*p++ = ' ';
+			*p++ = ' ';
+			*p++ = ' ';
+		}
+		*p++ = ' ';
+		*p++ = hex_digits[buf[idx] >> 4];
+		*p++ = hex_digits[buf[idx] & 0xf];
+	}
+	strbuf_setlen(out, p - out->buf);
+
+	strbuf_addstr(out, " </td><td class='hex'>");
+	for (idx = 0; idx < len; idx++) {
+		if (buf[idx] == '<')
+			strbuf_addstr(out, "&lt;");
+		else if (buf[idx] == '>')
+			strbuf_addstr(out, "&gt;");
+		else if (buf[idx] == '&')
+			strbuf_addstr(out, "&amp;");
+		else
+			strbuf_addch(out, isgraph(buf[idx]) ? buf[idx] : '.');
+	}
+	strbuf_addstr(out, "</td></tr>\n");
+}
+
+/* Show BINARY_PAGE_SIZE bytes of a binary blob from ctx.qry.ofs on, with
+ * links to the pages before and after it.
+ */
+static void print_binary_buffer(char *buf, unsigned long size,
+				const char *rev, const char *path)
+{
+	struct strbuf out = STRBUF_INIT;
+	unsigned long first = 0, last, ofs;
+
+	if (ctx.qry.ofs > 0 && ctx.qry.ofs < size)
+		first = ctx.qry.ofs - ctx.qry.ofs % ROWLEN;
+	last = first + BINARY_PAGE_SIZE < size ? first + BINARY_PAGE_SIZE : size;
 
 	html("<table summary='blob content' class='bin-blob'>\n");
 	html("<tr><th>ofs</th><th>hex dump</th><th>ascii</th></tr>");
-	for (ofs = 0; ofs < size; ofs += ROWLEN, buf += ROWLEN) {
-		htmlf("<tr><td class='right'>%04lx</td><td class='hex'>", ofs);
-		for (idx = 0; idx < ROWLEN && ofs + idx < size; idx++)
-			htmlf("%*s%02x",
-			      idx == 16 ? 4 : 1, "",
-			      buf[idx] & 0xff);
-		html(" </td><td class='hex'>");
-		for (idx = 0; idx < ROWLEN && ofs + idx < size; idx++)
-			ascii[idx] = isgraph(buf[idx]) ? buf[idx] : '.';
-		ascii[idx] = '\0';
-		html_txt(ascii);
-		html("</td></tr>\n");
+	for (ofs = first; ofs < last; ofs += ROWLEN) {
+		add_hex_row(&out, (unsigned char *)buf + ofs, ofs,
+			    last - ofs < ROWLEN ? last - ofs : ROWLEN);
+		if (out.len >= BINARY_FLUSH_SIZE) {
+			html_raw(out.buf, out.len);
+			strbuf_reset(&out);
+		}
 	}
+	html_raw(out.buf, out.len);
+	strbuf_release(&out);
 	html("</table>\n");
+
+	if (first > 0 || last < size) {
+		html("<ul class='pager'>");
+		if (first > 0) {
+			html("<li>");
+			cgit_tree_page_link("[prev]", NULL, NULL, ctx.qry.head,
+					    rev, path,
+					    first > BINARY_PAGE_SIZE ?
+					    first - BINARY_PAGE_SIZE : 0);
+			html("</li>");
+		}
+		if (last < size) {
+			html("<li>");
+			cgit_tree_page_link("[next]", NULL, NULL, ctx.qry.head,
+					    rev, path, last);
+			html("</li>");
+		}
+		html("</ul>");
+	}
 }
 
 static void print_object(const unsigned char *sha1, char *path, const char *basename, const char *rev)
 {
 	enum object_type type;
-	char *buf;
+	char *buf = NULL;
 	unsigned long size;
+	int too_large;
 
 	type = sha1_object_info(sha1, &size);
 	if (type == OBJ_BAD) {
@@ -97,32 +195,228 @@ static void print_object(const unsigned char *sha1, char *path, const char *base
 		return;
 	}
 
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf) {
-		cgit_print_error_page(500, "Internal server error",
-			"Error reading object %s", sha1_to_hex(sha1));
-		return;
+	/* Don't even read blobs too large to be shown */
+	too_large = ctx.cfg.max_blob_size &&
+		size / 1024 > ctx.cfg.max_blob_size;
+	if (!too_large) {
+		buf = read_sha1_file(sha1, &type, &size);
+		if (!buf) {
+			cgit_print_error_page(500, "Internal server error",
+				"Error reading object %s", sha1_to_hex(sha1));
+			return;
+		}
 	}
 
 	cgit_print_layout_start();
 	htmlf("blob: %s (", sha1_to_hex(sha1));
 	cgit_plain_link("plain", NULL, NULL, ctx.qry.head,
 		        rev, path);
+	if (ctx.repo->enable_blame) {
+		html(", ");
+		cgit_blame_link("blame", NULL, NULL, ctx.qry.head,
+				rev, path);
+	}
 	html(")\n");
 
-	if (ctx.cfg.max_blob_size && size / 1024 > ctx.cfg.max_blob_size) {
+	if (too_large) {
 		htmlf("<div class='error'>blob size (%ldKB) exceeds display size limit (%dKB).</div>",
 				size / 1024, ctx.cfg.max_blob_size);
 		return;
 	}
 
 	if (buffer_is_binary(buf, size))
-		print_binary_buffer(buf, size);
+		print_binary_buffer(buf, size, rev, path);
 	else
-		print_text_buffer(basename, buf, size);
+		print_text_buffer(sha1, basename, buf, size);
+	free(buf);
 }
 
 
+static void print_last_commit(struct string_list *last_commits,
+			      const char *name, const char *path)
+{
+	struct string_list_item *item;
+	struct commit *commit = NULL;
+	struct commitinfo *info;
+
+	item = string_list_lookup(last_commits, name);
+	if (item)
+		commit = item->util;
+	if (!commit || parse_commit(commit)) {
+		html("<td/><td/><td/>");
+		return;
+	}
+	info = cgit_parse_commit(commit);
+	html("<td>");
+	cgit_commit_link(info->subject, NULL, NULL, ctx.qry.head,
+			 oid_to_hex(&commit->object.oid), path);
+	html("</td><td>");
+	cgit_open_filter(ctx.repo->email_filter, info->author_email, "tree");
+	html_txt(info->author);
+	cgit_close_filter(ctx.repo->email_filter);
+	html("</td><td>");
+	cgit_print_age(commit->date, TM_WEEK * 2, FMT_SHORTDATE);
+	html("</td>");
+	cgit_free_commitinfo(info);
+}
+
+static int size_request_cmp(const void *a, const void *b)
+{
+	const struct size_request *ra = a, *rb = b;
+
+	if (ra->pack_nr != rb->pack_nr)
+		return ra->pack_nr - rb->pack_nr;
+	return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+/* The size of the object at `offset` in `p`, read from its header, or
+ * from the delta header if it is a delta. Returns -1 if the object can't
+ * be read this way.
+ */
+static int packed_size(struct packed_git *p, off_t offset,
+		       unsigned long *size)
+{
+	struct pack_window *w_curs = NULL;
+	off_t curpos = offset;
+	const unsigned char *c;
+	int type;
+
+	if (!is_pack_valid(p))
+		return -1;
+	type = unpack_object_header(p, &w_curs, &curpos, size);
+	if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+		/* Skip the reference to the base */
+		if (type == OBJ_REF_DELTA)
+			curpos += 20;
+		else
+			do {
+				c = use_pack(p, &w_curs, curpos++, NULL);
+			} while (*c & 128);
+		*size = get_size_from_delta(p, &w_curs, curpos);
+		if (!*size)
+			type = OBJ_BAD;
+	}
+	unuse_pack(&w_curs);
+	return type > OBJ_NONE ? 0 : -1;
+}
+
+/* Look up the sizes of many objects at once. Packed objects are looked
+ * at in the order they are stored in, so each pack is read front to back,
+ * and only their size is asked for: it is in the header of a delta, while
+ * its type would mean following the delta chain to the base. Objects that
+ * cannot be found get BAD_SIZE. A NULL sha1 (a submodule) has size 0.
+ */
+static void get_object_sizes(const unsigned char **sha1s, int nr,
+			     unsigned long *sizes)
+{
+	struct size_request *reqs;
+	struct packed_git *p;
+	struct object_info oi = {NULL};
+	int i, pack_nr;
+
+	prepare_packed_git();
+	reqs = xcalloc(nr, sizeof(*reqs));
+	for (i = 0; i < nr; i++) {
+		reqs[i].sha1 = sha1s[i] ? lookup_replace_object(sha1s[i]) : NULL;
+		reqs[i].nr = i;
+		if (!reqs[i].sha1)
+			continue;
+		for (p = packed_git, pack_nr = 1; p; p = p->next, pack_nr++) {
+			reqs[i].offset = find_pack_entry_one(reqs[i].sha1, p);
+			if (reqs[i].offset) {
+				reqs[i].pack = p;
+				reqs[i].pack_nr = pack_nr;
+				break;
+			}
+		}
+	}
+	qsort(reqs, nr, sizeof(*reqs), size_request_cmp);
+
+	for (i = 0; i < nr; i++) {
+		sizes[reqs[i].nr] = 0;
+		if (!reqs[i].sha1)
+			continue;
+		if (reqs[i].pack &&
+		    !packed_size(reqs[i].pack, reqs[i].offset,
+				 &sizes[reqs[i].nr]))
+			continue;
+		/* Loose objects, and anything unusual in a pack */
+		oi.sizep = &sizes[reqs[i].nr];
+		if (sha1_object_info_extended(reqs[i].sha1, &oi,
+					      LOOKUP_REPLACE_OBJECT))
+			sizes[reqs[i].nr] = BAD_SIZE;
+	}
+	free(reqs);
+}
+
+/* The sizes of the entries from first to last of a tree. Large trees are
+ * looked up once and kept in the cache directory; trees never change.
+ *
+ * Payload layout (all integers are 32-bit big endian):
+ *   "CGTS" version nr
+ *   nr * (high low)                    all ones for bad objects
+ */
+static unsigned long *tree_sizes(struct tree *tree, int first, int last)
+{
+	const unsigned char **sha1s;
+	unsigned long *sizes;
+	struct tree_desc desc;
+	struct name_entry entry;
+	struct cache_data file;
+	struct strbuf buf = STRBUF_INIT;
+	const unsigned char *p;
+	int i, nr = last - first;
+	char *key;
+
+	sizes = xcalloc(nr ? nr : 1, sizeof(*sizes));
+	key = fmtalloc("%s\n%d\n%d", oid_to_hex(&tree->object.oid), first,
+		       last);
+	if (nr >= SIZES_MIN_ENTRIES &&
+	    !cache_open_data(&file, "treesizes", key)) {
+		p = (const unsigned char *)file.buf;
+		if (file.len == SIZES_HEADER_SIZE + (size_t)nr * 8 &&
+		    !memcmp(p, SIZES_SIGNATURE, 4) &&
+		    get_be32(p + 4) == SIZES_VERSION && get_be32(p + 8) == nr) {
+			for (i = 0, p += SIZES_HEADER_SIZE; i < nr; i++, p += 8)
+				sizes[i] = (unsigned long)((uint64_t)get_be32(p) << 32 |
+							   get_be32(p + 4));
+			cache_close_data(&file);
+			free(key);
+			return sizes;
+		}
+		cache_close_data(&file);
+	}
+
+	sha1s = xcalloc(nr ? nr : 1, sizeof(*sha1s));
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	for (i = 0; tree_entry(&desc, &entry) && i < last; i++)
+		if (i >= first && !S_ISGITLINK(entry.mode))
+			sha1s[i - first] = entry.sha1;
+	get_object_sizes(sha1s, nr, sizes);
+	free(sha1s);
+
+	if (nr >= SIZES_MIN_ENTRIES) {
+		strbuf_add(&buf, SIZES_SIGNATURE, 4);
+		cache_add_be32(&buf, SIZES_VERSION);
+		cache_add_be32(&buf, nr);
+		for (i = 0; i < nr; i++) {
+			cache_add_be32(&buf, (uint64_t)sizes[i] >> 32);
+			cache_add_be32(&buf, sizes[i]);
+		}
+		cache_write_data("treesizes", key, buf.buf, buf.len);
+		strbuf_release(&buf);
+	}
+	free(key);
+	return sizes;
+}
+
+/* The number of columns ls_head() prints */
+static int ls_columns(int last_commits)
+{
+	/* mode, name, size, [last commit, author, age,] links */
+	return last_commits ? 7 : 4;
+}
+
 static int ls_item(const unsigned char *sha1, struct strbuf *base,
 		const char *pathname, unsigned mode, int stage, void *cbdata)
 {
@@ -130,22 +424,25 @@ static int ls_item(const unsigned char *sha1, struct strbuf *base,
 	char *name;
 	struct strbuf fullpath = STRBUF_INIT;
 	struct strbuf class = STRBUF_INIT;
-	enum object_type type;
-	unsigned long size = 0;
+	unsigned long size;
+	int nr = walk_tree_ctx->nr++;
+
+	if (nr < walk_tree_ctx->first || nr >= walk_tree_ctx->last)
+		return 0;
+	size = walk_tree_ctx->sizes[nr - walk_tree_ctx->first];
 
 	name = xstrdup(pathname);
 	strbuf_addf(&fullpath, "%s%s%s", ctx.qry.path ? ctx.qry.path : "",
 		    ctx.qry.path ? "/" : "", name);
 
-	if (!S_ISGITLINK(mode)) {
-		type = sha1_object_info(sha1, &size);
-		if (type == OBJ_BAD) {
-			htmlf("<tr><td colspan='3'>Bad object: %s %s</td></tr>",
-			      name,
-			      sha1_to_hex(sha1));
-			free(name);
-			return 0;
-		}
+	if (size == BAD_SIZE) {
+		htmlf("<tr><td colspan='%d'>Bad object: %s %s</td></tr>",
+		      ls_columns(walk_tree_ctx->last_commits != NULL),
+		      name,
+		      sha1_to_hex(sha1));
+		free(name);
+		strbuf_release(&fullpath);
+		return 0;
 	}
 
 	html("<tr><td class='ls-mode'>");
@@ -165,6 +462,9 @@ static int ls_item(const unsigned char *sha1, struct strbuf *base,
 			       walk_tree_ctx->curr_rev, fullpath.buf);
 	}
 	htmlf("</td><td class='ls-size'>%li</td>", size);
+	if (walk_tree_ctx->last_commits)
+		print_last_commit(walk_tree_ctx->last_commits, name,
+				  fullpath.buf);
 
 	html("<td>");
 	cgit_log_link("log", NULL, "button", ctx.qry.head,
@@ -183,7 +483,7 @@ static int ls_item(const unsigned char *sha1, struct strbuf *base,
 	return 0;
 }
 
-static void ls_head(void)
+static void ls_head(int last_commits)
 {
 	cgit_print_layout_start();
 	html("<table summary='tree listing' class='list'>\n");
@@ -191,13 +491,37 @@ static void ls_head(void)
 	html("<th class='left'>Mode</th>");
 	html("<th class='left'>Name</th>");
 	html("<th class='right'>Size</th>");
+	if (last_commits) {
+		html("<th class='left'>Last commit</th>");
+		html("<th class='left'>Author</th>");
+		html("<th class='left'>Age</th>");
+	}
 	html("<th/>");
 	html("</tr>\n");
 }
 
-static void ls_tail(void)
+static void ls_tail(struct walk_tree_context *walk_tree_ctx)
 {
 	html("</table>\n");
+	if (walk_tree_ctx->first > 0 || walk_tree_ctx->last < walk_tree_ctx->nr) {
+		html("<ul class='pager'>");
+		if (walk_tree_ctx->first > 0) {
+			html("<li>");
+			cgit_tree_page_link("[prev]", NULL, NULL, ctx.qry.head,
+					    walk_tree_ctx->curr_rev, ctx.qry.path,
+					    walk_tree_ctx->first -
+					    ctx.cfg.max_tree_entries);
+			html("</li>");
+		}
+		if (walk_tree_ctx->last < walk_tree_ctx->nr) {
+			html("<li>");
+			cgit_tree_page_link("[next]", NULL, NULL, ctx.qry.head,
+					    walk_tree_ctx->curr_rev, ctx.qry.path,
+					    walk_tree_ctx->last);
+			html("</li>");
+		}
+		html("</ul>");
+	}
 	cgit_print_layout_end();
 }
 
@@ -207,6 +531,10 @@ static void ls_tree(const unsigned char *sha1, char *path, struct walk_tree_cont
 	struct pathspec paths = {
 		.nr = 0
 	};
+	struct string_list last_commits = STRING_LIST_INIT_DUP;
+	struct tree_desc desc;
+	struct name_entry entry;
+	int nr = 0;
 
 	tree = parse_tree_indirect(sha1);
 	if (!tree) {
@@ -215,38 +543,34 @@ static void ls_tree(const unsigned char *sha1, char *path, struct walk_tree_cont
 		return;
 	}
 
-	ls_head();
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry))
+		nr++;
+	walk_tree_ctx->first = 0;
+	walk_tree_ctx->last = nr;
+	if (ctx.cfg.max_tree_entries > 0 && nr > ctx.cfg.max_tree_entries) {
+		if (ctx.qry.ofs > 0 && ctx.qry.ofs < nr)
+			walk_tree_ctx->first = ctx.qry.ofs;
+		if (walk_tree_ctx->first + ctx.cfg.max_tree_entries < nr)
+			walk_tree_ctx->last = walk_tree_ctx->first +
+				ctx.cfg.max_tree_entries;
+	}
+	walk_tree_ctx->sizes = tree_sizes(tree, walk_tree_ctx->first,
+					  walk_tree_ctx->last);
+
+	if (ctx.repo->enable_tree_last_commit &&
+	    !cgit_last_commits(walk_tree_ctx->curr_rev, path, &last_commits))
+		walk_tree_ctx->last_commits = &last_commits;
+	ls_head(walk_tree_ctx->last_commits != NULL);
+	walk_tree_ctx->nr = 0;
 	read_tree_recursive(tree, "", 0, 1, &paths, ls_item, walk_tree_ctx);
-	ls_tail();
+	ls_tail(walk_tree_ctx);
+	walk_tree_ctx->last_commits = NULL;
+	string_list_clear(&last_commits, 0);
+	free(walk_tree_ctx->sizes);
 }
 
 
-static int walk_tree(const unsigned char *sha1, struct strbuf *base,
-		const char *pathname, unsigned mode, int stage, void *cbdata)
-{
-	struct walk_tree_context *walk_tree_ctx = cbdata;
-	static char buffer[PATH_MAX];
-
-	if (walk_tree_ctx->state == 0) {
-		memcpy(buffer, base->buf, base->len);
-		strcpy(buffer + base->len, pathname);
-		if (strcmp(walk_tree_ctx->match_path, buffer))
-			return READ_TREE_RECURSIVE;
-
-		if (S_ISDIR(mode)) {
-			walk_tree_ctx->state = 1;
-			ls_head();
-			return READ_TREE_RECURSIVE;
-		} else {
-			walk_tree_ctx->state = 2;
-			print_object(sha1, buffer, pathname, walk_tree_ctx->curr_rev);
-			return 0;
-		}
-	}
-	ls_item(sha1, base, pathname, mode, stage, walk_tree_ctx);
-	return 0;
-}
-
 /*
  * Show a tree or a blob
  *   rev:  the commit pointing at the root tree object
@@ -256,18 +580,11 @@ void cgit_print_tree(const char *rev, char *path)
 {
 	unsigned char sha1[20];
 	struct commit *commit;
-	struct pathspec_item path_items = {
-		.match = path,
-		.len = path ? strlen(path) : 0
-	};
-	struct pathspec paths = {
-		.nr = path ? 1 : 0,
-		.items = &path_items
-	};
 	struct walk_tree_context walk_tree_ctx = {
-		.match_path = path,
-		.state = 0
+		.last_commits = NULL
 	};
+	const char *basename;
+	unsigned mode;
 
 	if (!rev)
 		rev = ctx.qry.head;
@@ -291,13 +608,19 @@ void cgit_print_tree(const char *rev, char *path)
 		goto cleanup;
 	}
 
-	read_tree_recursive(commit->tree, "", 0, 0, &paths, walk_tree, &walk_tree_ctx);
-	if (walk_tree_ctx.state == 1)
-		ls_tail();
-	else if (walk_tree_ctx.state == 2)
-		cgit_print_layout_end();
-	else
+	if (cgit_get_path_entry(commit->tree->object.oid.hash, path, sha1,
+				&mode)) {
 		cgit_print_error_page(404, "Not found", "Path not found");
+		goto cleanup;
+	}
+	if (S_ISDIR(mode)) {
+		ls_tree(sha1, path, &walk_tree_ctx);
+		goto cleanup;
+	}
+	basename = strrchr(path, '/');
+	print_object(sha1, path, basename ? basename + 1 : path,
+		     walk_tree_ctx.curr_rev);
+	cgit_print_layout_end();
 
 cleanup:
 	free(walk_tree_ctx.curr_rev);